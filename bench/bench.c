@@ -0,0 +1,428 @@
+/*
+ * Ubiquiti RF Environment tool - microbenchmarks
+ *
+ * Runs the capture processing hot paths on deterministic synthetic
+ * captures. One line per case, the format is kept stable so that the
+ * results can be compared across commits:
+ *
+ *   <case> <param>=<value>... unit=<unit> ns/<unit>=<n> <unit>s/s=<n> allocs/<unit>=<n>
+ *
+ * The replay case runs synthetic scenes (see scene.h) through the scan
+ * pipeline and adds an accuracy line per scene, the check case compares
+ * the table helpers with known answers (see check.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+
+#include "../ubnt.h"
+#include "../fft_proc.h"
+#include "../mt_spectr.h"
+#include "../profile.h"
+#include "../occupancy.h"
+#include "../zoom.h"
+#include "../proc_pool.h"
+#include "scene.h"
+#include "bench.h"
+
+#define BENCH_VERSION       1
+#define BENCH_TONE_AMP      2000
+#define BENCH_NOISE_AMP     200
+
+/* allocations of the code under test, see BENCH_WRAP in the Makefile */
+static unsigned long bench_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    bench_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    bench_allocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    bench_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+unsigned long bench_alloc_count(void)
+{
+    return bench_allocs;
+}
+
+static uint32_t bench_seed;
+
+static uint32_t bench_rand(void)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 8;
+}
+
+/*
+ * A tone at a quarter of the band over uniform noise. The gain changes
+ * gsw_per_mille times per 1000 samples on average, every change opens a
+ * settling gap without windows in process_spectrum_data().
+ */
+static void bench_fill_capture(MTK_SPECTRUM_DATA *sd, unsigned int gsw_per_mille)
+{
+    int lna = 3, i;
+
+    bench_seed = 1;
+    for (i = 0; i < MTK_SPECTRUM_DATA_LEN; i++) {
+        if (bench_rand() % 1000 < gsw_per_mille)
+            lna = lna == 3 ? 2 : 3;
+        sd[i].Ival = BENCH_TONE_AMP * cos(M_PI * i / 2) + (int)(bench_rand() % (2 * BENCH_NOISE_AMP)) - BENCH_NOISE_AMP;
+        sd[i].Qval = BENCH_TONE_AMP * sin(M_PI * i / 2) + (int)(bench_rand() % (2 * BENCH_NOISE_AMP)) - BENCH_NOISE_AMP;
+        sd[i].LNA = lna;
+        sd[i].LPF = 0;
+    }
+}
+
+void bench_report(const char *name, const char *params, const char *unit,
+                  uint64_t ns, uint64_t units, unsigned long allocs)
+{
+    if (!units)
+        units = 1;
+    printf("%-16s %-20s unit=%-8s ns/%s=%.0f %ss/s=%.0f allocs/%s=%.2f\n",
+           name, params, unit, unit, (double)ns / units, unit,
+           ns ? units * 1e9 / ns : 0.0, unit, (double)allocs / units);
+}
+
+static void bench_fft(unsigned int iterations)
+{
+    static fft_t in, out;
+    unsigned int n, i, p;
+    unsigned long allocs;
+    uint64_t t, ns;
+    char params[32];
+
+    for (n = 128; n <= DFT_size_MAX; n *= 2) {
+        bench_seed = 1;
+        for (p = 0; p < n; p++) {
+            in.x[p][0] = cos(M_PI * p / 2) + (bench_rand() % 1000) / 10000.0;
+            in.x[p][1] = sin(M_PI * p / 2) + (bench_rand() % 1000) / 10000.0;
+        }
+        snprintf(params, sizeof(params), "dft=%u", n);
+
+        allocs = bench_allocs;
+        t = prof_now();
+        for (i = 0; i < iterations; i++)
+            fft(n, &in, &out);
+        ns = prof_now() - t;
+        bench_report("fft", params, "window", ns, iterations, bench_allocs - allocs);
+
+        allocs = bench_allocs;
+        t = prof_now();
+        for (i = 0; i < iterations; i++)
+            fftshift(&out, n, 2);
+        ns = prof_now() - t;
+        bench_report("fftshift", params, "window", ns, iterations, bench_allocs - allocs);
+    }
+}
+
+static void bench_process(mtk_ssd_info_t *pinfo, MTK_SPECTRUM_DATA *sd, unsigned int iterations)
+{
+    static const unsigned int densities[] = { 0, 1, 10, 50 };
+    unsigned int chan_width, d, i;
+    unsigned long allocs;
+    uint64_t t, ns, windows;
+    uint16_t sample_idx;
+    char params[32];
+
+    for (chan_width = 0; (1U << (7 + chan_width)) <= DFT_size_MAX; chan_width++) {
+        for (d = 0; d < ARRAY_SIZE(densities); d++) {
+            bench_fill_capture(sd, densities[d]);
+            snprintf(params, sizeof(params), "dft=%u gsw=%u", psd_dft_size(&pinfo->psd, chan_width), densities[d]);
+
+            windows = 0;
+            allocs = bench_allocs;
+            t = prof_now();
+            for (i = 0; i < iterations; i++)
+                windows += process_spectrum_data(sd, pinfo, chan_width, 2437);
+            ns = prof_now() - t;
+            bench_report("process", params, "window", ns, windows, bench_allocs - allocs);
+
+            /* the histograms are only fed 20 MHz windows by the scan */
+            if (chan_width)
+                continue;
+            windows = 0;
+            allocs = bench_allocs;
+            t = prof_now();
+            for (i = 0; i < iterations; i++) {
+                for (sample_idx = 0; sample_idx < pinfo->window_num; sample_idx++) {
+                    pinfo->pssd[sample_idx].ch_width = BW_20;
+                    ubnt_process_spectral_data(pinfo, sample_idx);
+                }
+                windows += pinfo->window_num;
+            }
+            ns = prof_now() - t;
+            bench_report("histogram", params, "window", ns, windows, bench_allocs - allocs);
+        }
+    }
+}
+
+static void bench_occupancy(MTK_SPECTRUM_DATA *sd, unsigned int iterations)
+{
+    static const unsigned int densities[] = { 0, 10 };
+    struct occupancy occ;
+    unsigned long allocs;
+    uint64_t t, ns;
+    unsigned int d, i;
+    char params[32];
+
+    for (d = 0; d < ARRAY_SIZE(densities); d++) {
+        bench_fill_capture(sd, densities[d]);
+        snprintf(params, sizeof(params), "gsw=%u", densities[d]);
+        occupancy_reset(&occ);
+        allocs = bench_allocs;
+        t = prof_now();
+        for (i = 0; i < iterations; i++)
+            process_occupancy_data(sd, 0, 2437, &occ);
+        ns = prof_now() - t;
+        bench_report("occupancy", params, "capture", ns, iterations, bench_allocs - allocs);
+    }
+}
+
+/* the tone of bench_fill_capture() sits at fc + 5 MHz, zoomed with decreasing spans */
+static void bench_zoom(MTK_SPECTRUM_DATA *sd, unsigned int iterations)
+{
+    static const char *specs[] = { "2442:4", "2442:2", "2442:0.5" };
+    static struct zoom_spectrum zoom;
+    unsigned long allocs;
+    uint64_t t, ns;
+    unsigned int s, i, p, peak;
+    char params[32];
+
+    bench_fill_capture(sd, 0);
+    for (s = 0; s < ARRAY_SIZE(specs); s++) {
+        zoom_parse(&zoom.cfg, specs[s]);
+        zoom_reset(&zoom);
+        allocs = bench_allocs;
+        t = prof_now();
+        for (i = 0; i < iterations; i++)
+            process_zoom_data(sd, 0, 2437, &zoom);
+        ns = prof_now() - t;
+        for (p = peak = 0; p < ZOOM_DFT_SIZE; p++)
+            peak = zoom.pwr[p] > zoom.pwr[peak] ? p : peak;
+        snprintf(params, sizeof(params), "span=%s res_khz=%.1f", strchr(specs[s], ':') + 1,
+                 20000.0 / zoom.decim / ZOOM_DFT_SIZE);
+        bench_report("zoom", params, "capture", ns, iterations, bench_allocs - allocs);
+        printf("%-16s %-20s segments/capture=%u peak_offset_khz=%.1f\n", "zoom", params,
+               zoom.segments / MAX(zoom.captures, 1),
+               ((int)peak - ZOOM_DFT_SIZE / 2) * 20000.0 / zoom.decim / ZOOM_DFT_SIZE);
+    }
+}
+
+/*
+ * Four capture nodes processed one after the other and on a pool of four
+ * workers, then combined. The nodes differ in their gain switching.
+ */
+static void bench_chains(mtk_ssd_info_t *pinfo, unsigned int iterations)
+{
+    static const unsigned int densities[PROC_POOL_MAX_BATCH] = { 0, 1, 10, 50 };
+    static const char *modes[] = { "max", "avg" };
+    MTK_SPECTRUM_DATA *sd[PROC_POOL_MAX_BATCH] = { NULL };
+    mtk_ssd_info_t chain[PROC_POOL_MAX_BATCH] = { { 0 } }, *info[PROC_POOL_MAX_BATCH];
+    unsigned long allocs;
+    uint64_t t, ns;
+    unsigned int c, i, workers, mode;
+    char params[32];
+
+    for (c = 0; c < PROC_POOL_MAX_BATCH; c++) {
+        sd[c] = malloc(MTK_SPECTRUM_DATA_LEN * sizeof(MTK_SPECTRUM_DATA));
+        chain[c] = *pinfo;
+        chain[c].pssd = malloc(SPECTRAL_SAMP_DATA_LEN * sizeof(SPECTRAL_SAMP_DATA));
+        info[c] = &chain[c];
+        if (!sd[c] || !chain[c].pssd) {
+            fprintf(stderr, "not enough memory\n");
+            goto out;
+        }
+        bench_fill_capture(sd[c], densities[c]);
+    }
+
+    for (workers = 0; workers <= PROC_POOL_MAX_BATCH; workers += PROC_POOL_MAX_BATCH) {
+        if (workers && proc_pool_start(workers, false))
+            break;
+        snprintf(params, sizeof(params), "nodes=%d pool=%u", PROC_POOL_MAX_BATCH, workers);
+        allocs = bench_allocs;
+        t = prof_now();
+        for (i = 0; i < iterations; i++)
+            proc_pool_run_batch(sd, info, PROC_POOL_MAX_BATCH, 0, 2437);
+        ns = prof_now() - t;
+        bench_report("chains", params, "capture", ns, iterations, bench_allocs - allocs);
+        if (workers)
+            proc_pool_stop();
+    }
+
+    for (mode = 0; mode < ARRAY_SIZE(modes); mode++) {
+        snprintf(params, sizeof(params), "nodes=%d %s", PROC_POOL_MAX_BATCH, modes[mode]);
+        allocs = bench_allocs;
+        t = prof_now();
+        for (i = 0; i < iterations; i++)
+            combine_spectrum_data(pinfo, info, PROC_POOL_MAX_BATCH, mode ? CHAIN_AVERAGE : CHAIN_MAX_HOLD, 0, 2437);
+        ns = prof_now() - t;
+        bench_report("combine", params, "window", ns, (uint64_t)iterations * pinfo->window_num,
+                     bench_allocs - allocs);
+    }
+
+out:
+    for (c = 0; c < PROC_POOL_MAX_BATCH; c++) {
+        free(sd[c]);
+        free(chain[c].pssd);
+    }
+}
+
+static void bench_parse(MTK_SPECTRUM_DATA *sd, unsigned int iterations)
+{
+    char dir[] = "/tmp/rf-env-bench.XXXXXX";
+    char iq_file[64], lna_lpf_file[64];
+    unsigned long allocs;
+    uint64_t t, ns, bytes = 0;
+    unsigned int i;
+    char params[32];
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return;
+    }
+    snprintf(iq_file, sizeof(iq_file), "%s/iq.txt", dir);
+    snprintf(lna_lpf_file, sizeof(lna_lpf_file), "%s/lna_lpf.txt", dir);
+    bench_fill_capture(sd, 10);
+    if (!scene_write_capture(iq_file, lna_lpf_file, sd)) {
+        allocs = bench_allocs;
+        t = prof_now();
+        for (i = 0; i < iterations; i++)
+            bytes += fill_scan_data_from_files(sd, iq_file, lna_lpf_file);
+        ns = prof_now() - t;
+        snprintf(params, sizeof(params), "bytes=%lu", (unsigned long)(bytes / iterations));
+        bench_report("parse", params, "capture", ns, iterations, bench_allocs - allocs);
+    } else {
+        perror("bench files");
+    }
+    unlink(iq_file);
+    unlink(lna_lpf_file);
+    rmdir(dir);
+}
+
+static void print_usage(void)
+{
+    printf("Usage: rf-env-bench [-n iterations] [-c case] [-s scene] [-N captures] [-g dir] [-P estimator] [-R points]\n");
+    printf("  -n <iterations>    per case, the captures are scaled down (default 2000)\n");
+    printf("  -c <case>          fft, process, occupancy, zoom, chains, parse, replay or check (default all)\n");
+    printf("  -s <scene>         replay only this scene, a built-in name or a description (see scene.h)\n");
+    printf("  -N <captures>      captures replayed per scene (default 8)\n");
+    printf("  -g <dir>           write the captures of the scene to dir instead of benchmarking\n");
+    printf("  -P <estimator>     Welch spectra of process and replay, as rf-env -P\n");
+    printf("  -R <points>        DFT points per 20 MHz of process and replay, as rf-env -R\n");
+    printf("  -h                 show this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct chan_info chan_list[11];
+    mtk_ssd_info_t info = { 0 };
+    MTK_SPECTRUM_DATA *sd;
+    unsigned int iterations = 2000;
+    const char *only = NULL, *scene = NULL, *gen_dir = NULL;
+    unsigned int captures = 8;
+    int i, c, ret = 0;
+
+    while ((c = getopt(argc, argv, "hn:c:s:N:g:P:R:")) != -1) {
+        switch (c) {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            only = optarg;
+            break;
+        case 's':
+            scene = optarg;
+            break;
+        case 'N':
+            captures = strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            gen_dir = optarg;
+            break;
+        case 'P':
+            if (psd_parse(&info.psd, optarg)) {
+                fprintf(stderr, "bad estimator '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'R':
+            if (psd_set_dft_size(&info.psd, strtoul(optarg, NULL, 0))) {
+                fprintf(stderr, "bad DFT size '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return c == 'h' ? 0 : -1;
+        }
+    }
+    if (!iterations)
+        iterations = 1;
+
+    sd = malloc(MTK_SPECTRUM_DATA_LEN * sizeof(MTK_SPECTRUM_DATA));
+    info.pssd = malloc(SPECTRAL_SAMP_DATA_LEN * sizeof(SPECTRAL_SAMP_DATA));
+    if (!sd || !info.pssd) {
+        fprintf(stderr, "not enough memory\n");
+        return -1;
+    }
+    if (gen_dir) {
+        ret = replay_generate(sd, scene ? scene : "mixed", captures, gen_dir);
+        goto out;
+    }
+    for (i = 0; i < ARRAY_SIZE(chan_list); i++) {
+        chan_list[i].channel = i + 1;
+        chan_list[i].bw = BW_20;
+        chan_list[i].freq_center = ieee80211_channel_to_frequency(i + 1, NL80211_BAND_2GHZ);
+    }
+    ubnt_init(ARRAY_SIZE(chan_list), chan_list, NL80211_BAND_2GHZ);
+    info.chan_list = NULL;
+    info.current_channel = BENCH_CHANNEL;
+
+    printf("# rf-env-bench %d iterations=%u\n", BENCH_VERSION, iterations);
+    if (!only || !strcmp(only, "fft"))
+        bench_fft(iterations * 10);
+    if (!only || !strcmp(only, "process"))
+        bench_process(&info, sd, MAX(iterations / 100, 1));
+    if (!only || !strcmp(only, "occupancy"))
+        bench_occupancy(sd, MAX(iterations / 100, 1));
+    if (!only || !strcmp(only, "zoom"))
+        bench_zoom(sd, MAX(iterations / 100, 1));
+    if (!only || !strcmp(only, "chains"))
+        bench_chains(&info, MAX(iterations / 400, 1));
+    if (!only || !strcmp(only, "parse"))
+        bench_parse(sd, MAX(iterations / 200, 1));
+    if ((!only || !strcmp(only, "check")) && bench_check())
+        ret = -1;
+    if (!only || !strcmp(only, "replay")) {
+        for (i = 0; scene ? !i : !!scene_builtin_name(i); i++) {
+            if (replay_scene(&info, sd, scene ? scene : scene_builtin_name(i), captures))
+                ret = -1;
+        }
+    }
+
+    ubnt_cleanup(&info);
+out:
+    free(info.pssd);
+    free(sd);
+    return ret;
+}
@@ -0,0 +1,19 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+#include "../mt_spectr.h"
+
+#define BENCH_CHANNEL       6
+
+unsigned long bench_alloc_count(void);
+void bench_report(const char *name, const char *params, const char *unit,
+                  uint64_t ns, uint64_t units, unsigned long allocs);
+
+int replay_scene(mtk_ssd_info_t *pinfo, MTK_SPECTRUM_DATA *sd, const char *scene, unsigned int captures);
+int replay_generate(MTK_SPECTRUM_DATA *sd, const char *scene, unsigned int captures, const char *dir);
+
+int bench_check(void);
+
+#endif //BENCH_H
@@ -0,0 +1,201 @@
+/*
+ * Ubiquiti RF Environment tool - table checks
+ *
+ * Known answers of the table helpers, one line per check:
+ *
+ *   check <name> cases=<n> failed=<n>
+ *
+ * and a line per failed case. Any failure makes the bench exit non-zero.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../ubnt.h"
+#include "../rftable_bin.h"
+#include "bench.h"
+
+#define CHECK_BIN_CHANNELS  4
+#define CHECK_BIN_WIDTH     40
+
+struct bonded_case {
+    uint8_t channel;
+    uint8_t bw;
+    uint16_t start;                                 /* 0 - no such block */
+    uint16_t end;
+};
+
+static const struct bonded_case bonded_cases[] = {
+    { 36,  BW_40,  5170, 5210 },
+    { 64,  BW_80,  5250, 5330 },
+    { 36,  BW_160, 5170, 5330 },
+    { 64,  BW_160, 5170, 5330 },
+    { 100, BW_160, 5490, 5650 },
+    { 128, BW_160, 5490, 5650 },
+    { 132, BW_160, 0, 0 },
+    { 144, BW_160, 0, 0 },
+    { 144, BW_40,  5690, 5730 },
+    { 144, BW_80,  5650, 5730 },
+    { 149, BW_40,  5735, 5775 },
+    { 161, BW_80,  5735, 5815 },
+    { 149, BW_160, 0, 0 },
+    { 165, BW_40,  0, 0 },
+    { 165, BW_80,  0, 0 },
+    { 165, BW_20,  5815, 5835 },
+};
+
+/* ubnt_bonded_range() over the 5G blocks, the ones that do not exist included */
+static unsigned int check_bonded(void)
+{
+    const struct bonded_case *c;
+    uint16_t start, end;
+    unsigned int i, failed = 0;
+    int ret;
+
+    for (i = 0; i < ARRAY_SIZE(bonded_cases); i++) {
+        c = &bonded_cases[i];
+        ret = ubnt_bonded_range(ieee80211_channel_to_frequency(c->channel, NL80211_BAND_5GHZ), c->bw,
+                                NL80211_BAND_5GHZ, &start, &end);
+        if (c->start ? (ret || start != c->start || end != c->end) : !ret) {
+            printf("check bonded ch=%u bw=%u: got %d [%u, %u), expected [%u, %u)\n", c->channel, 20 << c->bw,
+                   ret, ret ? 0 : start, ret ? 0 : end, c->start, c->end);
+            failed++;
+        }
+    }
+    printf("check %-11s cases=%u failed=%u\n", "bonded", i, failed);
+    return failed;
+}
+
+/* a table with sparse and dense histograms, the same for every run */
+static void check_fill_usi(struct ubnt_spectral_info *usi, struct ubnt_spectral_stats *table, uint32_t **rows,
+                           uint32_t *counts, uint32_t *hist)
+{
+    unsigned int i, k;
+
+    memset(usi, 0, sizeof(*usi));
+    usi->table = table;
+    usi->count = CHECK_BIN_CHANNELS;
+    usi->width = CHECK_BIN_WIDTH;
+    usi->rssi_histograms = rows;
+    usi->rssi_histograms_counts = counts;
+    usi->num_processed = 1234;
+    for (i = 0; i < CHECK_BIN_CHANNELS; i++) {
+        memset(&table[i], 0, sizeof(table[i]));
+        table[i].channel = 36 + 4 * i;
+        table[i].chan_width = i % 2 ? BW_40 : BW_20;
+        table[i].freq_center = ieee80211_channel_to_frequency(table[i].channel, NL80211_BAND_5GHZ);
+        table[i].utilization = 10 * i;
+        table[i].interference = -95 + (int)i;
+        for (k = i; k < UBNT_RSSI_HISTOGRAM_SIZE; k += 7 + i) {
+            table[i].rssi_histogram[k] = 1000 * k + i;
+            table[i].normalized_rssi_histogram[k] = k % 101;
+            table[i].total_samples += table[i].rssi_histogram[k];
+        }
+    }
+    for (i = 0; i < CHECK_BIN_WIDTH; i++) {
+        rows[i] = hist + i * UBNT_RSSI_HISTOGRAM_SIZE;
+        memset(rows[i], 0, UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t));
+        counts[i] = 0;
+        for (k = 0; i % 5 && k < UBNT_RSSI_HISTOGRAM_SIZE; k++) {
+            rows[i][k] = (k * 31 + i) % 17 ? 0 : 70000 + k;
+            counts[i] += rows[i][k];
+        }
+    }
+}
+
+static bool check_usi_equal(const struct ubnt_spectral_info *a, const struct ubnt_spectral_info *b)
+{
+    unsigned int i;
+
+    if (a->count != b->count || a->width != b->width || a->num_processed != b->num_processed)
+        return false;
+    for (i = 0; i < a->count; i++) {
+        if (a->table[i].channel != b->table[i].channel ||
+            a->table[i].chan_width != b->table[i].chan_width ||
+            a->table[i].freq_center != b->table[i].freq_center ||
+            a->table[i].utilization != b->table[i].utilization ||
+            a->table[i].interference != b->table[i].interference ||
+            a->table[i].total_samples != b->table[i].total_samples ||
+            memcmp(a->table[i].rssi_histogram, b->table[i].rssi_histogram, sizeof(a->table[i].rssi_histogram)) ||
+            memcmp(a->table[i].normalized_rssi_histogram, b->table[i].normalized_rssi_histogram,
+                   sizeof(a->table[i].normalized_rssi_histogram)))
+            return false;
+    }
+    for (i = 0; i < a->width; i++) {
+        if (a->rssi_histograms_counts[i] != b->rssi_histograms_counts[i] ||
+            memcmp(a->rssi_histograms[i], b->rssi_histograms[i], UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t)))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * The binary table read back says what was written: the decoded table,
+ * the suggested channels and the table id, and the same JSON table as
+ * rftable_bin_verify() (the check VERIFY_BINARY_TABLE runs in rf-env).
+ */
+static unsigned int check_rftable_bin(void)
+{
+    static const struct channel_bw suggested[] = { { 40, BW_20 }, { 44, BW_40 }, { 36, BW_20 } };
+    static struct ubnt_spectral_stats table[CHECK_BIN_CHANNELS];
+    static uint32_t hist[CHECK_BIN_WIDTH * UBNT_RSSI_HISTOGRAM_SIZE];
+    uint32_t *rows[CHECK_BIN_WIDTH], counts[CHECK_BIN_WIDTH];
+    char dir[] = "/tmp/rf-env-check.XXXXXX";
+    struct ubnt_spectral_info usi;
+    struct rftable_bin tb;
+    char path[64];
+    unsigned int i, failed = 0;
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/rftable.bin", dir);
+    check_fill_usi(&usi, table, rows, counts, hist);
+
+    if (rftable_bin_write(path, &usi, true, suggested, ARRAY_SIZE(suggested), 42) ||
+        rftable_bin_load(path, &tb)) {
+        printf("check rftable_bin: cannot write and read back %s\n", path);
+        failed++;
+    } else {
+        if (tb.version != RFTABLE_BIN_VERSION || !tb.band_5g || tb.table_id != 42 ||
+            tb.spectrum_start != UBNT_RSSI_SPECTRUM_START_5G) {
+            printf("check rftable_bin: header version=%u band_5g=%d table_id=%u start=%u\n", tb.version,
+                   tb.band_5g, tb.table_id, tb.spectrum_start);
+            failed++;
+        }
+        if (!check_usi_equal(&usi, &tb.usi)) {
+            printf("check rftable_bin: decoded table differs\n");
+            failed++;
+        }
+        for (i = 0; i < ARRAY_SIZE(suggested); i++) {
+            if (tb.suggested_count != ARRAY_SIZE(suggested) || tb.suggested[i].channel != suggested[i].channel ||
+                tb.suggested[i].bw != suggested[i].bw) {
+                printf("check rftable_bin: suggested channel %u differs\n", i);
+                failed++;
+                break;
+            }
+        }
+        rftable_bin_free(&tb);
+        if (rftable_bin_verify(path, &usi, suggested, ARRAY_SIZE(suggested))) {
+            printf("check rftable_bin: JSON table differs\n");
+            failed++;
+        }
+    }
+    unlink(path);
+    rmdir(dir);
+    printf("check %-11s cases=%u failed=%u\n", "rftable_bin", 4, failed);
+    return failed;
+}
+
+int bench_check(void)
+{
+    unsigned int failed = 0;
+
+    failed += check_bonded();
+    failed += check_rftable_bin();
+    return failed ? -1 : 0;
+}
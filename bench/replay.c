@@ -0,0 +1,199 @@
+/*
+ * Ubiquiti RF Environment tool - scene replay
+ *
+ * Runs the scan pipeline of a channel (capture files, parser,
+ * process_spectrum_data(), histograms, channel statistics) over rendered
+ * scenes, and compares what it reports with the scene truth.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../ubnt.h"
+#include "../fft_proc.h"
+#include "../profile.h"
+#include "../rssi_sketch.h"
+#include "../occupancy.h"
+#include "scene.h"
+#include "bench.h"
+
+#define REPLAY_SEED     1
+#define REPLAY_MHZ      20
+#define REPLAY_PATH_LEN 256
+
+/* what the pipeline would report if every window had the ideal bin levels */
+struct replay_truth {
+    struct rssi_sketch chan;
+    struct rssi_sketch mhz[REPLAY_MHZ];
+    uint32_t hist[REPLAY_MHZ][UBNT_RSSI_HISTOGRAM_SIZE];
+    uint32_t count[REPLAY_MHZ];
+};
+
+/* a window of truth, accounted as process_spectrum_data() and ubnt_process_spectral_data() do */
+static void replay_truth_add(struct replay_truth *truth, const int16_t *row, unsigned int dft_size)
+{
+    unsigned int p, bin_count = 0, mhz;
+    int rssi = 0, level;
+
+    for (p = 0; p < dft_size; p++) {
+        if (row[p]) {
+            rssi += row[p] - UBNT_HISTOGRAM_START_DBM;
+            bin_count++;
+        }
+    }
+    if (bin_count)
+        rssi /= (int)bin_count;
+    if (rssi < 0)
+        return;
+    rssi_sketch_add(&truth->chan, rssi, 1);
+
+    for (p = 0; p < dft_size; p++) {
+        level = row[p] ? row[p] : 1;
+        mhz = REPLAY_MHZ * p / dft_size;
+        truth->hist[mhz][MAX(MIN(level >> 1, UBNT_RSSI_HISTOGRAM_SIZE - 1), 0)]++;
+        truth->count[mhz]++;
+        rssi_sketch_add(&truth->mhz[mhz], level, 1);
+    }
+}
+
+static void replay_accuracy(const struct scene *sc, const struct replay_truth *truth, uint16_t fc_mhz)
+{
+    struct ubnt_spectral_info *usi = get_usi_p();
+    struct ubnt_spectral_stats *uss = ubnt_get_channel_stats(BENCH_CHANNEL, BW_20);
+    int rssi, interference, err, err_max = 0, mhz, bin, i;
+    double err_sum = 0, emd_sum = 0, cdf;
+    char params[48];
+
+    rssi = rssi_sketch_quantile(&truth->chan, UBNT_INTERFERENCE_POWER_PERCENTILE);
+    interference = ubnt_convert_to_dbm(rssi > 1 ? rssi - 1 : 1, BW_20);
+
+    for (mhz = 0; mhz < REPLAY_MHZ; mhz++) {
+        bin = fc_mhz - REPLAY_MHZ / 2 + mhz - UBNT_RSSI_SPECTRUM_START_2G;
+        err = abs(ubnt_get_mhz_percentile(fc_mhz - REPLAY_MHZ / 2 + mhz, 50) -
+                  rssi_sketch_quantile(&truth->mhz[mhz], 50));
+        err_sum += err;
+        err_max = MAX(err_max, err);
+        /* earth mover's distance of the normalized histograms, 2 dB per bin */
+        cdf = 0;
+        for (i = 0; i < UBNT_RSSI_HISTOGRAM_SIZE; i++) {
+            cdf += (double)usi->rssi_histograms[bin][i] / MAX(usi->rssi_histograms_counts[bin], 1) -
+                   (double)truth->hist[mhz][i] / MAX(truth->count[mhz], 1);
+            emd_sum += 2 * fabs(cdf);
+        }
+    }
+
+    snprintf(params, sizeof(params), "scene=%s", sc->name);
+    printf("%-16s %-20s interference=%d truth=%d err_db=%d mhz_p50_err_db=%.2f mhz_p50_err_max_db=%d hist_emd_db=%.2f\n",
+           "accuracy", params, uss ? uss->interference : 0, interference,
+           uss ? uss->interference - interference : 0,
+           err_sum / REPLAY_MHZ, err_max, emd_sum / REPLAY_MHZ);
+}
+
+static int replay_resolve(struct scene *sc, const char *scene)
+{
+    const char *spec = scene_builtin(scene);
+
+    /* not a built-in one, take it as a description */
+    return scene_parse(sc, spec ? scene : "custom", spec ? spec : scene);
+}
+
+/*
+ * Replay captures of a scene on BENCH_CHANNEL (20 MHz), the statistics
+ * are cleared first. Only the pipeline is timed, not the rendering.
+ */
+int replay_scene(mtk_ssd_info_t *pinfo, MTK_SPECTRUM_DATA *sd, const char *scene, unsigned int captures)
+{
+    char dir[] = "/tmp/rf-env-replay.XXXXXX";
+    char iq_file[64], lna_lpf_file[64], params[48];
+    const uint16_t fc_mhz = ieee80211_channel_to_frequency(BENCH_CHANNEL, NL80211_BAND_2GHZ);
+    struct replay_truth *truth;
+    struct scene sc;
+    int16_t *levels;
+    uint64_t t, ns = 0, windows = 0;
+    unsigned long allocs = 0;
+    unsigned int capture, p;
+    uint16_t sample_idx;
+    int ret = -1;
+
+    if (replay_resolve(&sc, scene))
+        return -1;
+    truth = calloc(1, sizeof(*truth));
+    levels = malloc(MTK_SPECTRUM_DATA_LEN * sizeof(int16_t));
+    if (!truth || !levels || !mkdtemp(dir))
+        goto out;
+    snprintf(iq_file, sizeof(iq_file), "%s/%s", dir, "WifiSpectrum_IQ.txt");
+    snprintf(lna_lpf_file, sizeof(lna_lpf_file), "%s/%s", dir, "WifiSpectrum_LNA_LPF.txt");
+
+    ubnt_clear_scan_data();
+    pinfo->current_channel = BENCH_CHANNEL;
+    for (capture = 0; capture < captures; capture++) {
+        scene_render(&sc, capture, REPLAY_SEED, sd, levels);
+        for (p = 0; p + scene_dft_size(&sc) <= MTK_SPECTRUM_DATA_LEN; p += scene_dft_size(&sc))
+            replay_truth_add(truth, &levels[p], scene_dft_size(&sc));
+        if (scene_write_capture(iq_file, lna_lpf_file, sd)) {
+            perror("replay capture");
+            goto out_files;
+        }
+
+        allocs -= bench_alloc_count();
+        t = prof_now();
+        fill_scan_data_from_files(sd, iq_file, lna_lpf_file);
+        process_occupancy_data(sd, sc.chan_width, fc_mhz, ubnt_get_channel_occupancy(BENCH_CHANNEL));
+        process_spectrum_data(sd, pinfo, sc.chan_width, fc_mhz);
+        for (sample_idx = 0; sample_idx < pinfo->window_num; sample_idx++) {
+            pinfo->pssd[sample_idx].ch_width = BW_20;
+            ubnt_process_spectral_data(pinfo, sample_idx);
+        }
+        ns += prof_now() - t;
+        allocs += bench_alloc_count();
+        windows += pinfo->window_num;
+    }
+    ubnt_process_channel_data(BENCH_CHANNEL, BW_20);
+
+    snprintf(params, sizeof(params), "scene=%s", sc.name);
+    bench_report("replay", params, "window", ns, windows, allocs);
+    printf("%-16s %-20s captures=%u captures/s=%.1f duty=%.1f\n", "replay", params, captures,
+           ns ? captures * 1e9 / ns : 0.0, occupancy_duty(ubnt_get_channel_occupancy(BENCH_CHANNEL)));
+    replay_accuracy(&sc, truth, fc_mhz);
+    ret = 0;
+
+out_files:
+    unlink(iq_file);
+    unlink(lna_lpf_file);
+    rmdir(dir);
+out:
+    free(levels);
+    free(truth);
+    return ret;
+}
+
+/* <scene>_2g_ch<BENCH_CHANNEL>_<n>_IQ.txt / _LNA_LPF.txt pairs in dir, as the offline mode reads them */
+int replay_generate(MTK_SPECTRUM_DATA *sd, const char *scene, unsigned int captures, const char *dir)
+{
+    char iq_file[REPLAY_PATH_LEN], lna_lpf_file[REPLAY_PATH_LEN];
+    struct scene sc;
+    unsigned int capture;
+
+    if (replay_resolve(&sc, scene))
+        return -1;
+    if (mkdir(dir, 0755) && errno != EEXIST) {
+        perror(dir);
+        return -1;
+    }
+    for (capture = 0; capture < captures; capture++) {
+        snprintf(iq_file, sizeof(iq_file), "%s/%s_2g_ch%d_%03u_IQ.txt", dir, sc.name, BENCH_CHANNEL, capture);
+        snprintf(lna_lpf_file, sizeof(lna_lpf_file), "%s/%s_2g_ch%d_%03u_LNA_LPF.txt", dir, sc.name, BENCH_CHANNEL, capture);
+        scene_render(&sc, capture, REPLAY_SEED, sd, NULL);
+        if (scene_write_capture(iq_file, lna_lpf_file, sd)) {
+            perror(iq_file);
+            return -1;
+        }
+        printf("%s %s\n", iq_file, lna_lpf_file);
+    }
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * Ubiquiti RF Environment tool - synthetic RF scenes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <complex.h>
+
+#include "../fft_proc.h"
+#include "scene.h"
+
+#define WIFI_SUBCARRIERS    26                      /* each side of DC */
+#define WIFI_SPACING_KHZ    312.5
+#define WIFI_SYMBOL_MAX     (64 << 2)
+
+static const struct {
+    const char *name;
+    const char *spec;
+} scene_builtins[] = {
+    { "quiet", "noise:5" },
+    { "cw",    "noise:5;cw:3125:40" },
+    { "wifi",  "noise:5;wifi:0:20:600:0.4" },
+    { "oven",  "noise:5;oven:-4000:35:0.5" },
+    { "mixed", "noise:6;cw:-6250:30;wifi:0:15:300:0.3;oven:4000:35:0.5;gsw:5" },
+};
+
+/* total gain of process_spectrum_data(), the scenes only use LNA 2 and 3 */
+static const uint8_t scene_lna_gain[4] = { 3, 21, 33, 45 };
+
+const char *scene_builtin(const char *name)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(scene_builtins); i++) {
+        if (!strcmp(scene_builtins[i].name, name))
+            return scene_builtins[i].spec;
+    }
+    return NULL;
+}
+
+/* NULL past the last one */
+const char *scene_builtin_name(int idx)
+{
+    return (idx >= 0 && idx < ARRAY_SIZE(scene_builtins)) ? scene_builtins[idx].name : NULL;
+}
+
+int scene_parse(struct scene *sc, const char *name, const char *spec)
+{
+    char buf[256], *item, *save = NULL;
+    struct scene_source *src;
+
+    memset(sc, 0, sizeof(*sc));
+    snprintf(sc->name, sizeof(sc->name), "%s", name);
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (item = strtok_r(buf, ";", &save); item; item = strtok_r(NULL, ";", &save)) {
+        if (sscanf(item, "noise:%lf", &sc->noise) == 1 ||
+            sscanf(item, "gsw:%u", &sc->gsw_per_mille) == 1)
+            continue;
+        if (sc->count == SCENE_MAX_SOURCES) {
+            fprintf(stderr, "scene %s: more than %d sources\n", name, SCENE_MAX_SOURCES);
+            return -1;
+        }
+        src = &sc->src[sc->count];
+        if (sscanf(item, "cw:%d:%lf", &src->offset_khz, &src->level) == 2) {
+            src->type = SCENE_CW;
+            src->duty = 1;
+        } else if (sscanf(item, "wifi:%d:%lf:%lf:%lf", &src->offset_khz, &src->level,
+                          &src->burst_us, &src->duty) == 4 && src->burst_us > 0) {
+            src->type = SCENE_WIFI;
+        } else if (sscanf(item, "oven:%d:%lf:%lf", &src->offset_khz, &src->level, &src->duty) == 3) {
+            src->type = SCENE_OVEN;
+        } else {
+            fprintf(stderr, "scene %s: bad item '%s'\n", name, item);
+            return -1;
+        }
+        sc->count++;
+    }
+    return 0;
+}
+
+unsigned int scene_dft_size(const struct scene *sc)
+{
+    return 1 << (7 + sc->chan_width);
+}
+
+static uint32_t scene_rand(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/* uniform in (0, 1) */
+static double scene_uniform(uint32_t *seed)
+{
+    return (scene_rand(seed) + 0.5) / (1 << 24);
+}
+
+static double complex scene_gauss(uint32_t *seed)
+{
+    double r = sqrt(-2 * log(scene_uniform(seed)));
+    double a = 2 * M_PI * scene_uniform(seed);
+
+    return r * cos(a) + r * sin(a) * I;
+}
+
+static double scene_lin(double level)
+{
+    return pow(10, level / 10);
+}
+
+/* samples until the next wifi state change: fixed bursts, exponential gaps */
+static long scene_wifi_next(const struct scene_source *src, bool on, double fs_khz, uint32_t *seed)
+{
+    double burst = src->burst_us * fs_khz / 1000;
+
+    if (on)
+        return MAX((long)burst, 1);
+    return MAX((long)(-burst * (1 - src->duty) / src->duty * log(scene_uniform(seed))), 1);
+}
+
+static int scene_bin(int offset_khz, unsigned int dft_size, double fs_khz)
+{
+    return dft_size / 2 + lround(offset_khz * dft_size / fs_khz);
+}
+
+/* ideal levels of a block: noise plus the sources that were on for most of it */
+static void scene_truth_row(const struct scene *sc, const unsigned int *on, const double *freq_khz,
+                            unsigned int dft_size, double fs_khz, int16_t *row)
+{
+    double lin[DFT_size_MAX];
+    unsigned int p;
+    int s, bin;
+
+    for (p = 0; p < dft_size; p++)
+        lin[p] = scene_lin(sc->noise);
+    for (s = 0; s < sc->count; s++) {
+        if (on[s] * 2 < dft_size)
+            continue;
+        switch (sc->src[s].type) {
+        case SCENE_WIFI:
+            for (p = 0; p < dft_size; p++) {
+                if (fabs((p - dft_size / 2.0) * fs_khz / dft_size - sc->src[s].offset_khz) <=
+                    WIFI_SUBCARRIERS * WIFI_SPACING_KHZ)
+                    lin[p] += scene_lin(sc->src[s].level);
+            }
+            break;
+        default:
+            bin = scene_bin(freq_khz[s], dft_size, fs_khz);
+            if (bin >= 0 && bin < dft_size)
+                lin[bin] += scene_lin(sc->src[s].level);
+            break;
+        }
+    }
+    for (p = 0; p < dft_size; p++)
+        row[p] = (int16_t)(10 * log10(lin[p]));
+}
+
+/*
+ * Render capture number `capture` of the scene into sd. The gain switches
+ * are undone by the sample scaling, as the AGC of the radio would. With
+ * truth, also fill MTK_SPECTRUM_DATA_LEN ideal bin levels (see scene.h).
+ */
+int scene_render(const struct scene *sc, unsigned int capture, uint32_t seed,
+                 MTK_SPECTRUM_DATA *sd, int16_t *truth)
+{
+    const unsigned int dft_size = scene_dft_size(sc);
+    const unsigned int symbol = 64 << sc->chan_width;
+    const double fs_khz = 20000 << sc->chan_width;
+    const double frac_scale = 1.0 / (1 << 9);
+    double complex wifi_sym[SCENE_MAX_SOURCES][2 * WIFI_SUBCARRIERS + 1];
+    double complex twiddle[WIFI_SYMBOL_MAX];
+    double phase[SCENE_MAX_SOURCES] = { 0 };
+    double freq_khz[SCENE_MAX_SOURCES];
+    unsigned int on_count[SCENE_MAX_SOURCES] = { 0 };
+    long wifi_left[SCENE_MAX_SOURCES] = { 0 };
+    unsigned int wifi_n[SCENE_MAX_SOURCES] = { 0 };
+    bool on[SCENE_MAX_SOURCES];
+    double noise_amp, amp, gain, t_us;
+    double complex v, sym;
+    int i, s, k, lna = 3;
+
+    if (sc->chan_width > 2)
+        return -1;
+    seed += capture * 2654435761U;
+    for (k = 0; k < symbol; k++)
+        twiddle[k] = cexp(2 * M_PI * I * k / symbol);
+    for (s = 0; s < sc->count; s++) {
+        freq_khz[s] = sc->src[s].offset_khz;
+        on[s] = sc->src[s].duty >= 1 || (sc->src[s].duty > 0 && scene_uniform(&seed) < sc->src[s].duty);
+        if (sc->src[s].type == SCENE_WIFI && sc->src[s].duty > 0 && sc->src[s].duty < 1)
+            wifi_left[s] = scene_wifi_next(&sc->src[s], on[s], fs_khz, &seed) * scene_uniform(&seed) + 1;
+    }
+    /* per bin expectation of |X/N|^2: sigma^2/N for noise, a^2 for a bin aligned tone */
+    noise_amp = sqrt(scene_lin(sc->noise) * dft_size / 2);
+
+    for (i = 0; i < MTK_SPECTRUM_DATA_LEN; i++) {
+        if (scene_rand(&seed) % 1000 < sc->gsw_per_mille)
+            lna = lna == 3 ? 2 : 3;
+        t_us = capture * SCENE_CAPTURE_GAP_US + i * 1000.0 / fs_khz;
+        v = noise_amp * scene_gauss(&seed);
+
+        for (s = 0; s < sc->count; s++) {
+            const struct scene_source *src = &sc->src[s];
+
+            switch (src->type) {
+            case SCENE_CW:
+                v += sqrt(scene_lin(src->level)) * cexp(I * phase[s]);
+                break;
+            case SCENE_WIFI:
+                if (wifi_left[s] && !--wifi_left[s]) {
+                    on[s] = !on[s];
+                    wifi_left[s] = scene_wifi_next(src, on[s], fs_khz, &seed);
+                    wifi_n[s] = 0;
+                }
+                if (!on[s])
+                    break;
+                if (!(wifi_n[s] % symbol)) {
+                    for (k = 0; k <= 2 * WIFI_SUBCARRIERS; k++)
+                        wifi_sym[s][k] = ((scene_rand(&seed) & 1) ? M_SQRT1_2 : -M_SQRT1_2) +
+                                         ((scene_rand(&seed) & 1) ? M_SQRT1_2 : -M_SQRT1_2) * I;
+                }
+                /* the flat level over the 52 subcarriers, see scene_truth_row() */
+                amp = sqrt(scene_lin(src->level) * dft_size * WIFI_SPACING_KHZ / fs_khz);
+                sym = 0;
+                for (k = -WIFI_SUBCARRIERS; k <= WIFI_SUBCARRIERS; k++) {
+                    if (k)
+                        sym += wifi_sym[s][k + WIFI_SUBCARRIERS] *
+                               twiddle[((k + symbol) * wifi_n[s]) % symbol];
+                }
+                v += amp * sym * cexp(I * phase[s]);
+                wifi_n[s]++;
+                break;
+            case SCENE_OVEN:
+                on[s] = fmod(t_us, SCENE_OVEN_PERIOD_US) < src->duty * SCENE_OVEN_PERIOD_US;
+                freq_khz[s] = src->offset_khz + SCENE_OVEN_SWEEP_KHZ * sin(2 * M_PI * t_us / SCENE_OVEN_PERIOD_US);
+                if (on[s])
+                    v += sqrt(scene_lin(src->level)) * cexp(I * phase[s]);
+                break;
+            }
+            phase[s] = fmod(phase[s] + 2 * M_PI * freq_khz[s] / fs_khz, 2 * M_PI);
+            on_count[s] += on[s];
+        }
+
+        gain = pow(10, -0.05 * (scene_lna_gain[lna] + (lna - 3) * 2 + 18 - 13));
+        v /= frac_scale * gain;
+        sd[i].Ival = MAX(MIN(creal(v), INT_MAX), INT_MIN);
+        sd[i].Qval = MAX(MIN(cimag(v), INT_MAX), INT_MIN);
+        sd[i].LNA = lna;
+        sd[i].LPF = 0;
+
+        if (i % dft_size == dft_size - 1) {
+            if (truth)
+                scene_truth_row(sc, on_count, freq_khz, dft_size, fs_khz, &truth[i + 1 - dft_size]);
+            memset(on_count, 0, sizeof(on_count));
+        }
+    }
+    return 0;
+}
+
+/* in the driver's dump format */
+int scene_write_capture(const char *iq_file, const char *lna_lpf_file, const MTK_SPECTRUM_DATA *sd)
+{
+    FILE *fp_iq, *fp_lna_lpf;
+    int i;
+
+    fp_iq = fopen(iq_file, "w");
+    fp_lna_lpf = fopen(lna_lpf_file, "w");
+    if (!fp_iq || !fp_lna_lpf) {
+        if (fp_iq)
+            fclose(fp_iq);
+        if (fp_lna_lpf)
+            fclose(fp_lna_lpf);
+        return -1;
+    }
+    for (i = 0; i < MTK_SPECTRUM_DATA_LEN; i++) {
+        fprintf(fp_iq, "%d\t%d\n", sd[i].Ival, sd[i].Qval);
+        fprintf(fp_lna_lpf, "%d\t%d\n", sd[i].LNA, sd[i].LPF);
+    }
+    fclose(fp_iq);
+    fclose(fp_lna_lpf);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdint.h>
+
+#include "../mt_spectr.h"
+
+/*
+ * Synthetic RF scenes, rendered into ICAP captures as the driver dumps
+ * them. Levels are in the unit of the per-bin power of
+ * process_spectrum_data() (20*log10(|X|/N) after the gain correction),
+ * so that the renderer also knows the ideal value of every bin: the
+ * scene truth, one row of dft_size levels per dft_size samples.
+ *
+ * A scene is described as ';'-separated items:
+ *   noise:<level>                              noise floor of every bin
+ *   cw:<offset kHz>:<level>                    continuous tone
+ *   wifi:<offset kHz>:<level>:<burst us>:<duty> OFDM bursts, 52 x 312.5 kHz
+ *   oven:<offset kHz>:<level>:<duty>           microwave oven, swept +-2 MHz
+ *                                              on the 20 ms mains cycle
+ *   gsw:<per mille>                            gain switches per 1000 samples
+ * Offsets are from the channel center.
+ */
+
+#define SCENE_MAX_SOURCES       8
+/* start of capture n is n * SCENE_CAPTURE_GAP_US, the oven phase moves on */
+#define SCENE_CAPTURE_GAP_US    4100
+#define SCENE_OVEN_PERIOD_US    20000
+#define SCENE_OVEN_SWEEP_KHZ    2000
+
+enum scene_source_type {
+    SCENE_CW,
+    SCENE_WIFI,
+    SCENE_OVEN,
+};
+
+struct scene_source {
+    enum scene_source_type type;
+    int offset_khz;
+    double level;
+    double burst_us;                                /* wifi */
+    double duty;                                    /* wifi, oven: share of time on */
+};
+
+struct scene {
+    char name[32];
+    unsigned int chan_width;                        /* as process_spectrum_data(), 0 - 20 MHz */
+    double noise;
+    unsigned int gsw_per_mille;
+    int count;
+    struct scene_source src[SCENE_MAX_SOURCES];
+};
+
+const char *scene_builtin(const char *name);
+const char *scene_builtin_name(int idx);
+int scene_parse(struct scene *sc, const char *name, const char *spec);
+unsigned int scene_dft_size(const struct scene *sc);
+int scene_render(const struct scene *sc, unsigned int capture, uint32_t seed,
+                 MTK_SPECTRUM_DATA *sd, int16_t *truth);
+int scene_write_capture(const char *iq_file, const char *lna_lpf_file, const MTK_SPECTRUM_DATA *sd);
+
+#endif //SCENE_H
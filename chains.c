@@ -0,0 +1,187 @@
+/*
+ * Ubiquiti RF Environment tool - multi-node capture
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ubnt.h"
+#include "chains.h"
+
+/*
+ * Capture nodes "b,c,d,e", any of them in any order. A single node leaves
+ * the set empty (count 0), the scan then captures it alone as before.
+ */
+int chains_parse(struct chain_set *set, const char *nodes)
+{
+    char list[16], *tok, *save = NULL;
+    uint8_t count = 0, i;
+
+    snprintf(list, sizeof(list), "%s", nodes);
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if (count == CHAINS_MAX || strlen(tok) != 1 || tok[0] < 'b' || tok[0] > 'e')
+            return -1;
+        for (i = 0; i < count; i++) {
+            if (set->chain[i].node[0] == tok[0])
+                return -1;
+        }
+        set->chain[count].node[0] = tok[0];
+        set->chain[count++].node[1] = '\0';
+    }
+    if (!count)
+        return -1;
+    set->count = (count > 1) ? count : 0;
+    return 0;
+}
+
+/* max - the strongest chain per bin, avg - their power average */
+int chains_parse_combine(struct chain_set *set, const char *mode)
+{
+    if (!strcmp(mode, "max"))
+        set->combine = CHAIN_MAX_HOLD;
+    else if (!strcmp(mode, "avg"))
+        set->combine = CHAIN_AVERAGE;
+    else
+        return -1;
+    return 0;
+}
+
+/* the first chain captures into first_sd, the others get their own buffers */
+int chains_init(struct chain_set *set, uint16_t channels, MTK_SPECTRUM_DATA *first_sd)
+{
+    struct chain *c;
+    uint8_t i;
+
+    set->channels = channels;
+    set->sketches = calloc((size_t)channels * set->count, sizeof(*set->sketches));
+    if (!set->sketches)
+        return -1;
+    for (i = 0; i < set->count; i++) {
+        c = &set->chain[i];
+        c->sd = i ? malloc(MTK_SPECTRUM_DATA_LEN * sizeof(MTK_SPECTRUM_DATA)) : first_sd;
+        c->info.pssd = malloc(SPECTRAL_SAMP_DATA_LEN * sizeof(SPECTRAL_SAMP_DATA));
+        if (!c->sd || !c->info.pssd) {
+            chains_free(set);
+            return -1;
+        }
+        prof_reset(&c->prof);
+        cpu_budget_init(&c->budget, 0);
+    }
+    return 0;
+}
+
+void chains_free(struct chain_set *set)
+{
+    uint8_t i;
+
+    for (i = 0; i < set->count; i++) {
+        if (i)
+            free(set->chain[i].sd);
+        free(set->chain[i].info.pssd);
+        set->chain[i].sd = NULL;
+        set->chain[i].info.pssd = NULL;
+    }
+    free(set->sketches);
+    set->sketches = NULL;
+}
+
+/* drop the per-chain statistics, e.g. at the start of a scan */
+void chains_reset(struct chain_set *set)
+{
+    uint32_t i;
+
+    for (i = 0; i < (uint32_t)set->channels * set->count; i++)
+        rssi_sketch_reset(&set->sketches[i]);
+}
+
+/* the chains process the next captures with the settings of the radio */
+void chains_prepare(struct chain_set *set, const mtk_ssd_info_t *pinfo)
+{
+    SPECTRAL_SAMP_DATA *pssd;
+    struct chain *c;
+    uint8_t i;
+
+    for (i = 0; i < set->count; i++) {
+        c = &set->chain[i];
+        pssd = c->info.pssd;
+        c->info = *pinfo;
+        c->info.pssd = pssd;
+        c->info.window_num = 0;
+        c->info.prof = &c->prof;
+        c->info.budget = pinfo->budget ? &c->budget : NULL;
+        if (pinfo->budget)
+            c->budget.share = pinfo->budget->share;
+    }
+}
+
+/* add the windows of every chain to its RSSI on the channel */
+void chains_account(struct chain_set *set, uint16_t channel_index)
+{
+    const SPECTRAL_SAMP_DATA *ssd;
+    struct rssi_sketch *sk;
+    uint16_t w;
+    uint8_t i;
+
+    if (channel_index >= set->channels)
+        return;
+    for (i = 0; i < set->count; i++) {
+        sk = &set->sketches[channel_index * set->count + i];
+        for (w = 0; w < set->chain[i].info.window_num; w++) {
+            ssd = &set->chain[i].info.pssd[w];
+            if (ssd->spectral_rssi >= 0)
+                rssi_sketch_add(sk, ssd->spectral_rssi, 1);
+        }
+    }
+}
+
+/* move the counters and the CPU time of the chains to the radio */
+void chains_collect(struct chain_set *set, mtk_ssd_info_t *pinfo)
+{
+    uint8_t i;
+
+    for (i = 0; i < set->count; i++) {
+        prof_collect_counters(pinfo->prof, &set->chain[i].prof);
+        cpu_budget_collect(pinfo->budget, &set->chain[i].budget);
+    }
+}
+
+static json_t *chain_json(const struct chain *c, const struct rssi_sketch *sk)
+{
+    json_t *json = json_object();
+    int rssi = rssi_sketch_quantile(sk, UBNT_INTERFERENCE_POWER_PERCENTILE);
+
+    json_object_set_new(json, "node", json_string(c->node));
+    json_object_set_new(json, "windows", json_integer(sk->total));
+    /* as ubnt_calculate_interference() */
+    json_object_set_new(json, "interference", json_integer(ubnt_convert_to_dbm(rssi > 1 ? rssi - 1 : 1, BW_20)));
+    json_object_set_new(json, "rssi_p50", json_integer(ubnt_convert_to_dbm(rssi_sketch_quantile(sk, 50), BW_20)));
+    return json;
+}
+
+/* the channels of chan_list with windows on any chain */
+json_t *chains_json(const struct chain_set *set, const struct chan_info *chan_list)
+{
+    json_t *root = json_array(), *entry, *chains;
+    const struct rssi_sketch *sk;
+    uint32_t total;
+    uint16_t ch;
+    uint8_t i;
+
+    for (ch = 0; ch < set->channels; ch++) {
+        sk = &set->sketches[ch * set->count];
+        for (i = 0, total = 0; i < set->count; i++)
+            total += sk[i].total;
+        if (!total)
+            continue;
+        chains = json_array();
+        for (i = 0; i < set->count; i++) {
+            if (sk[i].total)
+                json_array_append_new(chains, chain_json(&set->chain[i], &sk[i]));
+        }
+        entry = json_object();
+        json_object_set_new(entry, "channel", json_integer(chan_list[ch].channel));
+        json_object_set_new(entry, "chains", chains);
+        json_array_append_new(root, entry);
+    }
+    return root;
+}
@@ -0,0 +1,57 @@
+#ifndef CHAINS_H
+#define CHAINS_H
+
+#include <stdint.h>
+#include <jansson.h>
+
+#include "ubnt.h"
+#include "fft_proc.h"
+#include "profile.h"
+#include "cpu_budget.h"
+#include "rssi_sketch.h"
+
+/*
+ * Multi-node capture: every capture node (receive chain) listed with -n
+ * is captured back-to-back on each channel while it is tuned. The chains
+ * are processed in parallel on the pool, each into its own windows, and
+ * combined per bin into the windows the histograms take, see
+ * combine_spectrum_data().
+ *
+ * The RSSI of every chain is kept per scanned channel as well and written
+ * as CHAINS_FILE_FMT at the end of the scan:
+ *
+ *   [{"channel":..,"chains":[{"node":"b","windows":..,"interference":..,"rssi_p50":..},..]},..]
+ *
+ * (dBm, as the table's interference).
+ */
+
+#define CHAINS_MAX              CHAIN_COMBINE_MAX   /* nodes b, c, d and e */
+#define CHAINS_FILE_FMT         "/var/run/rftable_%s.chains"
+
+struct chain {
+    char node[2];
+    MTK_SPECTRUM_DATA *sd;
+    mtk_ssd_info_t info;                            /* own pssd, the rest follows the radio */
+    struct scan_profile prof;                       /* counters only, collected per capture */
+    struct cpu_budget budget;
+};
+
+struct chain_set {
+    uint8_t count;                                  /* 0 - the single node of -n */
+    enum chain_combine combine;
+    struct chain chain[CHAINS_MAX];
+    uint16_t channels;
+    struct rssi_sketch *sketches;                   /* count per channel index */
+};
+
+int chains_parse(struct chain_set *set, const char *nodes);
+int chains_parse_combine(struct chain_set *set, const char *mode);
+int chains_init(struct chain_set *set, uint16_t channels, MTK_SPECTRUM_DATA *first_sd);
+void chains_free(struct chain_set *set);
+void chains_reset(struct chain_set *set);
+void chains_prepare(struct chain_set *set, const mtk_ssd_info_t *pinfo);
+void chains_account(struct chain_set *set, uint16_t channel_index);
+void chains_collect(struct chain_set *set, mtk_ssd_info_t *pinfo);
+json_t *chains_json(const struct chain_set *set, const struct chan_info *chan_list);
+
+#endif //CHAINS_H
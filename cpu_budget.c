@@ -0,0 +1,105 @@
+/*
+ * Ubiquiti RF Environment tool - CPU budget of the processing
+ */
+
+#define _GNU_SOURCE                                 /* SCHED_IDLE */
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "ubnt.h"
+#include "cpu_budget.h"
+
+static uint64_t cpu_budget_clock(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void cpu_budget_init(struct cpu_budget *b, double share)
+{
+    memset(b, 0, sizeof(*b));
+    b->share = (share > 0 && share < 1) ? share : 0;
+}
+
+/* drop what was accounted, e.g. at the start of a scan */
+void cpu_budget_reset(struct cpu_budget *b)
+{
+    cpu_budget_init(b, b->share);
+}
+
+/* run the calling thread only when a core has nothing else to do */
+int cpu_budget_idle(void)
+{
+    struct sched_param param = { .sched_priority = 0 };
+    int ret;
+
+    if ((ret = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param)))
+        warn(MODULE, "%s: cannot set SCHED_IDLE: %s\n", __func__, strerror(ret));
+    return ret ? -1 : 0;
+}
+
+/* a batch of processing starts on the calling thread */
+void cpu_budget_begin(struct cpu_budget *b)
+{
+    if (!b)
+        return;
+    b->batch_cpu = cpu_budget_clock(CLOCK_THREAD_CPUTIME_ID);
+    b->batch_wall = cpu_budget_clock(CLOCK_MONOTONIC);
+}
+
+/*
+ * End the batch (begun on the same thread): account it, sleep off what
+ * it used over the share or else just yield, and begin the next one.
+ */
+void cpu_budget_yield(struct cpu_budget *b)
+{
+    uint64_t cpu, wall, owed, now, start;
+    struct timespec ts;
+
+    if (!b)
+        return;
+    start = b->batch_wall;
+    cpu = cpu_budget_clock(CLOCK_THREAD_CPUTIME_ID) - b->batch_cpu;
+    now = cpu_budget_clock(CLOCK_MONOTONIC);
+    wall = now - start;
+    b->cpu_ns += cpu;
+    b->yields++;
+
+    owed = 0;
+    if (b->share && cpu / b->share > wall)
+        owed = MIN((uint64_t)(cpu / b->share) - wall, CPU_BUDGET_MAX_SLEEP_NS);
+    if (owed) {
+        ts.tv_sec = owed / 1000000000ULL;
+        ts.tv_nsec = owed % 1000000000ULL;
+        while (nanosleep(&ts, &ts) && errno == EINTR)
+            ;
+        b->throttled_ns += cpu_budget_clock(CLOCK_MONOTONIC) - now;
+    } else {
+        sched_yield();
+    }
+    cpu_budget_begin(b);
+    b->wall_ns += b->batch_wall - start;
+}
+
+/* move what src accounted to dst, e.g. from the budgets of parallel chains */
+void cpu_budget_collect(struct cpu_budget *dst, struct cpu_budget *src)
+{
+    if (!dst || !src)
+        return;
+    dst->cpu_ns += src->cpu_ns;
+    dst->wall_ns += src->wall_ns;
+    dst->throttled_ns += src->throttled_ns;
+    dst->yields += src->yields;
+    cpu_budget_reset(src);
+}
+
+/* share of one core the processing used while it ran */
+double cpu_budget_achieved(const struct cpu_budget *b)
+{
+    return b->wall_ns ? (double)b->cpu_ns / b->wall_ns : 0;
+}
@@ -0,0 +1,39 @@
+#ifndef CPU_BUDGET_H
+#define CPU_BUDGET_H
+
+#include <stdint.h>
+
+/*
+ * CPU budget of the capture processing, so that a scan does not compete
+ * with the forwarding and the management daemons of the AP. The
+ * processing threads run at SCHED_IDLE and process_spectrum_data() yields
+ * between batches of windows; with a share set, a batch that used more
+ * CPU than the share of its wall time sleeps the difference off.
+ *
+ * All the calls take a NULL budget (not budgeted) and do nothing then.
+ */
+
+#define CPU_BUDGET_BATCH        16                  /* windows between yields */
+/* a batch never sleeps longer, whatever it owes */
+#define CPU_BUDGET_MAX_SLEEP_NS (100 * 1000000ULL)
+
+struct cpu_budget {
+    double share;                                   /* of one core, 0 - no limit */
+    uint64_t cpu_ns;                                /* used by the processing */
+    uint64_t wall_ns;                               /* of the processing, sleeps included */
+    uint64_t throttled_ns;                          /* slept to keep to the share */
+    uint32_t yields;
+    /* the running batch */
+    uint64_t batch_cpu;
+    uint64_t batch_wall;
+};
+
+void cpu_budget_init(struct cpu_budget *b, double share);
+void cpu_budget_reset(struct cpu_budget *b);
+int cpu_budget_idle(void);
+void cpu_budget_begin(struct cpu_budget *b);
+void cpu_budget_yield(struct cpu_budget *b);
+void cpu_budget_collect(struct cpu_budget *dst, struct cpu_budget *src);
+double cpu_budget_achieved(const struct cpu_budget *b);
+
+#endif //CPU_BUDGET_H
@@ -0,0 +1,375 @@
+/*
+ * Ubiquiti RF Environment tool - resident daemon mode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "daemon.h"
+
+static volatile sig_atomic_t daemon_stop;
+static int daemon_lfd = -1;
+
+static struct {
+    uint32_t scans;
+    uint32_t last_scan;
+    int      last_visited;
+} daemon_stats;
+
+/*
+ * Clients are served from their own threads, scans run on the thread that
+ * called daemon_run() (the one bound to the radio). A client asking for a
+ * scan hands it over and waits; the others keep querying the published
+ * snapshots meanwhile.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool     pending;
+    bool     running;
+    uint32_t done;                                  /* completed requests */
+    uint8_t  channels[MAX_NUM_CHANNELS];
+    uint8_t  count;
+    uint32_t max_age;
+    bool     incremental;
+    int      result;
+} daemon_req = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int fds[DAEMON_MAX_CLIENTS];
+    int count;
+} daemon_clients = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+struct daemon_client_arg {
+    int fd;
+    const struct daemon_ops *ops;
+};
+
+static void daemon_signal(int sig)
+{
+    daemon_stop = 1;
+}
+
+static int daemon_listen(const char *sock_path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+        error(MODULE, "%s: socket path too long: %s\n", __func__, sock_path);
+        return -1;
+    }
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        error(MODULE, "%s: socket: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock_path);
+    unlink(sock_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, DAEMON_MAX_CLIENTS) < 0) {
+        error(MODULE, "%s: bind/listen %s: %s\n", __func__, sock_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    chmod(sock_path, 0600);
+
+    return fd;
+}
+
+static json_t *daemon_error(const char *msg)
+{
+    json_t *reply = json_object();
+
+    json_object_set_new(reply, "error", json_string(msg));
+    return reply;
+}
+
+/* queue a scan for the radio thread and wait for its result */
+static int daemon_request_scan(const uint8_t *channels, uint8_t count, uint32_t max_age, bool incremental)
+{
+    uint32_t ticket;
+    int ret;
+
+    pthread_mutex_lock(&daemon_req.lock);
+    /* one scan at a time */
+    while ((daemon_req.pending || daemon_req.running) && !daemon_stop)
+        pthread_cond_wait(&daemon_req.cond, &daemon_req.lock);
+    if (daemon_stop) {
+        pthread_mutex_unlock(&daemon_req.lock);
+        return -1;
+    }
+    memcpy(daemon_req.channels, channels, count);
+    daemon_req.count = count;
+    daemon_req.max_age = max_age;
+    daemon_req.incremental = incremental;
+    daemon_req.pending = true;
+    ticket = daemon_req.done + 1;
+    pthread_cond_broadcast(&daemon_req.cond);
+    while ((int32_t)(daemon_req.done - ticket) < 0 && !daemon_stop)
+        pthread_cond_wait(&daemon_req.cond, &daemon_req.lock);
+    ret = (daemon_req.done == ticket) ? daemon_req.result : -1;
+    pthread_mutex_unlock(&daemon_req.lock);
+
+    return ret;
+}
+
+static json_t *daemon_scan_reply(int visited)
+{
+    json_t *reply = json_object();
+
+    pthread_mutex_lock(&daemon_req.lock);
+    daemon_stats.scans++;
+    daemon_stats.last_scan = ubnt_uptime();
+    daemon_stats.last_visited = visited;
+    pthread_mutex_unlock(&daemon_req.lock);
+
+    json_object_set_new(reply, "status", json_string(visited < 0 ? "failed" : "ok"));
+    json_object_set_new(reply, "channels", json_integer(visited));
+    return reply;
+}
+
+static json_t *daemon_command(char *line, const struct daemon_ops *ops)
+{
+    uint8_t channels[MAX_NUM_CHANNELS];
+    uint8_t count = 0;
+    char *cmd, *arg, *tok, *save = NULL;
+    json_t *reply;
+
+    cmd = strtok_r(line, " \t\r\n", &save);
+    arg = strtok_r(NULL, " \t\r\n", &save);
+    if (!cmd)
+        return daemon_error("empty command");
+
+    if (!strcmp(cmd, "scan")) {
+        if (!arg)
+            return daemon_scan_reply(daemon_request_scan(NULL, 0, 0, false));
+        for (tok = strtok_r(arg, ",", &save); tok && count < ARRAY_SIZE(channels); tok = strtok_r(NULL, ",", &save))
+            channels[count++] = atoi(tok);
+        /* only the listed channels are stale */
+        return daemon_scan_reply(daemon_request_scan(channels, count, UINT32_MAX, true));
+    } else if (!strcmp(cmd, "rescan")) {
+        if (!arg)
+            return daemon_error("rescan <sec>");
+        return daemon_scan_reply(daemon_request_scan(NULL, 0, strtoul(arg, NULL, 10), true));
+    } else if (!strcmp(cmd, "table")) {
+        return ops->table();
+    } else if (!strcmp(cmd, "best")) {
+        return ops->best(arg ? atoi(arg) : 1);
+    } else if (!strcmp(cmd, "status")) {
+        reply = json_object();
+        pthread_mutex_lock(&daemon_req.lock);
+        json_object_set_new(reply, "scans", json_integer(daemon_stats.scans));
+        json_object_set_new(reply, "last_scan", json_integer(daemon_stats.last_scan));
+        json_object_set_new(reply, "last_channels", json_integer(daemon_stats.last_visited));
+        json_object_set_new(reply, "scanning", (daemon_req.pending || daemon_req.running) ? json_true() : json_false());
+        pthread_mutex_unlock(&daemon_req.lock);
+        return reply;
+    } else if (!strcmp(cmd, "quit")) {
+        daemon_stop = 1;
+        reply = json_object();
+        json_object_set_new(reply, "status", json_string("ok"));
+        return reply;
+    }
+
+    return daemon_error("unknown command");
+}
+
+/* serve one client until it hangs up */
+static void *daemon_client(void *data)
+{
+    struct daemon_client_arg *arg = data;
+    char line[DAEMON_LINE_LEN];
+    /* a stream each way, one "r+" stream cannot switch from reading to writing unpositioned */
+    FILE *in = fdopen(arg->fd, "r");
+    int out_fd = dup(arg->fd);
+    FILE *out = out_fd < 0 ? NULL : fdopen(out_fd, "w");
+    json_t *reply;
+    int i;
+
+    if (in && out) {
+        while (!daemon_stop && fgets(line, sizeof(line), in)) {
+            reply = daemon_command(line, arg->ops);
+            if (reply) {
+                json_dumpf(reply, out, JSON_COMPACT);
+                json_decref(reply);
+            }
+            fputc('\n', out);
+            fflush(out);
+        }
+    }
+    if (out)
+        fclose(out);
+    else if (out_fd >= 0)
+        close(out_fd);
+
+    pthread_mutex_lock(&daemon_clients.lock);
+    for (i = 0; i < daemon_clients.count; i++) {
+        if (daemon_clients.fds[i] == arg->fd) {
+            daemon_clients.fds[i] = daemon_clients.fds[--daemon_clients.count];
+            break;
+        }
+    }
+    /* closed under the lock, daemon_run() may be shutting the fd down */
+    if (in)
+        fclose(in);
+    else
+        close(arg->fd);
+    pthread_cond_broadcast(&daemon_clients.cond);
+    pthread_mutex_unlock(&daemon_clients.lock);
+    free(arg);
+
+    return NULL;
+}
+
+static void daemon_spawn_client(int fd, const struct daemon_ops *ops)
+{
+    struct daemon_client_arg *arg;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_mutex_lock(&daemon_clients.lock);
+    if (daemon_clients.count >= DAEMON_MAX_CLIENTS || !(arg = malloc(sizeof(*arg)))) {
+        pthread_mutex_unlock(&daemon_clients.lock);
+        warn(MODULE, "%s: too many clients\n", __func__);
+        close(fd);
+        return;
+    }
+    arg->fd = fd;
+    arg->ops = ops;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, DAEMON_THREAD_STACK_SIZE);
+    if (pthread_create(&thread, &attr, daemon_client, arg)) {
+        error(MODULE, "%s: pthread_create: %s\n", __func__, strerror(errno));
+        close(fd);
+        free(arg);
+    } else {
+        daemon_clients.fds[daemon_clients.count++] = fd;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_mutex_unlock(&daemon_clients.lock);
+}
+
+static void *daemon_listener(void *data)
+{
+    const struct daemon_ops *ops = data;
+    int fd;
+
+    while (!daemon_stop) {
+        fd = accept(daemon_lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && !daemon_stop)
+                error(MODULE, "%s: accept: %s\n", __func__, strerror(errno));
+            if (errno == EINVAL)
+                break;
+            continue;
+        }
+        daemon_spawn_client(fd, ops);
+    }
+
+    return NULL;
+}
+
+/* run the queued scans until asked to stop */
+static void daemon_serve_scans(const struct daemon_ops *ops)
+{
+    struct timespec ts;
+    int ret;
+
+    pthread_mutex_lock(&daemon_req.lock);
+    while (!daemon_stop) {
+        if (!daemon_req.pending) {
+            /* wake up now and then, signals only set daemon_stop */
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+            pthread_cond_timedwait(&daemon_req.cond, &daemon_req.lock, &ts);
+            continue;
+        }
+        daemon_req.pending = false;
+        daemon_req.running = true;
+        pthread_mutex_unlock(&daemon_req.lock);
+
+        ret = ops->scan(daemon_req.channels, daemon_req.count, daemon_req.max_age, daemon_req.incremental);
+
+        pthread_mutex_lock(&daemon_req.lock);
+        daemon_req.result = ret;
+        daemon_req.running = false;
+        daemon_req.done++;
+        pthread_cond_broadcast(&daemon_req.cond);
+    }
+    /* release the clients still waiting for a scan */
+    pthread_cond_broadcast(&daemon_req.cond);
+    pthread_mutex_unlock(&daemon_req.lock);
+}
+
+int daemon_run(const char *sock_path, const struct daemon_ops *ops)
+{
+    struct sigaction sa;
+    sigset_t block, old;
+    pthread_t listener;
+    int lfd, i;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = daemon_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((lfd = daemon_listen(sock_path)) < 0)
+        return -1;
+    info(MODULE, "daemon listening on %s\n", sock_path);
+
+    /* the signals are taken by this thread only */
+    sigemptyset(&block);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    daemon_lfd = lfd;
+    if (pthread_create(&listener, NULL, daemon_listener, (void *)ops)) {
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        error(MODULE, "%s: pthread_create: %s\n", __func__, strerror(errno));
+        close(lfd);
+        unlink(sock_path);
+        return -1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    daemon_serve_scans(ops);
+
+    /* wake up accept() and the clients blocked in reads, then wait them out */
+    shutdown(lfd, SHUT_RDWR);
+    pthread_join(listener, NULL);
+    pthread_mutex_lock(&daemon_clients.lock);
+    for (i = 0; i < daemon_clients.count; i++)
+        shutdown(daemon_clients.fds[i], SHUT_RDWR);
+    while (daemon_clients.count)
+        pthread_cond_wait(&daemon_clients.cond, &daemon_clients.lock);
+    pthread_mutex_unlock(&daemon_clients.lock);
+
+    close(lfd);
+    unlink(sock_path);
+    info(MODULE, "daemon stopped\n");
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ubnt.h"
+
+/*
+ * Resident mode: keep the scan state in memory and serve line based
+ * commands on a local unix socket, one JSON document per reply.
+ *
+ *   scan                  full scan
+ *   scan <ch,ch,...>      rescan the listed channels, keep the rest
+ *   rescan <sec>          rescan the channels older than sec
+ *   table                 the published table (spectrum_table + suggested_channels,
+ *                         snapshot version, published, scanning)
+ *   best [n]              the n best channels
+ *   status                scan counters
+ *   quit                  stop the daemon
+ *
+ * Every client is served from its own thread. Scans are run one at a time
+ * on the thread that called daemon_run(); table and best are answered from
+ * the latest published snapshot, also while a scan is in progress.
+ */
+
+#define DAEMON_MAX_CLIENTS 8
+#define DAEMON_LINE_LEN    256
+#define DAEMON_THREAD_STACK_SIZE (128 * 1024)
+
+/* table and best are called from the client threads */
+struct daemon_ops {
+    int (*scan)(const uint8_t *channels, uint8_t count, uint32_t max_age, bool incremental);
+    json_t *(*table)(void);
+    json_t *(*best)(int num_best_channels);
+};
+
+int daemon_run(const char *sock_path, const struct daemon_ops *ops);
+
+#endif //DAEMON_H
@@ -8,12 +8,165 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <string.h>
 
+#include <pthread.h>
 #include <math.h>
 #include <complex.h>
 
 #include "fft_proc.h"
 #include "ubnt.h"
+#include "profile.h"
+#include "occupancy.h"
+#include "cpu_budget.h"
+#include "zoom.h"
+
+/* LNA gain [dB] by the LNA state of a sample */
+static const uint8_t lna_gain_table_le_2_5[4] = { 3, 21, 33, 45 };
+static const uint8_t lna_gain_table_gt_2_5[4] = { 9, 21, 33, 45 };
+
+/* running statistics of the raw samples of a window */
+struct window_stats {
+    int64_t sum_i, sum_q;
+    double energy;
+    unsigned int peak;
+    unsigned int at_peak;
+};
+
+static inline void window_stats_peak(struct window_stats *ws, int v)
+{
+    unsigned int mag = v < 0 ? -(unsigned int)v : (unsigned int)v;
+
+    if (mag > ws->peak) {
+        ws->peak = mag;
+        ws->at_peak = 1;
+    } else if (mag == ws->peak) {
+        ws->at_peak++;
+    }
+}
+
+static inline void window_stats_add(struct window_stats *ws, int i_val, int q_val)
+{
+    ws->sum_i += i_val;
+    ws->sum_q += q_val;
+    ws->energy += (double)i_val * i_val + (double)q_val * q_val;
+    window_stats_peak(ws, i_val);
+    window_stats_peak(ws, q_val);
+}
+
+/*
+ * The rails are not known here: a clipped window shows as many I/Q values
+ * sitting exactly at its (large) peak magnitude, which a live signal of
+ * that amplitude practically never repeats.
+ */
+static enum window_quality window_check(const struct window_stats *ws, unsigned int n)
+{
+    double mean_pwr;
+
+    if (ws->energy == 0)
+        return WINDOW_EMPTY;
+    mean_pwr = ((double)ws->sum_i * ws->sum_i + (double)ws->sum_q * ws->sum_q) / n;
+    if (mean_pwr * 100 >= ws->energy * WINDOW_DC_PCT)
+        return WINDOW_DC;
+    if (ws->peak >= WINDOW_CLIP_MIN_PEAK && ws->at_peak * 100 >= 2 * n * WINDOW_CLIP_PCT)
+        return WINDOW_CLIPPED;
+    return WINDOW_OK;
+}
+
+static const char *psd_window_names[PSD_WINDOWS] = {
+    [PSD_RECT]     = "rect",
+    [PSD_HANN]     = "hann",
+    [PSD_BLACKMAN] = "blackman",
+};
+
+/* <window>[:<overlap %>[:<segments>]], e.g. hann:50:4 */
+int psd_parse(struct psd_cfg *cfg, const char *spec)
+{
+    char name[16];
+    int overlap = 0, segments = 1, n, w;
+
+    n = sscanf(spec, "%15[^:]:%d:%d", name, &overlap, &segments);
+    if (n < 1 || overlap < 0 || overlap > PSD_MAX_OVERLAP || segments < 1 || segments > UINT8_MAX)
+        return -1;
+    for (w = 0; w < PSD_WINDOWS; w++) {
+        if (!strcmp(name, psd_window_names[w])) {
+            cfg->window = w;
+            cfg->overlap = overlap;
+            cfg->segments = segments;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* a power of two within PSD_MIN_DFT_SIZE..DFT_size_MAX */
+int psd_set_dft_size(struct psd_cfg *cfg, unsigned int dft_size)
+{
+    if (dft_size < PSD_MIN_DFT_SIZE || dft_size > DFT_size_MAX || (dft_size & (dft_size - 1)))
+        return -1;
+    cfg->dft_size = dft_size;
+    return 0;
+}
+
+/* DFT size of a window of chan_width (0 - 20 MHz, 1 - 40 MHz, ...) */
+unsigned int psd_dft_size(const struct psd_cfg *cfg, unsigned int chan_width)
+{
+    return MIN((cfg->dft_size ? cfg->dft_size : PSD_REF_DFT_SIZE) << chan_width, DFT_size_MAX);
+}
+
+/*
+ * Fill the window function (periodic, as Welch segments are) and return
+ * the power normalization of a segment's |X|^2: 1 / (N * sum(w^2)) keeps
+ * the noise level of every window where the rectangular one has it,
+ * tones lose the coherent gain of the window (1.8 dB for Hann).
+ */
+static double psd_window(enum psd_window type, unsigned int n, double *win)
+{
+    double sum = 0;
+    unsigned int p;
+
+    for (p = 0; p < n; p++) {
+        switch (type) {
+        case PSD_HANN:
+            win[p] = 0.5 - 0.5 * cos(2 * M_PI * p / n);
+            break;
+        case PSD_BLACKMAN:
+            win[p] = 0.42 - 0.5 * cos(2 * M_PI * p / n) + 0.08 * cos(4 * M_PI * p / n);
+            break;
+        default:
+            win[p] = 1;
+            break;
+        }
+        sum += win[p] * win[p];
+    }
+    return 1 / (n * sum);
+}
+
+/* spectral_rssi of a window from its dft_size bins */
+static void window_rssi(SPECTRAL_SAMP_DATA *ssd, unsigned int dft_size, unsigned int chan_width, uint8_t band_5g)
+{
+    unsigned int bin_count = 0, p;
+    /* 512 bins overflow the int16_t spectral_rssi */
+    int32_t rssi_sum = 0;
+
+    for (p = 0; p < dft_size; p++) {
+        if (!band_5g) {
+            /* For 2.4G band scan results returned in "one column" (all the rest are equals zero) */
+            if (ssd->bin_pwr[p]) {
+                rssi_sum += (-1 * (UBNT_HISTOGRAM_START_DBM + 3 * chan_width) + ssd->bin_pwr[p]);
+                bin_count++;
+            }
+        } else {
+            rssi_sum += (-1 * (DBM_CORRECTION_FACTOR + UBNT_HISTOGRAM_START_DBM + 3 * chan_width) + ssd->bin_pwr[p]);
+        }
+    }
+    ssd->bin_pwr_count = dft_size;
+    if (band_5g) {
+        ssd->spectral_rssi = rssi_sum / (int32_t)dft_size;
+    } else {
+        ssd->spectral_rssi = rssi_sum / (int32_t)bin_count;
+    }
+}
 
 /* FFT */
 void fft_rec(unsigned int N, unsigned int offset, unsigned int delta,
@@ -102,23 +255,25 @@ void fftshift(fft_t *x, unsigned int m, unsigned int n)
 
 unsigned int process_spectrum_data(MTK_SPECTRUM_DATA *SD, mtk_ssd_info_t *pinfo, unsigned int chan_width, unsigned int fc_mhz)
 {
-    const uint8_t lna_gain_table_le_2_5[4] = { 3, 21, 33, 45 };
-    const uint8_t lna_gain_table_gt_2_5[4] = { 9, 21, 33, 45 };
     const uint8_t *lna_gain_table;
     const uint16_t fs_mhz =  20 * (1 << (/*1 + */chan_width));
-    const uint16_t dft_size = (1 << (7 + chan_width));
+    const uint16_t dft_size = psd_dft_size(&pinfo->psd, chan_width);
     const uint16_t freq_res_khz = (1000 * fs_mhz) / dft_size;
     const int frac_bit_num = 9; // 9:IQC output, 7:ADC output
     float total_gain;
     // float sample_rate_us = 1.0 / fs_mhz;
     float frac_scale = 1.0 / (1 << frac_bit_num);
     int i, p;
+    struct window_stats ws;
+    enum window_quality quality;
     int gsw_prd_us = 1;
     int gsw_prd_pt = gsw_prd_us * fs_mhz;
     fft_t FFT_IN = { .x = 0 };
     fft_t FFT_OUT = { .x = 0 };
     // float runtime_us = 0.0;
-    double complex bins_pwr_per_win[dft_size][dft_size * 2];
+    double win[DFT_size_MAX], psd_acc[DFT_size_MAX] = { 0 };
+    double pwr_norm;
+    unsigned int hop, segments = 0, psd_avg;
     unsigned int no_gsw_cnt = 0;
     unsigned int fft_window_cnt = 0;
     uint8_t band_5g = 0;
@@ -138,6 +293,7 @@ unsigned int process_spectrum_data(MTK_SPECTRUM_DATA *SD, mtk_ssd_info_t *pinfo,
     debug(MODULE, "%s: \nfs_mhz=%u \ndft_size=%u\nreq_res_khz=%u\n", __func__, fs_mhz, dft_size, freq_res_khz);
 
     pinfo->window_num = 0;
+    cpu_budget_begin(pinfo->budget);
     if (fc_mhz > BAND_5G_START_FREQ) {
         debug(MODULE, "%s: 5G (%d mhz)\n", __func__, fs_mhz);
         band_5g = 1;
@@ -148,6 +304,11 @@ unsigned int process_spectrum_data(MTK_SPECTRUM_DATA *SD, mtk_ssd_info_t *pinfo,
         lna_gain_table = &lna_gain_table_gt_2_5[0];
     else
         lna_gain_table = &lna_gain_table_le_2_5[0];
+    /* segments start every hop samples of a gain-stable stretch */
+    hop = dft_size - dft_size * MIN(pinfo->psd.overlap, PSD_MAX_OVERLAP) / 100;
+    pwr_norm = psd_window(pinfo->psd.window, dft_size, win) * dft_size / (PSD_REF_DFT_SIZE << chan_width);
+    /* short segments are averaged at least enough for the whole capture to fit in pssd */
+    psd_avg = MAX(pinfo->psd.segments, (MTK_SPECTRUM_DATA_LEN / hop + SPECTRAL_SAMP_DATA_LEN - 1) / SPECTRAL_SAMP_DATA_LEN);
 
 #ifdef PRINT_TO_FILE
     /* print header */
@@ -167,6 +328,7 @@ unsigned int process_spectrum_data(MTK_SPECTRUM_DATA *SD, mtk_ssd_info_t *pinfo,
         if (i > 0) {
             if (((psd+i)->LNA!=(psd+i-1)->LNA)||((psd+i)->LPF!=(psd+i-1)->LPF)) {
                 no_gsw_cnt = 0;
+                prof_count(pinfo->prof, PROF_GAIN_SWITCHES, 1);
             } else {
                 no_gsw_cnt++;
             }
@@ -179,15 +341,11 @@ unsigned int process_spectrum_data(MTK_SPECTRUM_DATA *SD, mtk_ssd_info_t *pinfo,
         }
 
         if (fft_window_cnt >= dft_size) {
-            fft_window_cnt = 0;
-#ifdef PRINT_TO_FILE
-            // runtime_us = i * sample_rate_us;
-            // fprintf(f, "%lf\t", (double)runtime_us*(double)pow(10, -6));
-            fprintf(f, "%d\t", pinfo->window_num);
-#endif // PRINT_TO_FILE
+            fft_window_cnt = dft_size - hop;
             /* total gain is lna gain + lpf gain */
             if (!((psd+i)->LNA >= 0 && (psd+i)->LNA <= 3)) {
                 error(MODULE,"LNA out of range %d (0<=LNA<=3)\n",  (psd+i)->LNA);
+                prof_count(pinfo->prof, PROF_WINDOWS_REJECTED, 1);
                 return pinfo->window_num;
             } else {
                 // printf("DEBUG: %s, lna_gain_table[%d]=%d\n", __func__, (psd+i)->LNA, lna_gain_table[(psd+i)->LNA]);
@@ -195,53 +353,321 @@ unsigned int process_spectrum_data(MTK_SPECTRUM_DATA *SD, mtk_ssd_info_t *pinfo,
                 total_gain = pow(10,(-0.05 * total_gain));
             }
 
+            memset(&ws, 0, sizeof(ws));
             for(p = 0; p < dft_size; p++)
             {
-                FFT_IN.x[p][0] = (psd+i-dft_size+1+p)->Ival*frac_scale*total_gain;
-                FFT_IN.x[p][1] = (psd+i-dft_size+1+p)->Qval*frac_scale*total_gain;
+                window_stats_add(&ws, (psd+i-dft_size+1+p)->Ival, (psd+i-dft_size+1+p)->Qval);
+                FFT_IN.x[p][0] = (psd+i-dft_size+1+p)->Ival*frac_scale*total_gain*win[p];
+                FFT_IN.x[p][1] = (psd+i-dft_size+1+p)->Qval*frac_scale*total_gain*win[p];
 
                 FFT_OUT.x[p][0] = 0;
                 FFT_OUT.x[p][1] = 0;
             }
 
+            quality = window_check(&ws, dft_size);
+            if (quality != WINDOW_OK) {
+                prof_count(pinfo->prof, PROF_WINDOWS_EMPTY + quality - WINDOW_EMPTY, 1);
+#ifndef WINDOW_GATE_FLAG_ONLY
+                prof_count(pinfo->prof, PROF_WINDOWS_REJECTED, 1);
+                continue;
+#endif // !WINDOW_GATE_FLAG_ONLY
+            }
+
             fft(dft_size, &FFT_IN, &FFT_OUT);
             fftshift(&FFT_OUT, dft_size, 2);
 
+            /* Welch: a window is the power average of psd.segments segments */
+            for (p = 0; p < dft_size; p++)
+                psd_acc[p] += (FFT_OUT.x[p][0] * FFT_OUT.x[p][0] + FFT_OUT.x[p][1] * FFT_OUT.x[p][1]) * pwr_norm;
+            if (++segments < psd_avg)
+                continue;
+
+#ifdef PRINT_TO_FILE
+            // runtime_us = i * sample_rate_us;
+            // fprintf(f, "%lf\t", (double)runtime_us*(double)pow(10, -6));
+            fprintf(f, "%d\t", pinfo->window_num);
+#endif // PRINT_TO_FILE
             // printf("window_num %d: ", pinfo->window_num);
-            unsigned int bin_count = 0;
             for(p = 0; p < dft_size; p++)
             {
-                bins_pwr_per_win[p][pinfo->window_num] = FFT_OUT.x[p][1] + FFT_OUT.x[p][0] * I;
-                (pssd+pinfo->window_num)->bin_pwr[p] = (int16_t) 20 * log10(cabs(bins_pwr_per_win[p][pinfo->window_num]) / dft_size);
+                (pssd+pinfo->window_num)->bin_pwr[p] = (int16_t)(10 * log10(psd_acc[p] / segments));
+                psd_acc[p] = 0;
 #ifdef PRINT_TO_FILE
                  fprintf(f, "%+3d\t", (pssd+pinfo->window_num)->bin_pwr[p]);
 #endif // PRINT_TO_FILE
-                if (!band_5g) {
-                    /* For 2.4G band scan results returned in "one column" (all the rest are equals zero) */
-                    if ((pssd+pinfo->window_num)->bin_pwr[p]) {
-                        (pssd+pinfo->window_num)->spectral_rssi += (-1 * (UBNT_HISTOGRAM_START_DBM + 3 * chan_width) + (pssd+pinfo->window_num)->bin_pwr[p]);
-                        bin_count++;
-                    }
-                } else {
-                    (pssd+pinfo->window_num)->spectral_rssi += (-1 * (DBM_CORRECTION_FACTOR + UBNT_HISTOGRAM_START_DBM + 3 * chan_width) + (pssd+pinfo->window_num)->bin_pwr[p]);
-                    // printf( "\t%+3d", (int) (pssd+pinfo->window_num)->bin_pwr[p]);
-                }
-            }
-            (pssd+pinfo->window_num)->bin_pwr_count = p;
-            if (band_5g) {
-                (pssd+pinfo->window_num)->spectral_rssi /= dft_size;
-            } else {
-                (pssd+pinfo->window_num)->spectral_rssi /= bin_count;
             }
+            window_rssi(pssd + pinfo->window_num, dft_size, chan_width, band_5g);
 #ifdef PRINT_TO_FILE
             fprintf(f, "\n");
 #endif // PRINT_TO_FILE
+            segments = 0;
             pinfo->window_num++;
+            if (pinfo->window_num == SPECTRAL_SAMP_DATA_LEN)
+                break;
+            if (!(pinfo->window_num % CPU_BUDGET_BATCH))
+                cpu_budget_yield(pinfo->budget);
         }
     }
+    cpu_budget_yield(pinfo->budget);
 #ifdef PRINT_TO_FILE
     fclose(f);
 #endif // PRINT_TO_FILE
 
     return pinfo->window_num;
 }
+
+/* linear power of the bin levels, the averaged ones are clamped to the table */
+static double combine_lin[CHAIN_COMBINE_DB_MAX - CHAIN_COMBINE_DB_MIN + 1];
+static pthread_once_t combine_once = PTHREAD_ONCE_INIT;
+
+static void combine_lin_init(void)
+{
+    int db;
+
+    for (db = CHAIN_COMBINE_DB_MIN; db <= CHAIN_COMBINE_DB_MAX; db++)
+        combine_lin[db - CHAIN_COMBINE_DB_MIN] = pow(10, db / 10.0);
+}
+
+/*
+ * Combine the windows of receive chains captured on the same channel
+ * into pinfo->pssd, bin by bin: the strongest chain (CHAIN_MAX_HOLD) or
+ * the power average (CHAIN_AVERAGE). The captures are back-to-back, not
+ * simultaneous: windows are paired by index, up to the shortest chain
+ * that has any. Returns the number of combined windows.
+ */
+unsigned int combine_spectrum_data(mtk_ssd_info_t *pinfo, mtk_ssd_info_t *const *chains, unsigned int count,
+                                   enum chain_combine mode, unsigned int chan_width, unsigned int fc_mhz)
+{
+    const uint16_t dft_size = psd_dft_size(&pinfo->psd, chan_width);
+    const uint8_t band_5g = fc_mhz > BAND_5G_START_FREQ;
+    const SPECTRAL_SAMP_DATA *in[CHAIN_COMBINE_MAX];
+    const double *lin = combine_lin;
+    double sum;
+    SPECTRAL_SAMP_DATA *out;
+    unsigned int used = 0, windows = SPECTRAL_SAMP_DATA_LEN, c, w, p;
+    int16_t level;
+    int db, top;
+
+    for (c = 0; c < count && used < CHAIN_COMBINE_MAX; c++) {
+        if (chains[c]->window_num) {
+            windows = MIN(windows, chains[c]->window_num);
+            in[used++] = chains[c]->pssd;
+        }
+    }
+    pinfo->window_num = used ? windows : 0;
+    if (mode == CHAIN_AVERAGE)
+        pthread_once(&combine_once, combine_lin_init);
+
+    for (w = 0; w < pinfo->window_num; w++) {
+        out = pinfo->pssd + w;
+        for (p = 0; p < dft_size; p++) {
+            if (mode == CHAIN_AVERAGE) {
+                sum = 0;
+                top = CHAIN_COMBINE_DB_MIN;
+                for (c = 0; c < used; c++) {
+                    db = MIN(MAX(in[c][w].bin_pwr[p], CHAIN_COMBINE_DB_MIN), CHAIN_COMBINE_DB_MAX);
+                    sum += lin[db - CHAIN_COMBINE_DB_MIN];
+                    top = MAX(top, db);
+                }
+                /*
+                 * 10 * log10(sum / used) as the bins are rounded (towards
+                 * zero), without the log: it is at most 10 * log10(used)
+                 * under the strongest chain.
+                 */
+                sum /= used;
+                for (db = top; db > CHAIN_COMBINE_DB_MIN && lin[db - CHAIN_COMBINE_DB_MIN] > sum; db--)
+                    ;
+                if (db < 0 && lin[db - CHAIN_COMBINE_DB_MIN] < sum)
+                    db++;
+                out->bin_pwr[p] = db;
+            } else {
+                level = in[0][w].bin_pwr[p];
+                for (c = 1; c < used; c++)
+                    level = MAX(level, in[c][w].bin_pwr[p]);
+                out->bin_pwr[p] = level;
+            }
+        }
+        window_rssi(out, dft_size, chan_width, band_5g);
+    }
+
+    return pinfo->window_num;
+}
+
+/*
+ * Energy detector, see occupancy.h: one pass over the raw samples, no FFT.
+ * The sample power, undone of the LNA gain and smoothed over
+ * OCCUPANCY_SMOOTH samples, is compared with a noise floor tracked along
+ * the capture; the floor carries over to the next capture of the channel
+ * in occ. Samples settling after a gain switch are skipped. Returns the
+ * number of samples observed.
+ */
+unsigned int process_occupancy_data(MTK_SPECTRUM_DATA *SD, unsigned int chan_width, unsigned int fc_mhz,
+                                    struct occupancy *occ)
+{
+    const uint8_t *lna_gain_table = (fc_mhz > 2500) ? lna_gain_table_gt_2_5 : lna_gain_table_le_2_5;
+    const unsigned int fs_mhz = 20 * (1 << chan_width);
+    const unsigned int gsw_prd_pt = fs_mhz;
+    const double on = pow(10, OCCUPANCY_ON_DB / 10.0);
+    const double off = pow(10, OCCUPANCY_OFF_DB / 10.0);
+    double scale[4], ring[OCCUPANCY_SMOOTH] = { 0 };
+    double pwr, sum = 0, nf = occ->noise_floor;
+    unsigned int fill = 0, settle = 0, observed = 0;
+    uint32_t run = 0;
+    bool busy = false, whole = false, state;
+    int i, lna;
+
+    for (lna = 0; lna < 4; lna++)
+        scale[lna] = pow(10, -0.1 * (lna_gain_table[lna] + (lna - 3) * 2 + 18 - 13));
+
+    for (i = 0; i < MTK_SPECTRUM_DATA_LEN; i++) {
+        lna = SD[i].LNA;
+        if (i > 0 && (lna != SD[i - 1].LNA || SD[i].LPF != SD[i - 1].LPF)) {
+            settle = gsw_prd_pt;
+            fill = 0;
+            sum = 0;
+            /* the run goes on unseen, it is no longer whole */
+            whole = false;
+        }
+        if (settle) {
+            settle--;
+            continue;
+        }
+        if (lna < 0 || lna > 3) {
+            fill = 0;
+            sum = 0;
+            whole = false;
+            continue;
+        }
+
+        pwr = ((double)SD[i].Ival * SD[i].Ival + (double)SD[i].Qval * SD[i].Qval) * scale[lna];
+        sum += pwr - (fill >= OCCUPANCY_SMOOTH ? ring[i % OCCUPANCY_SMOOTH] : 0);
+        ring[i % OCCUPANCY_SMOOTH] = pwr;
+        if (++fill < OCCUPANCY_SMOOTH)
+            continue;
+        pwr = sum / OCCUPANCY_SMOOTH;
+
+        if (nf <= 0)
+            nf = pwr;
+        state = busy ? pwr > nf * off : pwr > nf * on;
+        if (state != busy || !run) {
+            if (run && whole)
+                occupancy_add_run(occ, busy, run, fs_mhz);
+            /* a run of the first observed sample has not been seen starting */
+            whole = run > 0;
+            if (state && whole)
+                occ->bursts++;
+            busy = state;
+            run = 0;
+        }
+        run++;
+        observed++;
+        occ->busy += busy;
+
+        if (pwr < nf)
+            nf += (pwr - nf) / OCCUPANCY_NF_FALL;
+        else if (!busy)
+            nf += (pwr - nf) / OCCUPANCY_NF_RISE;
+    }
+    occ->samples += observed;
+    if (nf > 0)
+        occ->noise_floor = nf;
+
+    return observed;
+}
+
+/*
+ * Zoom FFT, see zoom.h: the gain-stable stretches of the capture are
+ * mixed down to the zoom center and fed to the decimating FIR, whose
+ * outputs go through Hann windowed FFTs of ZOOM_DFT_SIZE points. The
+ * quality gate of process_spectrum_data() is applied to the raw samples
+ * of every segment. Returns the number of segments accounted, 0 if the
+ * capture does not hold the span.
+ */
+unsigned int process_zoom_data(MTK_SPECTRUM_DATA *SD, unsigned int chan_width, unsigned int fc_mhz,
+                               struct zoom_spectrum *zoom)
+{
+    const uint8_t *lna_gain_table = (fc_mhz > 2500) ? lna_gain_table_gt_2_5 : lna_gain_table_le_2_5;
+    const unsigned int fs_mhz = 20 * (1 << chan_width);
+    const unsigned int gsw_prd_pt = fs_mhz;
+    const unsigned int decim = zoom_decimation(&zoom->cfg, fs_mhz);
+    const double frac_scale = 1.0 / (1 << 9);
+    double complex rot = 1, step, x;
+    fft_t FFT_IN = { .x = 0 };
+    fft_t FFT_OUT = { .x = 0 };
+    double win[ZOOM_DFT_SIZE], scale[4], y[2], pwr_norm;
+    struct window_stats ws;
+    enum window_quality quality;
+    unsigned int settle = 0, fill = 0, raw = 0, segments = 0, p;
+    bool restart = true;
+    int i, lna;
+
+    if (!decim || !zoom_covered(&zoom->cfg, fc_mhz, fs_mhz))
+        return 0;
+    /* the bins of all the captures have to line up */
+    if (zoom->captures && zoom->fs_mhz != fs_mhz)
+        return 0;
+    if (zoom->fir.decim != decim)
+        zoom_fir_design(&zoom->fir, decim);
+
+    for (lna = 0; lna < 4; lna++)
+        scale[lna] = frac_scale * pow(10, -0.05 * (lna_gain_table[lna] + (lna - 3) * 2 + 18 - 13));
+    step = cexp(-2 * M_PI * I * ((double)zoom->cfg.center_khz - 1000.0 * fc_mhz) / (1000.0 * fs_mhz));
+    /* the decimated noise is 1/decim of the input one, calibrated as the reference bins */
+    pwr_norm = psd_window(PSD_HANN, ZOOM_DFT_SIZE, win) * ZOOM_DFT_SIZE * decim / (PSD_REF_DFT_SIZE << chan_width);
+
+    for (i = 0; i < MTK_SPECTRUM_DATA_LEN; i++) {
+        lna = SD[i].LNA;
+        if (i > 0 && (lna != SD[i - 1].LNA || SD[i].LPF != SD[i - 1].LPF)) {
+            settle = gsw_prd_pt;
+            restart = true;
+        }
+        if (settle) {
+            settle--;
+            continue;
+        }
+        if (lna < 0 || lna > 3) {
+            restart = true;
+            continue;
+        }
+        if (restart) {
+            zoom_fir_restart(&zoom->fir);
+            memset(&ws, 0, sizeof(ws));
+            fill = raw = 0;
+            restart = false;
+        }
+
+        window_stats_add(&ws, SD[i].Ival, SD[i].Qval);
+        raw++;
+        x = (SD[i].Ival + I * SD[i].Qval) * scale[lna] * rot;
+        rot *= step;
+        if (!zoom_fir_push(&zoom->fir, creal(x), cimag(x), y))
+            continue;
+        /* keep the mixer on the unit circle */
+        rot /= cabs(rot);
+
+        FFT_IN.x[fill][0] = y[0] * win[fill];
+        FFT_IN.x[fill][1] = y[1] * win[fill];
+        if (++fill < ZOOM_DFT_SIZE)
+            continue;
+        fill = 0;
+        quality = window_check(&ws, raw);
+        memset(&ws, 0, sizeof(ws));
+        raw = 0;
+        if (quality != WINDOW_OK)
+            continue;
+
+        fft(ZOOM_DFT_SIZE, &FFT_IN, &FFT_OUT);
+        fftshift(&FFT_OUT, ZOOM_DFT_SIZE, 2);
+        for (p = 0; p < ZOOM_DFT_SIZE; p++)
+            zoom->pwr[p] += (FFT_OUT.x[p][0] * FFT_OUT.x[p][0] + FFT_OUT.x[p][1] * FFT_OUT.x[p][1]) * pwr_norm;
+        segments++;
+    }
+    if (segments) {
+        zoom->fs_mhz = fs_mhz;
+        zoom->decim = decim;
+        zoom->captures++;
+        zoom->segments += segments;
+    }
+
+    return segments;
+}
@@ -7,11 +7,67 @@
 #define DFT_size_MAX 512
 #define DBM_CORRECTION_FACTOR -5
 
+/* window quality gate, checked on the raw samples before the FFT */
+#define WINDOW_CLIP_MIN_PEAK 256    /* below this the peak is not a rail */
+#define WINDOW_CLIP_PCT      5      /* samples pinned at the peak magnitude */
+#define WINDOW_DC_PCT        90     /* share of the window power in its mean */
+
 /* investigation options */
 // #define PRINT_TO_FILE
+// #define WINDOW_GATE_FLAG_ONLY    // count the failing windows but keep them
+
+/* Welch segments may overlap by up to this much, in % */
+#define PSD_MAX_OVERLAP 75
+/*
+ * DFT points per 20 MHz, PSD_MIN_DFT_SIZE..DFT_size_MAX. Bin powers are
+ * calibrated to the resolution bandwidth of the reference size (156 kHz):
+ * noise reads the same at any size, a narrowband signal lower by
+ * 10*log10(size / reference) on coarser bins.
+ */
+#define PSD_MIN_DFT_SIZE 32
+#define PSD_REF_DFT_SIZE 128
 
 typedef struct fft_t { double x[DFT_size_MAX][2]; } fft_t;
 
+/* window functions of struct psd_cfg */
+enum psd_window {
+    PSD_RECT,
+    PSD_HANN,
+    PSD_BLACKMAN,
+    PSD_WINDOWS
+};
+
+/* combining of the windows of several receive chains */
+enum chain_combine {
+    CHAIN_MAX_HOLD,
+    CHAIN_AVERAGE,
+};
+#define CHAIN_COMBINE_MAX       4
+#define CHAIN_COMBINE_DB_MIN    (-192)
+#define CHAIN_COMBINE_DB_MAX    63
+
+enum window_quality {
+    WINDOW_OK,
+    WINDOW_EMPTY,                   /* all zero, the capture file was short */
+    WINDOW_DC,
+    WINDOW_CLIPPED,                 /* saturated at the ADC rails */
+};
+
+int psd_parse(struct psd_cfg *cfg, const char *spec);
+int psd_set_dft_size(struct psd_cfg *cfg, unsigned int dft_size);
+unsigned int psd_dft_size(const struct psd_cfg *cfg, unsigned int chan_width);
+void fft(unsigned int N, fft_t *x, fft_t *X);
+void fftshift(fft_t *x, unsigned int m, unsigned int n);
 unsigned int process_spectrum_data(MTK_SPECTRUM_DATA *SD, mtk_ssd_info_t *pinfo, unsigned int chan_width, unsigned int fc_mhz);
+unsigned int combine_spectrum_data(mtk_ssd_info_t *pinfo, mtk_ssd_info_t *const *chains, unsigned int count,
+                                   enum chain_combine mode, unsigned int chan_width, unsigned int fc_mhz);
+
+struct occupancy;
+unsigned int process_occupancy_data(MTK_SPECTRUM_DATA *SD, unsigned int chan_width, unsigned int fc_mhz,
+                                    struct occupancy *occ);
+
+struct zoom_spectrum;
+unsigned int process_zoom_data(MTK_SPECTRUM_DATA *SD, unsigned int chan_width, unsigned int fc_mhz,
+                               struct zoom_spectrum *zoom);
 
 #endif //FFT_PROC_H
@@ -0,0 +1,139 @@
+/*
+ * Ubiquiti RF Environment tool - streaming JSON output
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ubnt.h"
+#include "json_stream.h"
+#include "occupancy.h"
+
+static int json_stream_flush(struct json_stream *js)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while (!js->err && off < js->len) {
+        n = write(js->fd, js->buf + off, js->len - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            js->err = errno;
+            break;
+        }
+        off += n;
+    }
+    js->len = 0;
+
+    return js->err ? -1 : 0;
+}
+
+int json_stream_open(struct json_stream *js, const char *path)
+{
+    js->len = 0;
+    js->err = 0;
+    js->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (js->fd < 0) {
+        error(MODULE, "%s: %s: %s\n", __func__, path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* flush and close, returns -1 if anything failed to be written */
+int json_stream_close(struct json_stream *js)
+{
+    json_stream_flush(js);
+    if (close(js->fd) < 0 && !js->err)
+        js->err = errno;
+    js->fd = -1;
+
+    return js->err ? -1 : 0;
+}
+
+/* drop everything written so far */
+int json_stream_rewind(struct json_stream *js)
+{
+    js->len = 0;
+    if (!js->err && (lseek(js->fd, 0, SEEK_SET) < 0 || ftruncate(js->fd, 0) < 0))
+        js->err = errno;
+
+    return js->err ? -1 : 0;
+}
+
+int json_stream_write(struct json_stream *js, const char *data, size_t len)
+{
+    size_t chunk;
+
+    while (len) {
+        if (js->len == sizeof(js->buf) && json_stream_flush(js))
+            return -1;
+        chunk = MIN(len, sizeof(js->buf) - js->len);
+        memcpy(js->buf + js->len, data, chunk);
+        js->len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return js->err ? -1 : 0;
+}
+
+int json_stream_puts(struct json_stream *js, const char *s)
+{
+    return json_stream_write(js, s, strlen(s));
+}
+
+static int json_stream_callback(const char *buffer, size_t size, void *data)
+{
+    return json_stream_write(data, buffer, size);
+}
+
+/* compact, as json_dump_file(JSON_COMPACT) would write it */
+int json_stream_dump(struct json_stream *js, const json_t *json)
+{
+    return json_dump_callback(json, json_stream_callback, js, JSON_COMPACT | JSON_ENCODE_ANY);
+}
+
+/*
+ * Write the spectrum table of usi one channel at a time: libubnt builds
+ * the entries of a one-channel view of usi, which are written and freed
+ * before the next channel. This relies on the table being an array of
+ * independent entries per channel. The channel's occupancy, if any, is
+ * added to its entries. Returns 1 if a view does not come back as an
+ * array, the caller then has to fall back to the full tree.
+ */
+int json_stream_spectrum_table(struct json_stream *js, struct ubnt_spectral_info *usi,
+                               const struct occupancy *occupancy)
+{
+    struct ubnt_spectral_info view = *usi;
+    json_t *part, *entry, *occ;
+    size_t index;
+    bool first = true;
+    int i;
+
+    if (json_stream_puts(js, "["))
+        return -1;
+    for (i = 0; i < usi->count; i++) {
+        view.table = &usi->table[i];
+        view.count = 1;
+        part = prepare_spectrum_table_usi(&view);
+        if (!json_is_array(part)) {
+            json_decref(part);
+            return 1;
+        }
+        json_array_foreach(part, index, entry) {
+            if (occupancy && json_is_object(entry) && (occ = occupancy_json(&occupancy[i])))
+                json_object_set_new(entry, "occupancy", occ);
+            if ((!first && json_stream_puts(js, ",")) || json_stream_dump(js, entry)) {
+                json_decref(part);
+                return -1;
+            }
+            first = false;
+        }
+        json_decref(part);
+    }
+    return json_stream_puts(js, "]");
+}
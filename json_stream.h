@@ -0,0 +1,34 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stddef.h>
+#include <jansson.h>
+
+#include "libubnt/libubnt.h"
+#include "libubnt/rfscan.h"
+
+/*
+ * Buffered JSON output straight to a file descriptor. Documents are
+ * written piecewise, so no tree of the whole output is ever built.
+ */
+
+#define JSON_STREAM_BUF_SIZE (16 * 1024)
+
+struct json_stream {
+    int fd;
+    int err;
+    size_t len;
+    char buf[JSON_STREAM_BUF_SIZE];
+};
+
+int json_stream_open(struct json_stream *js, const char *path);
+int json_stream_close(struct json_stream *js);
+int json_stream_rewind(struct json_stream *js);
+int json_stream_write(struct json_stream *js, const char *data, size_t len);
+int json_stream_puts(struct json_stream *js, const char *s);
+int json_stream_dump(struct json_stream *js, const json_t *json);
+struct occupancy;
+int json_stream_spectrum_table(struct json_stream *js, struct ubnt_spectral_info *usi,
+                               const struct occupancy *occupancy);
+
+#endif //JSON_STREAM_H
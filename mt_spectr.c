@@ -13,11 +13,26 @@
 
 #include <math.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "mt_spectr.h"
+#include "profile.h"
 
 static const char *typedev[2] = {"2860", "rtdev"};
 
+/* the driver dumps every capture to the same files, one capture at a time */
+static pthread_mutex_t icap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void icap_lock(void)
+{
+    pthread_mutex_lock(&icap_mutex);
+}
+
+void icap_unlock(void)
+{
+    pthread_mutex_unlock(&icap_mutex);
+}
+
 int nvram_set(char *interface, char *option, char *value)
 {
     char cmd_buff[64] = {0};
@@ -174,89 +189,200 @@ int getWifiSpectrumBWandFreq(char *interface, mtk_ssd_info_t *pinfo)
 
 #define WAITING_SCAN_ATTEMPTS 4
 
-int set_wifi_spectrum_param(char* interface, mtk_ssd_info_t *pinfo, char* node, int node_f)
+/* start (trigger) or stop a capture of the node, one-shot or into the ring buffer */
+static int icap_set_param(char *interface, mtk_ssd_info_t *pinfo, char *node, int node_f, int trigger, int ring)
 {
-
-    int status = -1;
-    int sc_attempt_cnt = 0;
+    ICAP_WIFI_SPECTRUM_SET_STRUC_T WifiSpecInfo;
     uint16_t node_pref;
-
+    uint64_t t;
+    int status;
+
+    WifiSpecInfo.fgTrigger=trigger;
+    WifiSpecInfo.fgRingCapEn=ring;
+    WifiSpecInfo.u4Band=0;
+    WifiSpecInfo.u4CapStopCycle=0;
+    WifiSpecInfo.u4MACTriggerEvent=0;
+    WifiSpecInfo.u4SourceAddressLSB=0;
+    WifiSpecInfo.u4SourceAddressMSB=0;
+    WifiSpecInfo.u4TriggerEvent=0;
+    WifiSpecInfo.ucBW = 0;//uss->chan_width+1;
+
+    if(node_f)
+        node_pref = 0x2000;
+    else
+        node_pref = 0x3000;
+    /* Antenna selection */
+    if (!strcmp(node, "b"))
     {
-        //run IOCTL command here
-        ICAP_WIFI_SPECTRUM_SET_STRUC_T WifiSpecInfo;
-        WifiSpecInfo.fgTrigger=1;
-        WifiSpecInfo.fgRingCapEn=0;
-        WifiSpecInfo.u4Band=0;
-        WifiSpecInfo.u4CapStopCycle=0;
-        WifiSpecInfo.u4MACTriggerEvent=0;
-        WifiSpecInfo.u4SourceAddressLSB=0;
-        WifiSpecInfo.u4SourceAddressMSB=0;
-        WifiSpecInfo.u4TriggerEvent=0;
-        WifiSpecInfo.ucBW = 0;//uss->chan_width+1;
-
-        if(node_f)
-            node_pref = 0x2000;
-        else
-            node_pref = 0x3000;
-        /* Antenna selection */
-        if (!strcmp(node, "b"))
-        {
-            WifiSpecInfo.u4CaptureNode=node_pref+0xb;
-        }
-        else if (!strcmp(node, "c"))
-        {
-            WifiSpecInfo.u4CaptureNode=node_pref+0xc;
-        }
-        else if (!strcmp(node, "d"))
-        {
-            WifiSpecInfo.u4CaptureNode=node_pref+0xd;
-        }
-        else if (!strcmp(node, "e"))
-        {
-            WifiSpecInfo.u4CaptureNode=node_pref+0xe;
-        }
+        WifiSpecInfo.u4CaptureNode=node_pref+0xb;
+    }
+    else if (!strcmp(node, "c"))
+    {
+        WifiSpecInfo.u4CaptureNode=node_pref+0xc;
+    }
+    else if (!strcmp(node, "d"))
+    {
+        WifiSpecInfo.u4CaptureNode=node_pref+0xd;
+    }
+    else if (!strcmp(node, "e"))
+    {
+        WifiSpecInfo.u4CaptureNode=node_pref+0xe;
+    }
 
-        WifiSpecInfo.u4CaptureLen=0;
-        status = SetRalinkOid(interface,
-                    OID_802_11_WIFISPECTRUM_SET_PARAMETER,
-                    sizeof(WifiSpecInfo),
-                    (void *)&WifiSpecInfo);
-        if(status < 0)
-        {
-            error(MODULE, "IOCTL failed OID_802_11_WIFISPECTRUM_SET_PARAMETER\n");
-            return status;
-        }
-        status = SetRalinkOid(interface,
-                    OID_802_11_WIFISPECTRUM_GET_CAPTURE_STOP_INFO,
-                    0,
-                    NULL);
-        usleep(10000);
-        while(status < 0 && sc_attempt_cnt < WAITING_SCAN_ATTEMPTS)
-        {
-            warn(MODULE, "IOCTL attempt OID_802_11_WIFISPECTRUM_GET_CAPTURE_STOP_INFO - is not ready\n");
-            status = SetRalinkOid(interface,
-                    OID_802_11_WIFISPECTRUM_GET_CAPTURE_STOP_INFO,
-                    0,
-                    NULL);
-            sc_attempt_cnt++;
-        }
-        if (sc_attempt_cnt == WAITING_SCAN_ATTEMPTS)
-        {
-            error(MODULE, "IOCTL failed OID_802_11_WIFISPECTRUM_GET_CAPTURE_STOP_INFO after %d attempts\n", sc_attempt_cnt);
-            return status;
-        }
+    WifiSpecInfo.u4CaptureLen=0;
+    t = prof_now();
+    status = SetRalinkOid(interface,
+                OID_802_11_WIFISPECTRUM_SET_PARAMETER,
+                sizeof(WifiSpecInfo),
+                (void *)&WifiSpecInfo);
+    prof_record(pinfo->prof, PROF_ICAP_TRIGGER, t);
+    if(status < 0)
+        error(MODULE, "IOCTL failed OID_802_11_WIFISPECTRUM_SET_PARAMETER\n");
+    return status;
+}
 
+/* wait for the capture to stop, settle_us after the first query */
+static int icap_wait_stop(char *interface, mtk_ssd_info_t *pinfo, useconds_t settle_us)
+{
+    int sc_attempt_cnt = 0;
+    uint64_t t;
+    int status;
+
+    t = prof_now();
+    status = SetRalinkOid(interface,
+                OID_802_11_WIFISPECTRUM_GET_CAPTURE_STOP_INFO,
+                0,
+                NULL);
+    if (settle_us)
+        usleep(settle_us);
+    while(status < 0 && sc_attempt_cnt < WAITING_SCAN_ATTEMPTS)
+    {
+        warn(MODULE, "IOCTL attempt OID_802_11_WIFISPECTRUM_GET_CAPTURE_STOP_INFO - is not ready\n");
         status = SetRalinkOid(interface,
-                    OID_802_11_WIFISPECTRUM_DUMP_DATA,
-                    0,
-                    NULL);
-
-        debug(MODULE, "OID_802_11_WIFISPECTRUM_DUMP_DATA Done, Status = %d\n", status);
-        status = getWifiSpectrumBWandFreq(interface, pinfo);
+                OID_802_11_WIFISPECTRUM_GET_CAPTURE_STOP_INFO,
+                0,
+                NULL);
+        sc_attempt_cnt++;
     }
+    prof_record(pinfo->prof, PROF_CAPTURE_WAIT, t);
+    prof_count(pinfo->prof, PROF_IOCTL_RETRIES, sc_attempt_cnt);
+    if (sc_attempt_cnt == WAITING_SCAN_ATTEMPTS)
+    {
+        error(MODULE, "IOCTL failed OID_802_11_WIFISPECTRUM_GET_CAPTURE_STOP_INFO after %d attempts\n", sc_attempt_cnt);
+        return status;
+    }
+    return 0;
+}
+
+/* the driver writes the stopped capture to IQ_FILE_LOC and LNA_LPF_FILE_LOC */
+static int icap_dump(char *interface, mtk_ssd_info_t *pinfo)
+{
+    uint64_t t;
+    int status;
+
+    t = prof_now();
+    status = SetRalinkOid(interface,
+                OID_802_11_WIFISPECTRUM_DUMP_DATA,
+                0,
+                NULL);
+    prof_record(pinfo->prof, PROF_DUMP, t);
+
+    debug(MODULE, "OID_802_11_WIFISPECTRUM_DUMP_DATA Done, Status = %d\n", status);
     return status;
 }
 
+int set_wifi_spectrum_param(char* interface, mtk_ssd_info_t *pinfo, char* node, int node_f)
+{
+    int status;
+
+    if ((status = icap_set_param(interface, pinfo, node, node_f, 1, 0)) < 0)
+        return status;
+    if ((status = icap_wait_stop(interface, pinfo, 10000)) < 0)
+        return status;
+    icap_dump(interface, pinfo);
+    return getWifiSpectrumBWandFreq(interface, pinfo);
+}
+
+/* start streaming the node, see struct icap_ring */
+int icap_ring_start(struct icap_ring *ring, char *interface, mtk_ssd_info_t *pinfo, char *node, int node_f)
+{
+    int status;
+
+    ring->interface = interface;
+    snprintf(ring->node, sizeof(ring->node), "%s", node);
+    ring->node_f = node_f;
+    ring->buffer_ns = MTK_SPECTRUM_DATA_LEN * 1000ULL / ICAP_FS_MHZ;
+    ring->armed_at = 0;
+    ring->segments = 0;
+    ring->dropped = 0;
+    ring->gap_ns = 0;
+    if ((status = icap_set_param(interface, pinfo, node, node_f, 1, 1)) < 0)
+        return status;
+    ring->armed_at = prof_now();
+    return 0;
+}
+
+/* until the buffer has filled since the last re-arm, not to dump a partial one */
+void icap_ring_wait(const struct icap_ring *ring)
+{
+    uint64_t elapsed;
+
+    if (!ring->armed_at)
+        return;
+    elapsed = prof_now() - ring->armed_at;
+    if (elapsed < ring->buffer_ns)
+        usleep((ring->buffer_ns - elapsed + 999) / 1000);
+}
+
+/*
+ * Dump the next segment and re-arm the ring at once, the segment is then
+ * in the capture files while the buffer fills again. See icap_ring_wait()
+ * for the buffer to fill first.
+ */
+int icap_ring_segment(struct icap_ring *ring, mtk_ssd_info_t *pinfo)
+{
+    uint64_t elapsed, armed_at, gap;
+    int status;
+
+    if (!ring->armed_at)
+        return -1;
+    /* still armed on failure, for icap_ring_stop() */
+    if ((status = icap_set_param(ring->interface, pinfo, ring->node, ring->node_f, 0, 1)) < 0)
+        return status;
+    armed_at = ring->armed_at;
+    ring->armed_at = 0;
+    if ((status = icap_wait_stop(ring->interface, pinfo, 0)) < 0)
+        return status;
+    if ((status = icap_dump(ring->interface, pinfo)) < 0)
+        return status;
+    if ((status = icap_set_param(ring->interface, pinfo, ring->node, ring->node_f, 1, 1)) < 0)
+        return status;
+    ring->armed_at = prof_now();
+
+    /*
+     * Of the time between the two re-arms only the dumped buffer was
+     * seen: what it overwrote and the stop, the dump and the re-arm are
+     * lost.
+     */
+    elapsed = ring->armed_at - armed_at;
+    gap = (elapsed > ring->buffer_ns) ? elapsed - ring->buffer_ns : 0;
+    ring->segments++;
+    ring->dropped += gap / ring->buffer_ns;
+    ring->gap_ns += gap;
+    prof_count(pinfo->prof, PROF_RING_SEGMENTS, 1);
+    prof_count(pinfo->prof, PROF_RING_DROPPED, gap / ring->buffer_ns);
+    prof_count(pinfo->prof, PROF_RING_GAP_US, gap / 1000);
+    return 0;
+}
+
+void icap_ring_stop(struct icap_ring *ring, mtk_ssd_info_t *pinfo)
+{
+    if (!ring->armed_at)
+        return;
+    icap_set_param(ring->interface, pinfo, ring->node, ring->node_f, 0, 0);
+    ring->armed_at = 0;
+}
+
 
 void cleanup_scan_data_files(void)
 {
@@ -277,26 +403,28 @@ void cleanup_scan_data_files(void)
 }
 
 
-void fill_scan_data_from_file(MTK_SPECTRUM_DATA *SD)
+/* returns the number of bytes parsed */
+size_t fill_scan_data_from_files(MTK_SPECTRUM_DATA *SD, const char *iq_file, const char *lna_lpf_file)
 {
     MTK_SPECTRUM_DATA *psd = SD;
     FILE *fp_iq;
     FILE *fp_lna_lpf;
+    size_t parsed;
     int i;
 
-    fp_iq = fopen(IQ_FILE_LOC,"r");
+    fp_iq = fopen(iq_file,"r");
     if(fp_iq == NULL)
     {
-        error(MODULE, "Failed to run the command for %s\n", IQ_FILE_LOC);
-        return;
+        error(MODULE, "Failed to run the command for %s\n", iq_file);
+        return 0;
     }
 
-    fp_lna_lpf = fopen(LNA_LPF_FILE_LOC,"r");
+    fp_lna_lpf = fopen(lna_lpf_file,"r");
     if(fp_lna_lpf == NULL)
     {
-        error(MODULE, "Failed to run the command for %s\n", LNA_LPF_FILE_LOC);
+        error(MODULE, "Failed to run the command for %s\n", lna_lpf_file);
         fclose(fp_iq);
-        return;
+        return 0;
     }
 
     memset(psd, 0, sizeof(MTK_SPECTRUM_DATA));
@@ -309,8 +437,18 @@ void fill_scan_data_from_file(MTK_SPECTRUM_DATA *SD)
         psd++;
     }
 
+    parsed = ftell(fp_iq) + ftell(fp_lna_lpf);
+
     if(fp_iq)
         fclose(fp_iq);
     if(fp_lna_lpf)
         fclose(fp_lna_lpf);
+
+    return parsed;
+}
+
+/* the capture the driver dumped last */
+size_t fill_scan_data_from_file(MTK_SPECTRUM_DATA *SD)
+{
+    return fill_scan_data_from_files(SD, IQ_FILE_LOC, LNA_LPF_FILE_LOC);
 }
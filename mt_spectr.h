@@ -15,6 +15,9 @@
 #endif
 
 #define MTK_SPECTRUM_DATA_LEN 32768
+/* the captures are taken at 20 MHz (ucBW 0), as many samples per us */
+#define ICAP_CAPTURE_BW BW_20
+#define ICAP_FS_MHZ (20 << ICAP_CAPTURE_BW)
 #define SPECTRAL_SAMP_DATA_LEN 512
 
 
@@ -83,11 +86,39 @@ typedef struct _ICAP_WIFI_SPECTRUM_SET_STRUC_T {
 	unsigned char aucReserved[3];
 } ICAP_WIFI_SPECTRUM_SET_STRUC_T, *P_ICAP_WIFI_SPECTRUM_SET_STRUC_T;
 
+/*
+ * Ring capture streaming: the ICAP keeps overwriting its buffer of
+ * MTK_SPECTRUM_DATA_LEN samples until it is stopped and dumped, and is
+ * re-armed right after the dump, the buffer fills again while the dumped
+ * segment is parsed and processed. Of the time between two re-arms only
+ * the dumped buffer is seen, the rest (what the buffer overwrote, and the
+ * stop and the dump in the driver) is lost: gap_ns, dropped counts it in
+ * whole buffer lengths.
+ */
+#define ICAP_RING_MAX_DWELL_MS  60000                   /* per channel */
+
+struct icap_ring {
+    char *interface;
+    char node[2];
+    int node_f;
+    uint64_t buffer_ns;                             /* to fill the buffer */
+    uint64_t armed_at;                              /* 0 - stopped */
+    uint32_t segments;
+    uint32_t dropped;
+    uint64_t gap_ns;
+};
 
 int getWifiSpectrumBWandFreq(char *interface, mtk_ssd_info_t *pinfo);
 int set_wifi_spectrum_param(char* interface, mtk_ssd_info_t *pinfo, char* node, int node_f);
-void fill_scan_data_from_file(MTK_SPECTRUM_DATA *SD);
+size_t fill_scan_data_from_files(MTK_SPECTRUM_DATA *SD, const char *iq_file, const char *lna_lpf_file);
+size_t fill_scan_data_from_file(MTK_SPECTRUM_DATA *SD);
+int icap_ring_start(struct icap_ring *ring, char *interface, mtk_ssd_info_t *pinfo, char *node, int node_f);
+void icap_ring_wait(const struct icap_ring *ring);
+int icap_ring_segment(struct icap_ring *ring, mtk_ssd_info_t *pinfo);
+void icap_ring_stop(struct icap_ring *ring, mtk_ssd_info_t *pinfo);
 void cleanup_scan_data_files(void);
+void icap_lock(void);
+void icap_unlock(void);
 // void ubnt_process_spectral_data(uint16_t channel, struct ubnt_spectral_info *usi, SPECTRAL_SAMP_DATA *ssd);
 int nvram_set(char *interface, char *option, char *value);
 int interface_reload(char *interface);
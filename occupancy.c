@@ -0,0 +1,105 @@
+/*
+ * Ubiquiti RF Environment tool - time-domain channel occupancy
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "ubnt.h"
+#include "occupancy.h"
+
+void occupancy_reset(struct occupancy *occ)
+{
+    memset(occ, 0, sizeof(*occ));
+}
+
+/* age as the histograms are, the noise floor is kept */
+void occupancy_scale(struct occupancy *occ, double weight)
+{
+    int i;
+
+    occ->samples = (uint64_t)(occ->samples * weight);
+    occ->busy = (uint64_t)(occ->busy * weight);
+    occ->bursts = (uint32_t)(occ->bursts * weight);
+    for (i = 0; i < OCCUPANCY_BUCKETS; i++) {
+        occ->burst_us[i] = (uint32_t)(occ->burst_us[i] * weight);
+        occ->gap_us[i] = (uint32_t)(occ->gap_us[i] * weight);
+    }
+}
+
+void occupancy_merge(struct occupancy *dst, const struct occupancy *src)
+{
+    int i;
+
+    dst->samples += src->samples;
+    dst->busy += src->busy;
+    dst->bursts += src->bursts;
+    for (i = 0; i < OCCUPANCY_BUCKETS; i++) {
+        dst->burst_us[i] += src->burst_us[i];
+        dst->gap_us[i] += src->gap_us[i];
+    }
+    if (src->noise_floor > 0 && (!dst->noise_floor || src->noise_floor < dst->noise_floor))
+        dst->noise_floor = src->noise_floor;
+}
+
+/* a whole run of busy or idle samples, at fs_mhz samples per us */
+void occupancy_add_run(struct occupancy *occ, int busy, uint32_t samples, unsigned int fs_mhz)
+{
+    uint32_t us = samples / fs_mhz;
+    int bucket = us ? MIN(32 - __builtin_clz(us), OCCUPANCY_BUCKETS - 1) : 0;
+
+    if (busy)
+        occ->burst_us[bucket]++;
+    else
+        occ->gap_us[bucket]++;
+}
+
+/* busy share of the observed time, in % */
+double occupancy_duty(const struct occupancy *occ)
+{
+    return occ->samples ? 100.0 * occ->busy / occ->samples : 0;
+}
+
+static json_t *occupancy_buckets_json(const uint32_t *buckets)
+{
+    json_t *array = json_array();
+    int i;
+
+    for (i = 0; i < OCCUPANCY_BUCKETS; i++)
+        json_array_append_new(array, json_integer(buckets[i]));
+    return array;
+}
+
+/* NULL if nothing was observed */
+json_t *occupancy_json(const struct occupancy *occ)
+{
+    json_t *json;
+
+    if (!occ->samples)
+        return NULL;
+    json = json_object();
+    json_object_set_new(json, "duty", json_real(round(10 * occupancy_duty(occ)) / 10));
+    json_object_set_new(json, "bursts", json_integer(occ->bursts));
+    json_object_set_new(json, "burst_us", occupancy_buckets_json(occ->burst_us));
+    json_object_set_new(json, "gap_us", occupancy_buckets_json(occ->gap_us));
+    return json;
+}
+
+/*
+ * Add "occupancy" to the entries of a spectrum table built from a usi of
+ * count channels. Returns -1 if the table does not hold one entry per
+ * channel, it is then left as it is.
+ */
+int occupancy_add_json(json_t *table, const struct occupancy *occ, int count)
+{
+    json_t *json;
+    int i;
+
+    if (!json_is_array(table) || json_array_size(table) != count)
+        return -1;
+    for (i = 0; i < count; i++) {
+        if ((json = occupancy_json(&occ[i])))
+            json_object_set_new(json_array_get(table, i), "occupancy", json);
+    }
+    return 0;
+}
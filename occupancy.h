@@ -0,0 +1,50 @@
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include <stdint.h>
+#include <jansson.h>
+
+/*
+ * Time-domain channel occupancy from the energy detector (see
+ * process_occupancy_data()): how much of the captured time the channel
+ * was busy, and the lengths of its bursts and idle gaps.
+ *
+ * Run lengths go to log2 buckets of microseconds: bucket 0 holds runs
+ * under 1 us, bucket b [2^(b-1), 2^b) us, the last one everything longer.
+ * Only runs whose both edges were seen are bucketed, the ones cut by the
+ * capture boundaries or a gain switch only count towards the duty cycle.
+ */
+
+#define OCCUPANCY_BUCKETS       12                  /* up to >= 1024 us */
+/* smoothing of the sample power, a power of two */
+#define OCCUPANCY_SMOOTH        16
+/* busy above the noise floor by this much, idle again below the lower one */
+#define OCCUPANCY_ON_DB         6
+#define OCCUPANCY_OFF_DB        3
+/* noise floor tracking: follows drops fast, rises slowly and only when idle */
+#define OCCUPANCY_NF_FALL       16
+#define OCCUPANCY_NF_RISE       4096
+
+struct occupancy {
+    uint64_t samples;                               /* observed, settling after gain switches excluded */
+    uint64_t busy;
+    uint32_t bursts;                                /* busy runs started */
+    uint32_t burst_us[OCCUPANCY_BUCKETS];
+    uint32_t gap_us[OCCUPANCY_BUCKETS];
+    double noise_floor;                             /* linear sample power, 0 - not known yet */
+};
+
+void occupancy_reset(struct occupancy *occ);
+void occupancy_scale(struct occupancy *occ, double weight);
+void occupancy_merge(struct occupancy *dst, const struct occupancy *src);
+void occupancy_add_run(struct occupancy *occ, int busy, uint32_t samples, unsigned int fs_mhz);
+double occupancy_duty(const struct occupancy *occ);
+
+/*
+ * Only the JSON table carries the occupancy: the binary table, its deltas
+ * and the shared memory segment leave it out.
+ */
+json_t *occupancy_json(const struct occupancy *occ);
+int occupancy_add_json(json_t *table, const struct occupancy *occ, int count);
+
+#endif //OCCUPANCY_H
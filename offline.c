@@ -0,0 +1,505 @@
+/*
+ * Ubiquiti RF Environment tool - offline processing of recorded captures
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+#include <jansson.h>
+
+#include "offline.h"
+#include "fft_proc.h"
+#include "proc_pool.h"
+#include "profile.h"
+#include "occupancy.h"
+
+#define IQ_SUFFIX       "_IQ.txt"
+#define LNA_LPF_SUFFIX  "_LNA_LPF.txt"
+/* <ap> <band> <channel> <iq file> <lna_lpf file> with room for the separators */
+#define MANIFEST_LINE_LEN (OFFLINE_AP_LEN + 2 * OFFLINE_PATH_LEN + 32)
+
+struct offline_capture {
+    char ap[OFFLINE_AP_LEN];
+    enum nl80211_band band_5g;
+    uint8_t channel;
+    char iq_file[OFFLINE_PATH_LEN];
+    char lna_lpf_file[OFFLINE_PATH_LEN];
+};
+
+/* a table being built, its statistics exist while runs are pending */
+struct offline_table {
+    const char *ap;
+    enum nl80211_band band_5g;
+    pthread_mutex_t lock;
+    int pending;
+    bool ready;
+    struct ubnt_radio stats;
+};
+
+/* consecutive captures of a table, processed by one worker */
+struct offline_run {
+    struct offline_table *table;
+    struct offline_capture *first;
+    int count;
+};
+
+struct offline_list {
+    struct offline_capture *caps;
+    int count;
+    int size;
+};
+
+static struct {
+    const char *out_dir;
+    struct psd_cfg psd;                                 /* of the processing */
+    mtk_ssd_info_t band[2];                             /* channel lists of 2.4G and 5G */
+    struct offline_run *runs;
+    int num_runs;
+    int next_run;
+    pthread_mutex_t lock;
+    uint64_t windows;
+    int failed;
+} offline = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int offline_add(struct offline_list *list, const struct offline_capture *cap)
+{
+    struct offline_capture *tmp;
+
+    if (list->count == list->size) {
+        tmp = realloc(list->caps, MAX(list->size * 2, 64) * sizeof(*tmp));
+        if (!tmp) {
+            error(MODULE, "UOH, not enough memory!!!");
+            return -1;
+        }
+        list->caps = tmp;
+        list->size = MAX(list->size * 2, 64);
+    }
+    list->caps[list->count++] = *cap;
+    return 0;
+}
+
+/* whether the channel is one of the 20 MHz channels of the band the tables are built on */
+static bool offline_channel_listed(enum nl80211_band band_5g, unsigned int channel)
+{
+    const mtk_ssd_info_t *band = &offline.band[band_5g ? 1 : 0];
+    int i;
+
+    for (i = 0; i < band->channels_in_bw; i++) {
+        if (band->chan_list[i].channel == channel)
+            return true;
+    }
+    return false;
+}
+
+/* 0 - the path fits in OFFLINE_PATH_LEN, -1 - it does not */
+static int offline_path(char *path, const char *dir, const char *file)
+{
+    int len;
+
+    if (file[0] == '/' || !dir)
+        len = snprintf(path, OFFLINE_PATH_LEN, "%s", file);
+    else
+        len = snprintf(path, OFFLINE_PATH_LEN, "%s/%s", dir, file);
+    return len < 0 || len >= OFFLINE_PATH_LEN ? -1 : 0;
+}
+
+static int offline_read_manifest(const char *manifest, struct offline_list *list)
+{
+    /* the fields get the size of the line, so that none is split by sscanf() */
+    char line[MANIFEST_LINE_LEN], ap[MANIFEST_LINE_LEN], band[MANIFEST_LINE_LEN];
+    char iq[MANIFEST_LINE_LEN], lna_lpf[MANIFEST_LINE_LEN];
+    char dir_buf[OFFLINE_PATH_LEN], *dir;
+    size_t len;
+    struct offline_capture cap;
+    unsigned int channel;
+    int lineno = 0;
+    FILE *fp;
+
+    fp = fopen(manifest, "r");
+    if (!fp) {
+        error(MODULE, "cannot open %s\n", manifest);
+        return -1;
+    }
+    snprintf(dir_buf, sizeof(dir_buf), "%s", manifest);
+    dir = dirname(dir_buf);
+
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        memset(&cap, 0, sizeof(cap));
+        len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n' && !feof(fp)) {
+            warn(MODULE, "%s:%d: longer than %d characters\n", manifest, lineno, MANIFEST_LINE_LEN - 2);
+            while (fgets(line, sizeof(line), fp) && line[strlen(line) - 1] != '\n')
+                ;
+            continue;
+        }
+        if (line[strspn(line, " \t\r\n")] == '#' || !line[strspn(line, " \t\r\n")])
+            continue;
+        if (sscanf(line, "%s %s %u %s %s", ap, band, &channel, iq, lna_lpf) != 5 ||
+            (band[0] != '2' && band[0] != '5')) {
+            warn(MODULE, "%s:%d: not <ap> <band> <channel> <iq file> <lna_lpf file>\n", manifest, lineno);
+            continue;
+        }
+        cap.band_5g = band[0] == '5' ? NL80211_BAND_5GHZ : NL80211_BAND_2GHZ;
+        if (!offline_channel_listed(cap.band_5g, channel)) {
+            warn(MODULE, "%s:%d: no channel %u in the %cG band\n", manifest, lineno, channel, band[0]);
+            continue;
+        }
+        cap.channel = channel;
+        if (strlen(ap) >= sizeof(cap.ap)) {
+            warn(MODULE, "%s:%d: ap name longer than %d characters\n", manifest, lineno, OFFLINE_AP_LEN - 1);
+            continue;
+        }
+        strcpy(cap.ap, ap);
+        if (offline_path(cap.iq_file, dir, iq) || offline_path(cap.lna_lpf_file, dir, lna_lpf)) {
+            warn(MODULE, "%s:%d: path longer than %d characters\n", manifest, lineno, OFFLINE_PATH_LEN - 1);
+            continue;
+        }
+        if (offline_add(list, &cap)) {
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int offline_read_dir(const char *dir, struct offline_list *list)
+{
+    struct offline_capture cap;
+    struct dirent *de;
+    unsigned int channel;
+    size_t len;
+    char band;
+    DIR *d;
+
+    d = opendir(dir);
+    if (!d) {
+        error(MODULE, "cannot open %s\n", dir);
+        return -1;
+    }
+    while ((de = readdir(d))) {
+        len = strlen(de->d_name);
+        if (len <= strlen(IQ_SUFFIX) || strcmp(de->d_name + len - strlen(IQ_SUFFIX), IQ_SUFFIX))
+            continue;
+        memset(&cap, 0, sizeof(cap));
+        if (sscanf(de->d_name, "%63[^_]_%cg_ch%u_", cap.ap, &band, &channel) != 3 ||
+            (band != '2' && band != '5')) {
+            debug(MODULE, "%s: not <ap>_<2|5>g_ch<channel>_..., skipped\n", de->d_name);
+            continue;
+        }
+        cap.band_5g = band == '5' ? NL80211_BAND_5GHZ : NL80211_BAND_2GHZ;
+        if (!offline_channel_listed(cap.band_5g, channel)) {
+            warn(MODULE, "%s: no channel %u in the %cG band, skipped\n", de->d_name, channel, band);
+            continue;
+        }
+        cap.channel = channel;
+        if (offline_path(cap.iq_file, dir, de->d_name) ||
+            snprintf(cap.lna_lpf_file, sizeof(cap.lna_lpf_file), "%s/%.*s" LNA_LPF_SUFFIX, dir,
+                     (int)(len - strlen(IQ_SUFFIX)), de->d_name) >= (int)sizeof(cap.lna_lpf_file)) {
+            warn(MODULE, "%s: path longer than %d characters, skipped\n", de->d_name, OFFLINE_PATH_LEN - 1);
+            continue;
+        }
+        if (offline_add(list, &cap)) {
+            closedir(d);
+            return -1;
+        }
+    }
+    closedir(d);
+    return 0;
+}
+
+static int offline_read(const char *source, struct offline_list *list)
+{
+    char manifest[OFFLINE_PATH_LEN];
+    struct stat st;
+
+    if (stat(source, &st)) {
+        error(MODULE, "cannot access %s\n", source);
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode))
+        return offline_read_manifest(source, list);
+
+    snprintf(manifest, sizeof(manifest), "%s/%s", source, OFFLINE_MANIFEST);
+    if (!access(manifest, R_OK))
+        return offline_read_manifest(manifest, list);
+    return offline_read_dir(source, list);
+}
+
+static int offline_cmp(const void *a, const void *b)
+{
+    const struct offline_capture *x = a, *y = b;
+    int ret = strcmp(x->ap, y->ap);
+
+    if (ret)
+        return ret;
+    if (x->band_5g != y->band_5g)
+        return x->band_5g - y->band_5g;
+    return x->channel - y->channel;
+}
+
+static void offline_write_table(struct offline_table *table)
+{
+    char fname[OFFLINE_PATH_LEN], ftemp[OFFLINE_PATH_LEN + 8];
+    struct channel_bw best_channels[NUM_SUGGESTED_CHANNELS];
+    mtk_ssd_info_t *band = &offline.band[table->band_5g ? 1 : 0];
+    json_t *json_root, *json_table;
+    int i;
+
+    /* as at the end of a scan */
+    for (i = 0; i < band->max_channels; i++) {
+        struct ubnt_spectral_stats *uss = &table->stats.usi.table[i];
+
+        if (uss->chan_width != BW_20 || !uss->total_samples)
+            continue;
+        ubnt_process_channel_data(uss->channel, BW_20);
+        ubnt_mark_channel_scanned(uss->channel);
+    }
+    ubnt_process_bonded_channels(table->band_5g);
+
+    memset(best_channels, 0, sizeof(best_channels));
+    json_root = json_object();
+    json_table = prepare_spectrum_table_usi(&table->stats.usi);
+    occupancy_add_json(json_table, table->stats.occupancy, table->stats.usi.count);
+    json_object_set_new(json_root, "spectrum_table", json_table);
+    get_best_channels(&table->stats.usi, table->band_5g ? OFFLINE_RADIO_IF_5G : OFFLINE_RADIO_IF_2G,
+                      best_channels, NUM_SUGGESTED_CHANNELS);
+    json_object_set_new(json_root, "suggested_channels", prepare_suggested_channels(best_channels, NUM_SUGGESTED_CHANNELS));
+
+    snprintf(fname, sizeof(fname), "%s/rftable_%s_%s", offline.out_dir, table->ap, table->band_5g ? "5g" : "2g");
+    snprintf(ftemp, sizeof(ftemp), "%s.temp", fname);
+    if (json_dump_file(json_root, ftemp, JSON_COMPACT) || rename(ftemp, fname)) {
+        error(MODULE, "failed to write %s\n", fname);
+        unlink(ftemp);
+    } else {
+        info(MODULE, "%s written\n", fname);
+    }
+    json_decref(json_root);
+}
+
+/* add the worker statistics to the table, the last run writes it out */
+static void offline_merge(struct offline_table *table, struct ubnt_radio *shard)
+{
+    mtk_ssd_info_t *band = &offline.band[table->band_5g ? 1 : 0];
+    mtk_ssd_info_t none = { 0 };
+
+    pthread_mutex_lock(&table->lock);
+    ubnt_select_radio(&table->stats);
+    if (!table->ready) {
+        ubnt_init(band->max_channels, band->chan_list, table->band_5g);
+        table->ready = true;
+    }
+    ubnt_merge_radio(shard);
+    if (!--table->pending) {
+        offline_write_table(table);
+        /* the channel list is shared, keep it */
+        ubnt_cleanup(&none);
+        table->ready = false;
+    }
+    ubnt_select_radio(shard);
+    pthread_mutex_unlock(&table->lock);
+}
+
+static struct offline_run *offline_next_run(void)
+{
+    struct offline_run *run = NULL;
+
+    pthread_mutex_lock(&offline.lock);
+    if (offline.next_run < offline.num_runs)
+        run = &offline.runs[offline.next_run++];
+    pthread_mutex_unlock(&offline.lock);
+    return run;
+}
+
+static void *offline_worker(void *arg)
+{
+    struct ubnt_radio shards[2];
+    bool shard_ready[2] = { false, false };
+    mtk_ssd_info_t info = { 0 }, none = { 0 };
+    MTK_SPECTRUM_DATA *sd;
+    struct offline_run *run;
+    struct offline_capture *cap;
+    struct occupancy *occ;
+    uint64_t windows = 0;
+    uint16_t sample_idx;
+    int failed = 0, b, i;
+
+    memset(shards, 0, sizeof(shards));
+    sd = (MTK_SPECTRUM_DATA *)malloc(MTK_SPECTRUM_DATA_LEN * sizeof(MTK_SPECTRUM_DATA));
+    info.pssd = (SPECTRAL_SAMP_DATA *)malloc(SPECTRAL_SAMP_DATA_LEN * sizeof(SPECTRAL_SAMP_DATA));
+    info.psd = offline.psd;
+    if (!sd || !info.pssd) {
+        error(MODULE, "UOH, not enough memory!!!");
+        goto out;
+    }
+
+    while ((run = offline_next_run())) {
+        b = run->table->band_5g ? 1 : 0;
+        ubnt_select_radio(&shards[b]);
+        if (!shard_ready[b]) {
+            ubnt_init(offline.band[b].max_channels, offline.band[b].chan_list, run->table->band_5g);
+            shard_ready[b] = true;
+        } else {
+            ubnt_clear_scan_data();
+        }
+
+        for (i = 0, cap = run->first; i < run->count; i++, cap++) {
+            if (!fill_scan_data_from_files(sd, cap->iq_file, cap->lna_lpf_file)) {
+                failed++;
+                continue;
+            }
+            info.current_channel = cap->channel;
+            if ((occ = ubnt_get_channel_occupancy(cap->channel)))
+                process_occupancy_data(sd, 0, ieee80211_channel_to_frequency(cap->channel, cap->band_5g), occ);
+            process_spectrum_data(sd, &info, 0, ieee80211_channel_to_frequency(cap->channel, cap->band_5g));
+            for (sample_idx = 0; sample_idx < info.window_num; sample_idx++) {
+                info.pssd[sample_idx].ch_width = BW_20;
+                ubnt_process_spectral_data(&info, sample_idx);
+            }
+            ubnt_mark_channel_scanned(cap->channel);
+            windows += info.window_num;
+        }
+        offline_merge(run->table, &shards[b]);
+    }
+
+    for (b = 0; b < 2; b++) {
+        if (shard_ready[b]) {
+            ubnt_select_radio(&shards[b]);
+            ubnt_cleanup(&none);
+        }
+    }
+out:
+    ubnt_select_radio(NULL);
+    free(info.pssd);
+    free(sd);
+
+    pthread_mutex_lock(&offline.lock);
+    offline.windows += windows;
+    offline.failed += failed;
+    pthread_mutex_unlock(&offline.lock);
+    return NULL;
+}
+
+/*
+ * Split the captures, sorted by table, in runs: a table gets about one run
+ * per worker so that a single large table still spreads over all of them.
+ */
+static int offline_plan(struct offline_capture *caps, int count, bool merged, int jobs,
+                        struct offline_table **tables, int *num_tables)
+{
+    int i, start, end, run_len, t = 0;
+
+    *tables = calloc(count, sizeof(struct offline_table));
+    offline.runs = calloc(count, sizeof(struct offline_run));
+    if (!*tables || !offline.runs)
+        return -1;
+
+    for (start = 0; start < count; start = end) {
+        for (end = start + 1; end < count; end++) {
+            if (caps[end].band_5g != caps[start].band_5g ||
+                (!merged && strcmp(caps[end].ap, caps[start].ap)))
+                break;
+        }
+        (*tables)[t].ap = merged ? "merged" : caps[start].ap;
+        (*tables)[t].band_5g = caps[start].band_5g;
+        pthread_mutex_init(&(*tables)[t].lock, NULL);
+
+        run_len = MAX((end - start + jobs - 1) / jobs, OFFLINE_MIN_RUN);
+        for (i = start; i < end; i += run_len) {
+            offline.runs[offline.num_runs].table = &(*tables)[t];
+            offline.runs[offline.num_runs].first = &caps[i];
+            offline.runs[offline.num_runs].count = MIN(run_len, end - i);
+            offline.num_runs++;
+            (*tables)[t].pending++;
+        }
+        t++;
+    }
+    *num_tables = t;
+    return 0;
+}
+
+static int offline_merged_cmp(const void *a, const void *b)
+{
+    const struct offline_capture *x = a, *y = b;
+
+    if (x->band_5g != y->band_5g)
+        return x->band_5g - y->band_5g;
+    return offline_cmp(a, b);
+}
+
+int offline_main(const char *source, const char *out_dir, bool merged, int jobs, const struct psd_cfg *psd)
+{
+    struct offline_list list = { 0 };
+    struct offline_table *tables = NULL;
+    pthread_t *threads;
+    pthread_attr_t attr;
+    uint64_t start;
+    int num_tables = 0, started = 0, i, ret = -1;
+
+    offline.out_dir = out_dir;
+    offline.psd = *psd;
+    if (jobs <= 0)
+        jobs = get_nprocs();
+    /* the captures are checked against them as they are read */
+    if (ubnt_default_chan_list(&offline.band[0], NL80211_BAND_2GHZ) ||
+        ubnt_default_chan_list(&offline.band[1], NL80211_BAND_5GHZ) ||
+        offline_read(source, &list))
+        goto out;
+    if (!list.count) {
+        error(MODULE, "no captures in %s\n", source);
+        goto out;
+    }
+    if (mkdir(out_dir, 0755) && access(out_dir, W_OK)) {
+        error(MODULE, "cannot write to %s\n", out_dir);
+        goto out;
+    }
+    qsort(list.caps, list.count, sizeof(*list.caps), merged ? offline_merged_cmp : offline_cmp);
+    if (offline_plan(list.caps, list.count, merged, jobs, &tables, &num_tables))
+        goto out;
+    jobs = MIN(jobs, offline.num_runs);
+    info(MODULE, "%d captures, %d tables, %d runs on %d workers\n", list.count, num_tables, offline.num_runs, jobs);
+
+    threads = calloc(jobs, sizeof(pthread_t));
+    if (!threads)
+        goto out;
+    start = prof_now();
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PROC_THREAD_STACK_SIZE);
+    for (i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], &attr, offline_worker, NULL)) {
+            error(MODULE, "failed to start worker %d\n", i);
+            break;
+        }
+        started++;
+    }
+    pthread_attr_destroy(&attr);
+    /* with no worker at all, process on this thread */
+    if (!started)
+        offline_worker(NULL);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    info(MODULE, "%d captures (%d failed), %llu windows in %llu ms\n", list.count, offline.failed,
+         (unsigned long long)offline.windows, (unsigned long long)((prof_now() - start) / 1000000));
+    ret = offline.failed == list.count ? -1 : 0;
+
+out:
+    for (i = 0; i < num_tables; i++)
+        pthread_mutex_destroy(&tables[i].lock);
+    free(tables);
+    free(offline.runs);
+    free(offline.band[0].chan_list);
+    free(offline.band[1].chan_list);
+    free(list.caps);
+    return ret;
+}
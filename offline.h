@@ -0,0 +1,39 @@
+#ifndef OFFLINE_H
+#define OFFLINE_H
+
+#include <stdbool.h>
+
+#include "ubnt.h"
+
+/*
+ * Offline mode: build tables from recorded ICAP captures instead of the
+ * radio. The captures come from a manifest, one per line:
+ *
+ *   <ap> <band 2|5> <channel> <iq file> <lna_lpf file>
+ *
+ * (relative paths are relative to the manifest, '#' starts a comment),
+ * or from a directory holding such a "manifest", or else capture pairs
+ * named <ap>_<2|5>g_ch<channel>_<anything>_IQ.txt / ..._LNA_LPF.txt.
+ *
+ * The captures are processed on all the workers; each worker accounts a
+ * run of captures of a table on its own statistics and merges them into
+ * the table at the end of the run. A table is written as
+ * <out_dir>/rftable_<ap>_<2g|5g>, or rftable_merged_<2g|5g> when all
+ * the APs are merged, as soon as all its captures are in.
+ */
+
+#define OFFLINE_PATH_LEN        256
+#define OFFLINE_AP_LEN          64
+#define OFFLINE_MANIFEST        "manifest"
+/* runs shorter than this do not pay for their merge */
+#define OFFLINE_MIN_RUN         4
+/*
+ * The captures do not record the radio, the suggested channels are taken
+ * for the default radio interface of the band (as rf-env -r).
+ */
+#define OFFLINE_RADIO_IF_2G     "ra0"
+#define OFFLINE_RADIO_IF_5G     "rai0"
+
+int offline_main(const char *source, const char *out_dir, bool merged, int jobs, const struct psd_cfg *psd);
+
+#endif //OFFLINE_H
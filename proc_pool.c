@@ -0,0 +1,152 @@
+/*
+ * Ubiquiti RF Environment tool - shared processing pool
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "proc_pool.h"
+#include "fft_proc.h"
+#include "cpu_budget.h"
+
+struct proc_job {
+    MTK_SPECTRUM_DATA *sd;
+    mtk_ssd_info_t *pinfo;
+    unsigned int chan_width;
+    unsigned int fc_mhz;
+    unsigned int windows;
+    bool done;
+    struct proc_job *next;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  queued;
+    pthread_cond_t  finished;
+    pthread_t       workers[PROC_POOL_MAX_WORKERS];
+    int             num_workers;
+    bool            stop;
+    struct proc_job *head, *tail;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .queued = PTHREAD_COND_INITIALIZER,
+    .finished = PTHREAD_COND_INITIALIZER,
+};
+
+static void *proc_pool_worker(void *arg)
+{
+    struct proc_job *job;
+
+    if (arg)
+        cpu_budget_idle();
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (!pool.head && !pool.stop)
+            pthread_cond_wait(&pool.queued, &pool.lock);
+        if (!pool.head)
+            break;
+        job = pool.head;
+        pool.head = job->next;
+        if (!pool.head)
+            pool.tail = NULL;
+        pthread_mutex_unlock(&pool.lock);
+
+        job->windows = process_spectrum_data(job->sd, job->pinfo, job->chan_width, job->fc_mhz);
+
+        pthread_mutex_lock(&pool.lock);
+        job->done = true;
+        pthread_cond_broadcast(&pool.finished);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+/* with idle, the workers run at SCHED_IDLE, see cpu_budget.h */
+int proc_pool_start(int workers, bool idle)
+{
+    pthread_attr_t attr;
+    int i;
+
+    workers = MIN(MAX(workers, 1), PROC_POOL_MAX_WORKERS);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PROC_THREAD_STACK_SIZE);
+
+    pool.stop = false;
+    for (i = 0; i < workers; i++) {
+        if (pthread_create(&pool.workers[i], &attr, proc_pool_worker, (void *)(intptr_t)idle)) {
+            error(MODULE, "%s: failed to start worker %d\n", __func__, i);
+            break;
+        }
+    }
+    pool.num_workers = i;
+    pthread_attr_destroy(&attr);
+    debug(MODULE, "%s: %d workers\n", __func__, pool.num_workers);
+
+    return pool.num_workers ? 0 : -1;
+}
+
+void proc_pool_stop(void)
+{
+    int i;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.queued);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i = 0; i < pool.num_workers; i++)
+        pthread_join(pool.workers[i], NULL);
+    pool.num_workers = 0;
+}
+
+/*
+ * Process count captures on the pool and wait for all of them, or one
+ * after the other in the calling thread when the pool is not running.
+ * Every capture has its own pinfo. Returns the total number of windows.
+ */
+unsigned int proc_pool_run_batch(MTK_SPECTRUM_DATA *const *SD, mtk_ssd_info_t *const *pinfo, unsigned int count,
+                                 unsigned int chan_width, unsigned int fc_mhz)
+{
+    struct proc_job jobs[PROC_POOL_MAX_BATCH];
+    unsigned int i, windows = 0;
+
+    count = MIN(count, PROC_POOL_MAX_BATCH);
+    if (!pool.num_workers) {
+        for (i = 0; i < count; i++)
+            windows += process_spectrum_data(SD[i], pinfo[i], chan_width, fc_mhz);
+        return windows;
+    }
+
+    memset(jobs, 0, count * sizeof(jobs[0]));
+    pthread_mutex_lock(&pool.lock);
+    for (i = 0; i < count; i++) {
+        jobs[i].sd = SD[i];
+        jobs[i].pinfo = pinfo[i];
+        jobs[i].chan_width = chan_width;
+        jobs[i].fc_mhz = fc_mhz;
+        if (pool.tail)
+            pool.tail->next = &jobs[i];
+        else
+            pool.head = &jobs[i];
+        pool.tail = &jobs[i];
+    }
+    pthread_cond_broadcast(&pool.queued);
+    for (i = 0; i < count; i++) {
+        while (!jobs[i].done)
+            pthread_cond_wait(&pool.finished, &pool.lock);
+        windows += jobs[i].windows;
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return windows;
+}
+
+/* process a capture on the pool and wait for the result */
+unsigned int proc_pool_run(MTK_SPECTRUM_DATA *SD, mtk_ssd_info_t *pinfo, unsigned int chan_width, unsigned int fc_mhz)
+{
+    return proc_pool_run_batch(&SD, &pinfo, 1, chan_width, fc_mhz);
+}
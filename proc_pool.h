@@ -0,0 +1,26 @@
+#ifndef PROC_POOL_H
+#define PROC_POOL_H
+
+#include <stdbool.h>
+
+#include "mt_spectr.h"
+
+/*
+ * Processing pool shared by the radio control threads: captures are
+ * turned into spectral windows by a bounded set of workers, so that
+ * concurrent radios do not oversubscribe the CPU.
+ */
+
+#define PROC_POOL_MAX_WORKERS 8
+/* captures of one proc_pool_run_batch(), the receive chains of a radio */
+#define PROC_POOL_MAX_BATCH 4
+/* process_spectrum_data() keeps its FFT buffers on the stack */
+#define PROC_THREAD_STACK_SIZE (512 * 1024)
+
+int proc_pool_start(int workers, bool idle);
+void proc_pool_stop(void);
+unsigned int proc_pool_run(MTK_SPECTRUM_DATA *SD, mtk_ssd_info_t *pinfo, unsigned int chan_width, unsigned int fc_mhz);
+unsigned int proc_pool_run_batch(MTK_SPECTRUM_DATA *const *SD, mtk_ssd_info_t *const *pinfo, unsigned int count,
+                                 unsigned int chan_width, unsigned int fc_mhz);
+
+#endif //PROC_POOL_H
@@ -0,0 +1,168 @@
+/*
+ * Ubiquiti RF Environment tool - scan profiling
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ubnt.h"
+#include "profile.h"
+
+static const char *prof_stage_names[PROF_STAGES] = {
+    [PROF_CHANNEL]          = "channel",
+    [PROF_SET_CHANNEL]      = "set_channel",
+    [PROF_SETTLE]           = "settle",
+    [PROF_ICAP_LOCK]        = "icap_lock",
+    [PROF_ICAP_TRIGGER]     = "icap_trigger",
+    [PROF_CAPTURE_WAIT]     = "capture_wait",
+    [PROF_DUMP]             = "dump",
+    [PROF_PARSE]            = "parse",
+    [PROF_OCCUPANCY]        = "occupancy",
+    [PROF_PROCESS]          = "process",
+    [PROF_HISTOGRAM]        = "histogram",
+    [PROF_ZOOM]             = "zoom",
+    [PROF_UTILIZATION]      = "utilization",
+    [PROF_OUTPUT]           = "output",
+};
+
+static const char *prof_counter_names[PROF_COUNTERS] = {
+    [PROF_CAPTURES]         = "captures",
+    [PROF_WINDOWS]          = "windows",
+    [PROF_WINDOWS_REJECTED] = "windows_rejected",
+    [PROF_WINDOWS_EMPTY]    = "windows_empty",
+    [PROF_WINDOWS_DC]       = "windows_dc",
+    [PROF_WINDOWS_CLIPPED]  = "windows_clipped",
+    [PROF_GAIN_SWITCHES]    = "gain_switches",
+    [PROF_IOCTL_RETRIES]    = "ioctl_retries",
+    [PROF_BYTES_PARSED]     = "bytes_parsed",
+    [PROF_PROCESS_CPU_US]   = "process_cpu_us",
+    [PROF_PROCESS_WALL_US]  = "process_wall_us",
+    [PROF_THROTTLED_US]     = "throttled_us",
+    [PROF_ZOOM_SEGMENTS]    = "zoom_segments",
+    [PROF_RING_SEGMENTS]    = "ring_segments",
+    [PROF_RING_DROPPED]     = "ring_dropped",
+    [PROF_RING_GAP_US]      = "ring_gap_us",
+};
+
+uint64_t prof_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void prof_reset(struct scan_profile *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->seed = 1;
+    p->start_ns = prof_now();
+}
+
+/* account the stage that started at start_ns (from prof_now()) */
+void prof_record(struct scan_profile *p, enum prof_stage stage, uint64_t start_ns)
+{
+    struct prof_stage_stats *st;
+    uint64_t ns;
+    uint32_t slot, us;
+
+    if (!p)
+        return;
+    st = &p->stage[stage];
+    ns = prof_now() - start_ns;
+    st->total_ns += ns;
+    st->max_ns = MAX(st->max_ns, ns);
+    /* a channel visit with its settle time is seconds, beyond 32 bits of ns */
+    us = MIN(ns / 1000, UINT32_MAX);
+
+    /* keep a uniform sample of all the durations */
+    if (st->count < PROF_MAX_SAMPLES) {
+        st->samples_us[st->count] = us;
+    } else {
+        p->seed = p->seed * 1103515245 + 12345;
+        slot = p->seed % (st->count + 1);
+        if (slot < PROF_MAX_SAMPLES)
+            st->samples_us[slot] = us;
+    }
+    st->count++;
+}
+
+void prof_count(struct scan_profile *p, enum prof_counter counter, uint64_t n)
+{
+    if (p)
+        p->counter[counter] += n;
+}
+
+/* move the counters of src to dst, e.g. from the threads of parallel chains */
+void prof_collect_counters(struct scan_profile *dst, struct scan_profile *src)
+{
+    int i;
+
+    if (!dst || !src)
+        return;
+    for (i = 0; i < PROF_COUNTERS; i++) {
+        dst->counter[i] += src->counter[i];
+        src->counter[i] = 0;
+    }
+}
+
+static int prof_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static json_t *prof_stage_json(const struct prof_stage_stats *st)
+{
+    uint32_t sorted[PROF_MAX_SAMPLES];
+    uint32_t n = MIN(st->count, PROF_MAX_SAMPLES);
+    json_t *obj = json_object();
+
+    memcpy(sorted, st->samples_us, n * sizeof(uint32_t));
+    qsort(sorted, n, sizeof(uint32_t), prof_cmp);
+
+    json_object_set_new(obj, "count", json_integer(st->count));
+    json_object_set_new(obj, "total_us", json_integer(st->total_ns / 1000));
+    json_object_set_new(obj, "p50_us", json_integer(n ? sorted[(n - 1) / 2] : 0));
+    json_object_set_new(obj, "p99_us", json_integer(n ? sorted[(n - 1) * 99 / 100] : 0));
+    json_object_set_new(obj, "max_us", json_integer(st->max_ns / 1000));
+    return obj;
+}
+
+/*
+ * Write the profile of the scan so far:
+ *   {"duration_ms":..,"stages":{"<stage>":{"count","total_us","p50_us","p99_us","max_us"},..},
+ *    "counters":{"<counter>":..,..}}
+ */
+int prof_write(struct scan_profile *p, const char *path)
+{
+    char tmp[FILE_NAME_LEN + 8];
+    json_t *root, *stages, *counters;
+    int i, ret;
+
+    root = json_object();
+    stages = json_object();
+    counters = json_object();
+    json_object_set_new(root, "duration_ms", json_integer((prof_now() - p->start_ns) / 1000000));
+    for (i = 0; i < PROF_STAGES; i++) {
+        if (p->stage[i].count)
+            json_object_set_new(stages, prof_stage_names[i], prof_stage_json(&p->stage[i]));
+    }
+    for (i = 0; i < PROF_COUNTERS; i++)
+        json_object_set_new(counters, prof_counter_names[i], json_integer(p->counter[i]));
+    json_object_set_new(root, "stages", stages);
+    json_object_set_new(root, "counters", counters);
+
+    snprintf(tmp, sizeof(tmp), "%s.temp", path);
+    ret = json_dump_file(root, tmp, JSON_COMPACT | JSON_PRESERVE_ORDER);
+    json_decref(root);
+    if (ret) {
+        unlink(tmp);
+        return -1;
+    }
+    return rename(tmp, path);
+}
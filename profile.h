@@ -0,0 +1,75 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Per-scan stage timing and counters, written as a profile next to the
+ * table. Stage durations are taken with the monotonic clock; a bounded
+ * reservoir of them per stage gives the p50/p99 of the report.
+ */
+
+#define PROFILE_FILE_FMT    "/var/run/rftable_%s.profile"
+#define PROF_MAX_SAMPLES    512
+
+enum prof_stage {
+    PROF_CHANNEL,                                   /* a whole channel visit */
+    PROF_SET_CHANNEL,
+    PROF_SETTLE,
+    PROF_ICAP_LOCK,                                 /* waiting for the other radio's capture */
+    PROF_ICAP_TRIGGER,
+    PROF_CAPTURE_WAIT,
+    PROF_DUMP,
+    PROF_PARSE,                                     /* fill_scan_data_from_file() */
+    PROF_OCCUPANCY,                                 /* process_occupancy_data() */
+    PROF_PROCESS,                                   /* process_spectrum_data() */
+    PROF_HISTOGRAM,                                 /* ubnt_process_spectral_data() of a capture */
+    PROF_ZOOM,                                      /* process_zoom_data() */
+    PROF_UTILIZATION,
+    PROF_OUTPUT,                                    /* table, binary, shared memory and state */
+    PROF_STAGES
+};
+
+enum prof_counter {
+    PROF_CAPTURES,
+    PROF_WINDOWS,
+    PROF_WINDOWS_REJECTED,                          /* by the LNA check or the quality gate */
+    PROF_WINDOWS_EMPTY,                             /* as enum window_quality */
+    PROF_WINDOWS_DC,
+    PROF_WINDOWS_CLIPPED,
+    PROF_GAIN_SWITCHES,
+    PROF_IOCTL_RETRIES,
+    PROF_BYTES_PARSED,
+    PROF_PROCESS_CPU_US,                            /* background mode, see cpu_budget.h */
+    PROF_PROCESS_WALL_US,
+    PROF_THROTTLED_US,
+    PROF_ZOOM_SEGMENTS,
+    PROF_RING_SEGMENTS,                             /* ring capture streaming, see struct icap_ring */
+    PROF_RING_DROPPED,
+    PROF_RING_GAP_US,
+    PROF_COUNTERS
+};
+
+struct prof_stage_stats {
+    uint32_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint32_t samples_us[PROF_MAX_SAMPLES];          /* reservoir, as reported */
+};
+
+struct scan_profile {
+    uint64_t start_ns;
+    uint32_t seed;
+    struct prof_stage_stats stage[PROF_STAGES];
+    uint64_t counter[PROF_COUNTERS];
+};
+
+uint64_t prof_now(void);
+void prof_reset(struct scan_profile *p);
+void prof_record(struct scan_profile *p, enum prof_stage stage, uint64_t start_ns);
+void prof_count(struct scan_profile *p, enum prof_counter counter, uint64_t n);
+void prof_collect_counters(struct scan_profile *dst, struct scan_profile *src);
+int prof_write(struct scan_profile *p, const char *path);
+
+#endif //PROFILE_H
@@ -12,14 +12,32 @@
 #include <ctype.h>
 #include <getopt.h>
 #include <sys/sysinfo.h>
+#include <pthread.h>
 #include <jansson.h>
 
 #include "ubnt.h"
 #include "fft_proc.h"
+#include "sampler.h"
+#include "scheduler.h"
+#include "rssi_sketch.h"
+#include "state.h"
+#include "daemon.h"
+#include "proc_pool.h"
+#include "shm_table.h"
+#include "json_stream.h"
+#include "rftable_bin.h"
+#include "rftable_delta.h"
+#include "profile.h"
+#include "offline.h"
+#include "occupancy.h"
+#include "cpu_budget.h"
+#include "zoom.h"
+#include "chains.h"
 
 
 #define IFACE_MAX_LEN 32
-#define NUM_SUGGESTED_CHANNELS 4
+/* below this weight the previous statistics are dropped altogether */
+#define WARM_MIN_WEIGHT (1.0 / 64)
 
 
 /* investigation options */
@@ -27,10 +45,15 @@
 // #define SET_WIFI_SPECTR_SUPPORT
 // #define IF_INFO_4EACH_SAMP
 #define SPECTRAL_SCAN_SUPPORT
+// #define VERIFY_BINARY_TABLE     // read the .bin table back and compare it with the JSON one, see also rf-env-bench -c check
 
 
-static mtk_ssd_info_t  mtk_ssdinfo;
-static mtk_ssd_info_t *pinfo = &mtk_ssdinfo;
+/* radio 0 is set up by -r/-i/-B, radio 1 by -X (the other band) */
+#define MAX_RADIOS 2
+
+static mtk_ssd_info_t  mtk_ssdinfo[MAX_RADIOS];
+/* the radio the calling thread controls */
+static __thread mtk_ssd_info_t *pinfo = &mtk_ssdinfo[0];
 
 bool ubnt_spectral_table_ready = FALSE;
 
@@ -51,10 +74,36 @@ static void print_usage(char *name)
     // printf("b : set bandwidth channels\n");
     printf("B : set band 2.4G:0 5G:1\n");
 #ifdef SPECTRAL_SCAN_SUPPORT
-    printf("n : capture node [b,c,d,e]\n");
+    printf("n : capture node [b,c,d,e], several [b,c,...] are captured back-to-back on each channel, see %s\n",
+           CHAINS_FILE_FMT);
+    printf("m : combining of several capture nodes per bin [max|avg], default: max\n");
     printf("w : capture Node type [0..1]\n");
     printf("S : collect spectral scanning data\n");
+    printf("a : adaptive sampling, max captures per channel [1..%d]\n", UINT8_MAX);
+    printf("e : adaptive sampling, interference confidence interval [dB] (0..%d]\n", SAMPLER_MAX_CI_DB);
+    printf("E : energy detector only, channel occupancy without the FFT and histograms\n");
+    printf("P : Welch spectra [rect|hann|blackman][:overlap %%[:segments averaged]], default: rect:0:1\n");
+    printf("R : DFT points per 20 MHz [%d..%d], resolution bandwidth 20 MHz / points, default: %d\n",
+           PSD_MIN_DFT_SIZE, DFT_size_MAX, PSD_REF_DFT_SIZE);
+    printf("L : ring capture streaming of the (first) node, dwell per channel [ms] [0..%d], 0 - snapshots\n",
+           ICAP_RING_MAX_DWELL_MS);
+    printf("z : zoom FFT of a sub-band [center MHz[:span MHz]], default span: %d MHz, written to %s\n",
+           ZOOM_DEFAULT_SPAN_KHZ / 1000, ZOOM_FILE_FMT);
 #endif // SPECTRAL_SCAN_SUPPORT
+    printf("t : scan time budget [sec], 0 - unlimited\n");
+    printf("U : background processing at idle priority, at most [%%] of one core (0..100], 100 - unlimited\n");
+    printf("I : incremental scan, rescan channels older than [sec]\n");
+    printf("C : incremental scan, also rescan channels [ch,ch,...], alone: only these channels\n");
+    printf("W : warm start from the previous statistics, aged with half-life [sec]\n");
+    printf("D : daemon mode, serve scans and queries on unix socket [path]\n");
+    printf("M : also publish the table in shared memory %s\n", SHM_TABLE_NAME_FMT);
+    printf("K : also write the table in binary form %s\n", RFTABLE_BIN_FILE_FMT);
+    printf("Z : also write the changes since the previous binary table to %s (implies -K)\n", RFTABLE_DELTA_FILE_FMT);
+    printf("X : also scan the other band concurrently on [radio_if[:if_name]]\n");
+    printf("O : offline, build tables from the recorded captures of [manifest|dir], see offline.h\n");
+    printf("o : offline, output directory, default: .\n");
+    printf("G : offline, merge all the APs in one table per band\n");
+    printf("j : offline, worker threads, default: one per CPU\n");
     printf("v : verbose\n");
     printf("d : output to stdout instead of syslog\n");
     line();
@@ -63,37 +112,93 @@ static void print_usage(char *name)
 
 
 /*
- * Write table to file.
+ * Build the published table from a snapshot, best_channels gets the
+ * suggested channels.
  */
-static void write_spectrum_json_table(const char *radio_ifname)
+static json_t *prepare_spectrum_json(struct spectrum_snapshot *snap, const char *radio_ifname,
+                                     struct channel_bw *best_channels)
+{
+    json_t *json_root = json_object();
+    json_t *table = prepare_spectrum_table_usi(&snap->usi);
+
+    if (occupancy_add_json(table, snap->occupancy, snap->usi.count))
+        debug(MODULE, "spectrum table without one entry per channel, occupancy left out\n");
+    json_object_set_new(json_root, "spectrum_table", table);
+
+    // report top best channels in inform
+    get_best_channels(&snap->usi, radio_ifname, best_channels, NUM_SUGGESTED_CHANNELS);
+    json_object_set_new(json_root, "suggested_channels", prepare_suggested_channels(best_channels, NUM_SUGGESTED_CHANNELS));
+
+    return json_root;
+}
+
+/*
+ * Stream the table of a snapshot, same document as prepare_spectrum_json()
+ * in compact form. Returns 1 if the table could not be streamed.
+ */
+static int stream_spectrum_json(struct json_stream *js, struct spectrum_snapshot *snap,
+                                const char *radio_ifname, struct channel_bw *best_channels)
+{
+    json_t *suggested;
+    int ret = 0;
+
+    if (json_stream_puts(js, "{\"spectrum_table\":") ||
+        (ret = json_stream_spectrum_table(js, &snap->usi, snap->occupancy)))
+        return ret ? ret : -1;
+
+    get_best_channels(&snap->usi, radio_ifname, best_channels, NUM_SUGGESTED_CHANNELS);
+    suggested = prepare_suggested_channels(best_channels, NUM_SUGGESTED_CHANNELS);
+    ret = json_stream_puts(js, ",\"suggested_channels\":") || json_stream_dump(js, suggested) ||
+          json_stream_puts(js, "}");
+    json_decref(suggested);
+
+    return ret ? -1 : 0;
+}
+
+/*
+ * Write table to file, best_channels gets the suggested channels.
+ */
+static void write_spectrum_json_table(const char *radio_ifname, struct channel_bw *best_channels)
 {
     FILE *fp;
     char rftable_fname[FILE_NAME_LEN], rftable_ftemp[FILE_NAME_LEN], best_channel_fname[FILE_NAME_LEN];
-    struct channel_bw best_channels[NUM_SUGGESTED_CHANNELS];
-    json_t *json_root = json_object();
+    struct snapshot_pub *pub = &ubnt_get_radio()->snap;
+    struct spectrum_snapshot *snap = snapshot_acquire(pub);
+    struct json_stream js;
+    json_t *json_root;
+    int ret;
 
-    json_object_set_new(json_root, "spectrum_table", prepare_spectrum_table());
+    snprintf(rftable_ftemp, sizeof(rftable_ftemp), "/var/run/rftable_%s.temp", radio_ifname);
+    snprintf(rftable_fname, sizeof(rftable_fname), "/var/run/rftable_%s", radio_ifname);
+    memset(best_channels, 0, NUM_SUGGESTED_CHANNELS * sizeof(*best_channels));
+    if (json_stream_open(&js, rftable_ftemp)) {
+        snapshot_release(pub, snap);
+        return;
+    }
+    ret = stream_spectrum_json(&js, snap, radio_ifname, best_channels);
+    if (ret > 0) {
+        debug(MODULE, "spectrum table not streamable, writing it as a whole\n");
+        json_root = prepare_spectrum_json(snap, radio_ifname, best_channels);
+        ret = json_stream_rewind(&js) || json_stream_dump(&js, json_root);
+        json_decref(json_root);
+    }
+    snapshot_release(pub, snap);
+    if (json_stream_close(&js) || ret) {
+        error(MODULE, "failed to write %s\n", rftable_ftemp);
+        unlink(rftable_ftemp);
+        return;
+    }
 
     // get best channel for auto
     snprintf(best_channel_fname, sizeof(best_channel_fname), "/var/run/rftable_best_channel_%s", radio_ifname);
 
     fp = fopen(best_channel_fname, "w");
     if (fp) {
-        ubnt_get_best_channels(radio_ifname, best_channels, NUM_SUGGESTED_CHANNELS);
         fprintf(fp, "%d", best_channels[0].channel);
         fclose(fp);
     }
 
-    // report top best channels in inform
-    json_object_set_new(json_root, "suggested_channels", prepare_suggested_channels(best_channels, NUM_SUGGESTED_CHANNELS));
-
-    snprintf(rftable_ftemp, sizeof(rftable_ftemp), "/var/run/rftable_%s.temp", radio_ifname);
-    snprintf(rftable_fname, sizeof(rftable_fname), "/var/run/rftable_%s", radio_ifname);
-    json_dump_file(json_root, rftable_ftemp, JSON_COMPACT);
-
     rename(rftable_ftemp, rftable_fname);
-
-    json_decref(json_root);
 }
 
 static void write_timestamp_file(char *filename)
@@ -159,6 +264,12 @@ static void cleanup_files(char *ifname)
         info(MODULE, " remove %s", buf);
         unlink(buf);
     }
+    snprintf(buf, sizeof(buf), "/var/run/rftable_%s.partial", ifname);
+    if(!access(buf, F_OK))
+    {
+        info(MODULE, " remove %s", buf);
+        unlink(buf);
+    }
 }
 
 
@@ -172,163 +283,562 @@ static void mark_spectrum_scan_done(char *ifname)
     write_timestamp_file(buf);
 }
 
-/* define greater than one to increase preciseness */
-#define ATTEMPTS_OF_SAMPLES 3
-#define ATTEMPTS_4_UTILIZATION
+#ifdef SPECTRAL_SCAN_SUPPORT
+/* set Wifi-spectrum mode for a scan */
+static void icap_mode_enter(char *radio_if_name)
+{
+#ifdef SET_WIFI_SPECTR_SUPPORT // "IcapMode" option changing in platdep_funcs.sh
+    nvram_set(radio_if_name, "IcapMode", "2");
+    interface_reload(radio_if_name);
+    info(MODULE, "Set WifiScan mode\n");
+    sleep(3); // waiting 3 sec to change the driver mode
+#endif // SET_WIFI_SPECTR_SUPPORT
+}
 
+/* restore Normal mode after a scan */
+static int icap_mode_leave(char *radio_if_name)
+{
+    int ret = nvram_set(radio_if_name, "IcapMode", "0");
+
+    // ret = interface_reload(radio_if_name);
+    // there is no need to apply (in case softrestart applies)
+    info(MODULE, "Restore Normal mode\n");
+    return ret;
+}
 
 /*
- * Function     : main
- * Description  : entry point
- * Input params : argc, argv
- * Return       : status
- *
+ * Whether the radio is on the channel of channel_index, it becomes the
+ * current channel then. Returns -1 if not.
  */
-int main(int argc, char *argv[])
+static int check_current_channel(char *radio_if_name)
 {
-    int i, c, attempt;
-    // int  bw = -1;
-    enum nl80211_band band_5g = NL80211_BAND_5GHZ;
-    char radio_if_name[IFACE_MAX_LEN] = "rai0";  // default interface for MT7615
-    char if_name[IFACE_MAX_LEN]       = "rai0";  // the interface name is used to create json output files
+    uint8_t current_channel = get_current_channel(radio_if_name);
+
+    info(MODULE, "get_current_channel:%d\n", current_channel);
+    if(pinfo->chan_list[pinfo->channel_index].channel != current_channel) {
+        error(MODULE, "Error: set_channel idx:%d -> ch:%d\n", pinfo->channel_index, current_channel);
+        return -1;
+    }
+    pinfo->current_channel = pinfo->chan_list[pinfo->channel_index].channel;
+    pinfo->pssd->ch_width = pinfo->current_bw = pinfo->chan_list[pinfo->channel_index].bw;
+    info(MODULE, "OK - current_channel:%d\n", current_channel);
+    return 0;
+}
+
+/* the capture the driver dumped last into sd */
+static void parse_capture(MTK_SPECTRUM_DATA *sd)
+{
+    uint64_t t = prof_now();
+
+    prof_count(pinfo->prof, PROF_BYTES_PARSED, fill_scan_data_from_file(sd));
+    prof_record(pinfo->prof, PROF_PARSE, t);
+}
+
+/*
+ * Capture a node into sd, with the ICAP lock held.
+ * Returns -1 if the capture failed or the radio is not on the expected
+ * channel, sd is left as it was then: the dump file may be another's.
+ */
+static int capture_node(char *radio_if_name, char *node, int node_f, MTK_SPECTRUM_DATA *sd)
+{
+    int ret;
+
+    prof_count(pinfo->prof, PROF_CAPTURES, 1);
+    if ((ret = set_wifi_spectrum_param(radio_if_name, pinfo, node, node_f))) {
+        error(MODULE, "fail: set_wifi_spectrum_param, ret:%d\n", ret);
+        return -1;
+    }
+    if (check_current_channel(radio_if_name))
+        return -1;
+
+    parse_capture(sd);
+    return 0;
+}
+
+/*
+ * Process the captures of all the chains in parallel, keep their RSSI and
+ * combine their windows into pinfo->pssd.
+ */
+static void process_chains(struct chain_set *chains, unsigned int fc_mhz)
+{
+    MTK_SPECTRUM_DATA *sd[CHAINS_MAX];
+    mtk_ssd_info_t *info[CHAINS_MAX];
+    uint8_t i;
+
+    chains_prepare(chains, pinfo);
+    for (i = 0; i < chains->count; i++) {
+        sd[i] = chains->chain[i].sd;
+        info[i] = &chains->chain[i].info;
+    }
+    proc_pool_run_batch(sd, info, chains->count, 0, fc_mhz);
+    chains_collect(chains, pinfo);
+    chains_account(chains, pinfo->channel_index);
+    combine_spectrum_data(pinfo, info, chains->count, chains->combine, 0, fc_mhz);
+}
+
+/*
+ * Account a capture of the current channel: its windows, and its zoom
+ * spectrum if the channel holds the sub-band (zoom not NULL), or with
+ * occupancy_only just its energy detector occupancy. With chains, the
+ * windows of all their nodes are combined; the occupancy and the zoom
+ * spectrum are taken from the first one (sd).
+ */
+static void process_capture(MTK_SPECTRUM_DATA *sd, unsigned int fc_mhz, bool occupancy_only,
+                            struct zoom_spectrum *zoom, struct chain_set *chains)
+{
+    struct occupancy *occ;
     uint16_t sample_idx;
-#ifndef IF_INFO_4EACH_SAMP
-    struct ath_info iface_info;
-    uint8_t tmp_cu;
-    uint8_t ch_gr40_cnt = 0;
-    uint8_t ch_gr80_cnt = 0;
-    uint8_t ch_gr160_cnt = 0;
-#endif //IF_INFO_4EACH_SAMP
-#ifdef SPECTRAL_SCAN_SUPPORT
-    int  node_f = 0;
-    char node[2] = "b";
-    bool scan_flag = false;
-    MTK_SPECTRUM_DATA sd[MTK_SPECTRUM_DATA_LEN];
-    SPECTRAL_SAMP_DATA ssd[SPECTRAL_SAMP_DATA_LEN];
-    pinfo->pssd = ssd;
-#endif //SPECTRAL_SCAN_SUPPORT
-    struct ubnt_spectral_info *p_usi = get_usi_p();
+    uint64_t t;
 
-    int  ret = 0;
+    t = prof_now();
+    if ((occ = ubnt_get_channel_occupancy(pinfo->current_channel)))
+        process_occupancy_data(sd, 0, fc_mhz, occ);
+    prof_record(pinfo->prof, PROF_OCCUPANCY, t);
+    if (occupancy_only)
+        return;
 
-    while ((c = getopt (argc, argv, "hHi:r:b:B:n:w:Svd")) != -1) {
-        switch (c) {
-            case 'h':
-            case 'H':
-                print_usage(argv[0]);
-                return ret;
-            case 'i':
-                snprintf(if_name, IFACE_MAX_LEN, "%s", optarg);
-                break;
-            case 'r':
-                snprintf(radio_if_name, IFACE_MAX_LEN, "%s", optarg);
-                break;
-            // case 'b':
-            //     bw = atoi(optarg);
-            //     break;
-            case 'B':
-                band_5g = !!(atoi(optarg)); // default 1 --> 5G
-                break;
-#ifdef SPECTRAL_SCAN_SUPPORT
-            case 'n':
-                memcpy(node, optarg, strlen(node));
-                break;
-            case 'w':
-                node_f = atoi(optarg);
-                break;
-            case 'S':
-                scan_flag = true;
-                break;
-#endif //SPECTRAL_SCAN_SUPPORT
-            case 'v':
-                libubnt_log_level = (libubnt_log_level << 1);
-                break;
-            case 'd':
-                libubnt_log_use_syslog = 0;
+    // TODO: scan only in BW: 20MHz; other settings does not work...
+    t = prof_now();
+    if (chains)
+        process_chains(chains, fc_mhz);
+    else
+        proc_pool_run(sd, pinfo, 0 /*p_usi->table[pinfo->channel_index].chan_width*/, fc_mhz);
+    prof_record(pinfo->prof, PROF_PROCESS, t);
+    prof_count(pinfo->prof, PROF_WINDOWS, pinfo->window_num);
+
+    t = prof_now();
+    for (sample_idx = 0; sample_idx < pinfo->window_num; sample_idx++) {
+        pinfo->pssd[sample_idx].ch_width = BW_20;
+        ubnt_process_spectral_data(pinfo, sample_idx);
+    }
+    prof_record(pinfo->prof, PROF_HISTOGRAM, t);
+
+    if (zoom) {
+        t = prof_now();
+        prof_count(pinfo->prof, PROF_ZOOM_SEGMENTS, process_zoom_data(sd, 0, fc_mhz, zoom));
+        prof_record(pinfo->prof, PROF_ZOOM, t);
+    }
+}
+
+/*
+ * Capture one ICAP snapshot on the current channel and account it, see
+ * process_capture(). With chains, all their nodes are captured.
+ * Returns -1 if a capture failed or the radio is not on the expected channel.
+ */
+static int capture_spectrum(char *radio_if_name, char *node, int node_f, MTK_SPECTRUM_DATA *sd,
+                            enum nl80211_band band_5g, bool occupancy_only, struct zoom_spectrum *zoom,
+                            struct chain_set *chains)
+{
+    uint64_t t;
+    int ret = 0;
+    uint8_t i;
+
+    /* the capture files are shared with the other radio */
+    t = prof_now();
+    icap_lock();
+    prof_record(pinfo->prof, PROF_ICAP_LOCK, t);
+    if (!chains) {
+        ret = capture_node(radio_if_name, node, node_f, sd);
+    } else {
+        /*
+         * back-to-back, the chain buffers keep the dumps apart; a failed
+         * node drops the batch, its buffer still holds an older dump
+         */
+        for (i = 0; i < chains->count; i++) {
+            if ((ret = capture_node(radio_if_name, chains->chain[i].node, node_f, chains->chain[i].sd))) {
+                error(MODULE, "fail: chain %u node %s, capture dropped\n", i, chains->chain[i].node);
                 break;
-            default:
-                print_usage(argv[0]);
-                abort();
+            }
         }
+    }
+    icap_unlock();
+    if (ret)
+        return -1;
 
-#ifdef ONLY_5G_SUPPORT
-        if (!band_5g) {
-            warn(MODULE, "5G - supported only\n");
-            return -1;
+    process_capture(sd, ieee80211_channel_to_frequency(pinfo->current_channel, band_5g),
+                    occupancy_only, zoom, chains);
+    return 0;
+}
+
+/*
+ * Stream the node on the current channel for dwell_ms with the ICAP in
+ * ring capture mode (struct icap_ring): the segments are dumped one after
+ * the other and each is accounted as a capture, see process_capture(),
+ * while the ring fills again. Only the dump and the parse hold the ICAP
+ * lock. Returns the number of segments, -1 if the ring could not be
+ * started or the radio is not on the expected channel.
+ */
+static int stream_spectrum(char *radio_if_name, char *node, int node_f, MTK_SPECTRUM_DATA *sd,
+                           enum nl80211_band band_5g, bool occupancy_only, struct zoom_spectrum *zoom,
+                           uint32_t dwell_ms, struct scan_scheduler *sched)
+{
+    struct icap_ring ring;
+    unsigned int fc_mhz;
+    uint64_t t, end;
+    int ret;
+
+    t = prof_now();
+    icap_lock();
+    prof_record(pinfo->prof, PROF_ICAP_LOCK, t);
+    ret = icap_ring_start(&ring, radio_if_name, pinfo, node, node_f);
+    if (!ret && (ret = check_current_channel(radio_if_name)))
+        icap_ring_stop(&ring, pinfo);
+    icap_unlock();
+    if (ret) {
+        error(MODULE, "fail: ring capture of node %s, ret:%d\n", node, ret);
+        return -1;
+    }
+    fc_mhz = ieee80211_channel_to_frequency(pinfo->current_channel, band_5g);
+
+    end = prof_now() + dwell_ms * 1000000ULL;
+    while (prof_now() < end && !sched_expired(sched)) {
+        prof_count(pinfo->prof, PROF_CAPTURES, 1);
+        icap_ring_wait(&ring);
+        t = prof_now();
+        icap_lock();
+        prof_record(pinfo->prof, PROF_ICAP_LOCK, t);
+        if (!(ret = icap_ring_segment(&ring, pinfo)))
+            parse_capture(sd);
+        icap_unlock();
+        if (ret) {
+            error(MODULE, "fail: ring capture segment, ret:%d\n", ret);
+            break;
         }
-#endif
+        process_capture(sd, fc_mhz, occupancy_only, zoom, NULL);
     }
 
+    icap_lock();
+    icap_ring_stop(&ring, pinfo);
+    icap_unlock();
+    info(MODULE, "Ch: %d; ring segments: %u, dropped: %u, gap: %llu us\n", pinfo->current_channel,
+         ring.segments, ring.dropped, (unsigned long long)(ring.gap_ns / 1000));
+    return ring.segments;
+}
+#endif // SPECTRAL_SCAN_SUPPORT
 
-#ifdef SPECTRAL_SCAN_SUPPORT
-    if(scan_flag) {
-        if (band_5g) {
-            ret = nvram_set(radio_if_name, "WirelessMode", "14"); // 11A/AN/AC mixed 5G band only            
-        } else {
-            ret = nvram_set(radio_if_name, "WirelessMode", "9"); // 11bgn mixed
+/**
+ * The scan hit its time budget: the table only holds the visited channels.
+ */
+static void mark_spectrum_scan_partial(char *ifname, uint16_t visited, uint16_t total)
+{
+    char buf[FILE_NAME_LEN];
+    FILE *fp;
+
+    snprintf(buf, sizeof(buf), "/var/run/rftable_%s.partial", ifname);
+    fp = fopen(buf, "w");
+    if (fp) {
+        fprintf(fp, "%u/%u\n", visited, total);
+        fclose(fp);
+    }
+}
+
+static bool channel_listed(uint8_t channel, const uint8_t *list, uint8_t list_len)
+{
+    uint8_t i;
+
+    for (i = 0; i < list_len; i++) {
+        if (list[i] == channel)
+            return true;
+    }
+    return false;
+}
+
+static uint8_t parse_channel_list(char *arg, uint8_t *list, uint8_t max_len)
+{
+    char *tok, *save = NULL;
+    uint8_t len = 0;
+
+    for (tok = strtok_r(arg, ",", &save); tok && len < max_len; tok = strtok_r(NULL, ",", &save))
+        list[len++] = atoi(tok);
+    return len;
+}
+
+/*
+ * Queue the 20 MHz channels for the scheduler, channels with a wide RSSI
+ * spread from earlier samples are worth revisiting first. In incremental
+ * mode only the stale and the requested channels are queued.
+ */
+static void schedule_channels(struct scan_scheduler *sched, bool incremental, uint32_t max_age,
+                              const uint8_t *rescan, uint8_t rescan_len)
+{
+    struct rssi_sketch *sk;
+    double spread;
+    uint32_t age;
+    uint8_t i, channel;
+
+    for (i = 0; i < pinfo->channels_in_bw; i++) {
+        channel = pinfo->chan_list[i].channel;
+        age = ubnt_get_channel_age(channel);
+        if (incremental && age != UINT32_MAX && age <= max_age &&
+            !channel_listed(channel, rescan, rescan_len)) {
+            debug(MODULE, "ch: %d is fresh (%u sec), kept\n", channel, age);
+            continue;
         }
-#ifdef SET_WIFI_SPECTR_SUPPORT // "IcapMode" option changing in platdep_funcs.sh
-        /* set Wifi-spectrum mode */
-        nvram_set(radio_if_name, "IcapMode", "2");
-        ret = interface_reload(radio_if_name);
-        info(MODULE, "Set WifiScan mode\n");
-        sleep(3); // waiting 3 sec to change the driver mode
-#endif // SET_WIFI_SPECTR_SUPPORT
+        spread = 0;
+        sk = ubnt_get_channel_sketch(channel, BW_20);
+        if (sk && sk->total)
+            spread = rssi_sketch_quantile(sk, 90) - rssi_sketch_quantile(sk, 10);
+        sched_add(sched, i, pinfo->chan_list[i].freq_center,
+                  (age == UINT32_MAX) ? SCHED_AGE_UNKNOWN : age, spread);
     }
-#endif // SPECTRAL_SCAN_SUPPORT
-    pinfo->radio_ifname = if_name;
+}
 
-    if (!strlen(if_name)) {
-        error(MODULE, "the interface name is not defined!\n");
-        exit(EXIT_FAILURE);
+/* define greater than one to increase preciseness */
+#define ATTEMPTS_OF_SAMPLES 3
+#define ATTEMPTS_4_UTILIZATION
+
+/* command line settings of a radio, shared by all its scans */
+struct scan_opts {
+    enum nl80211_band band_5g;
+    char radio_if_name[IFACE_MAX_LEN];
+    char if_name[IFACE_MAX_LEN];
+    uint32_t budget_sec;
+    uint32_t half_life;
+    uint32_t aged_at;                       /* uptime the statistics were last aged to */
+    bool incremental;
+    uint32_t max_age;
+    uint8_t rescan[64];
+    uint8_t rescan_len;
+    char *daemon_sock;
+    bool shm_enable;
+    bool bin_enable;
+    bool delta_enable;
+    struct shm_table *shm;
+    struct scan_profile prof;               /* of the last scan, see PROFILE_FILE_FMT */
+    bool background;                        /* processing at SCHED_IDLE, within budget */
+    struct cpu_budget budget;
+#ifdef SPECTRAL_SCAN_SUPPORT
+    int  node_f;
+    char node[2];
+    bool scan_flag;
+    bool occupancy_only;                    /* energy detector only, no FFT */
+    struct psd_cfg psd;
+    struct zoom_cfg zoom_cfg;
+    struct zoom_spectrum *zoom;             /* NULL - no zoom */
+    struct chain_set chains;                /* of several capture nodes */
+    uint32_t dwell_ms;                      /* ring capture streaming per channel, 0 - snapshots */
+    MTK_SPECTRUM_DATA *sd;
+    struct adaptive_sampler sampler;
+#endif //SPECTRAL_SCAN_SUPPORT
+    struct ubnt_radio *stats;
+    int ret;
+};
+
+static struct scan_opts radio_opts[MAX_RADIOS] = {
+    {
+        .band_5g = NL80211_BAND_5GHZ,
+        .radio_if_name = "rai0",  // default interface for MT7615
+        .if_name = "rai0",        // the interface name is used to create json output files
+#ifdef SPECTRAL_SCAN_SUPPORT
+        .node = "b",
+#endif //SPECTRAL_SCAN_SUPPORT
+    },
+};
+static __thread struct scan_opts *opts = &radio_opts[0];
+
+/*
+ * Warm start: weigh the statistics kept so far by 2^(-age/half_life),
+ * new captures are added on top of them.
+ */
+static void age_scan_data(void)
+{
+    uint32_t now = ubnt_uptime();
+    double weight;
+
+    /* saved before a reboot, or aged to the future */
+    if (now < opts->aged_at) {
+        ubnt_clear_scan_data();
+        opts->aged_at = now;
+        return;
     }
-    if (ubnt_populate_chan_list(radio_if_name, pinfo, band_5g)) {
-        error(MODULE, "ubnt_populate_chan_list() - failed!\n");
-        exit(EXIT_FAILURE);
+    weight = pow(0.5, (double)(now - opts->aged_at) / opts->half_life);
+    if (weight < WARM_MIN_WEIGHT)
+        ubnt_clear_scan_data();
+    else if (weight < 1)
+        ubnt_age_scan_data(weight);
+    info(MODULE, "warm start, previous statistics weighted %.3f\n", weight < WARM_MIN_WEIGHT ? 0 : weight);
+    opts->aged_at = now;
+}
+
+/*
+ * Write the binary table next to the JSON one, from the same snapshot.
+ * The previous binary table is the base of the delta and of the table id.
+ */
+static int write_spectrum_bin_table(const char *radio_ifname, struct channel_bw *best_channels)
+{
+    char fname[FILE_NAME_LEN];
+    struct snapshot_pub *pub = &ubnt_get_radio()->snap;
+    struct spectrum_snapshot *snap = snapshot_acquire(pub);
+    struct rftable_bin base;
+    bool have_base;
+    uint32_t table_id;
+    json_t *delta;
+    int ret;
+
+    snprintf(fname, sizeof(fname), RFTABLE_BIN_FILE_FMT, radio_ifname);
+    have_base = !rftable_bin_load(fname, &base);
+    table_id = have_base ? base.table_id + 1 : 1;
+    if (opts->delta_enable) {
+        delta = rftable_delta(have_base ? &base : NULL, &snap->usi, table_id, best_channels, NUM_SUGGESTED_CHANNELS);
+        snprintf(fname, sizeof(fname), RFTABLE_DELTA_FILE_FMT, radio_ifname);
+        rftable_delta_write(fname, delta);
+        json_decref(delta);
+        snprintf(fname, sizeof(fname), RFTABLE_BIN_FILE_FMT, radio_ifname);
     }
-    ubnt_init(pinfo->max_channels, pinfo->chan_list, band_5g);
+    if (have_base)
+        rftable_bin_free(&base);
+
+    ret = rftable_bin_write(fname, &snap->usi, opts->band_5g, best_channels, NUM_SUGGESTED_CHANNELS, table_id);
+#ifdef VERIFY_BINARY_TABLE
+    if (!ret)
+        ret = rftable_bin_verify(fname, &snap->usi, best_channels, NUM_SUGGESTED_CHANNELS);
+#endif //VERIFY_BINARY_TABLE
+    snapshot_release(pub, snap);
+
+    return ret;
+}
+
+#ifdef SPECTRAL_SCAN_SUPPORT
+/* the zoom spectrum of the scan, see zoom.h */
+static int write_zoom_json(const char *radio_ifname)
+{
+    char fname[FILE_NAME_LEN], ftemp[FILE_NAME_LEN];
+    json_t *json = zoom_json(opts->zoom);
+    int ret;
+
+    snprintf(fname, sizeof(fname), ZOOM_FILE_FMT, radio_ifname);
+    snprintf(ftemp, sizeof(ftemp), ZOOM_FILE_FMT ".temp", radio_ifname);
+    ret = json_dump_file(json, ftemp, JSON_COMPACT);
+    json_decref(json);
+    if (ret || rename(ftemp, fname)) {
+        error(MODULE, "failed to write %s\n", fname);
+        unlink(ftemp);
+        return -1;
+    }
+    if (!opts->zoom->segments)
+        warn(MODULE, "no scanned channel holds the zoom sub-band\n");
+    return 0;
+}
+
+/* the RSSI of every capture node per channel, see chains.h */
+static int write_chains_json(const char *radio_ifname)
+{
+    char fname[FILE_NAME_LEN], ftemp[FILE_NAME_LEN];
+    json_t *json = chains_json(&opts->chains, pinfo->chan_list);
+    int ret;
+
+    snprintf(fname, sizeof(fname), CHAINS_FILE_FMT, radio_ifname);
+    snprintf(ftemp, sizeof(ftemp), CHAINS_FILE_FMT ".temp", radio_ifname);
+    ret = json_dump_file(json, ftemp, JSON_COMPACT);
+    json_decref(json);
+    if (ret || rename(ftemp, fname)) {
+        error(MODULE, "failed to write %s\n", fname);
+        unlink(ftemp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Whether the channel has had enough captures. The energy detector alone
+ * leaves no histograms to converge, it takes the minimum number.
+ */
+static bool capture_done(uint16_t channel)
+{
+    if (opts->occupancy_only)
+        return ++opts->sampler.captures >= opts->sampler.min_captures;
+    return sampler_converged(&opts->sampler, channel);
+}
+#endif // SPECTRAL_SCAN_SUPPORT
+
+/*
+ * Function     : run_scan
+ * Description  : visit the scheduled channels and publish the table, the
+ *                caller marks the scan done (mark_spectrum_scan_done())
+ * Input params : incremental - rescan only stale/listed channels, keep the rest
+ *                max_age, rescan, rescan_len - incremental selection
+ * Return       : status
+ *
+ */
+static int run_scan(bool incremental, uint32_t max_age, const uint8_t *rescan, uint8_t rescan_len)
+{
+    enum nl80211_band band_5g = opts->band_5g;
+    char *radio_if_name = opts->radio_if_name;
+    char *if_name = opts->if_name;
+    struct ubnt_spectral_info *p_usi = get_usi_p();
+    struct scan_scheduler sched;
+    struct channel_bw best_channels[NUM_SUGGESTED_CHANNELS];
+    char profile_file[FILE_NAME_LEN];
+    uint64_t t, t_channel;
+    int attempt, next;
+    int ret = 0;
+#ifndef IF_INFO_4EACH_SAMP
+    struct ath_info iface_info;
+    uint8_t tmp_cu;
+#endif //IF_INFO_4EACH_SAMP
+#ifdef SPECTRAL_SCAN_SUPPORT
+    /* the energy detector alone and the streaming take the first node */
+    struct chain_set *chains = (opts->chains.count && !opts->occupancy_only && !opts->dwell_ms) ?
+                               &opts->chains : NULL;
+#endif // SPECTRAL_SCAN_SUPPORT
+
+    prof_reset(&opts->prof);
+    cpu_budget_reset(&opts->budget);
+#ifdef SPECTRAL_SCAN_SUPPORT
+    if (opts->zoom)
+        zoom_reset(opts->zoom);
+    if (chains)
+        chains_reset(chains);
+#endif // SPECTRAL_SCAN_SUPPORT
+    if (opts->half_life)
+        age_scan_data();
+    else if (!incremental)
+        ubnt_clear_scan_data();
 
     cleanup_files(if_name);
     start_spectrum_table(if_name);
+    sched_init(&sched, opts->budget_sec);
+    schedule_channels(&sched, incremental, max_age, rescan, rescan_len);
+    shm_table_set_state(opts->shm, SHM_SCAN_RUNNING, 0, sched.count);
 
-    for (pinfo->channel_index = 0; pinfo->channel_index < pinfo->channels_in_bw; pinfo->channel_index++) {
+    while ((next = sched_next(&sched)) >= 0) {
+        pinfo->channel_index = next;
+        t_channel = prof_now();
+        /* warm, the channel accumulates on top of its aged statistics */
+        if (incremental && !opts->half_life)
+            ubnt_reset_channel(pinfo->chan_list[pinfo->channel_index].channel);
+        t = prof_now();
         ret = set_channel(radio_if_name, pinfo->chan_list[pinfo->channel_index].channel);
+        prof_record(&opts->prof, PROF_SET_CHANNEL, t);
         if (ret < 0) {
             error(MODULE, "Error: set_channel idx:%d, ret=%d\n", pinfo->channel_index, ret);
         } else {
+            t = prof_now();
             sleep(2); // waiting 2 sec to set channel
+            prof_record(&opts->prof, PROF_SETTLE, t);
             info(MODULE, "OK: set_channel:%d, ret=%d\n", pinfo->chan_list[pinfo->channel_index].channel, ret);
-#ifndef IF_INFO_4EACH_SAMP
-            ch_gr40_cnt++;
-            ch_gr80_cnt++;
-            ch_gr160_cnt++;
-#endif // !IF_INFO_4EACH_SAMP
         }
 
 #ifndef ATTEMPTS_4_UTILIZATION
         for (attempt = 0; attempt < ATTEMPTS_OF_SAMPLES; attempt++) {
 #endif // !ATTEMPTS_4_UTILIZATION
 #ifdef SPECTRAL_SCAN_SUPPORT
-            if(scan_flag) {
-                if(!(ret = set_wifi_spectrum_param(radio_if_name, pinfo, node, node_f))) {
-                    uint8_t current_channel = get_current_channel(radio_if_name);
-                    info(MODULE, "get_current_channel:%d\n", current_channel);
-                    if(pinfo->chan_list[pinfo->channel_index].channel != current_channel) {
-                        error(MODULE, "Error: set_channel idx:%d -> ch:%d\n", pinfo->channel_index, current_channel);
-                        continue;
-                    } else {
-                        pinfo->current_channel = pinfo->chan_list[pinfo->channel_index].channel;
-                        pinfo->pssd->ch_width = pinfo->current_bw = pinfo->chan_list[pinfo->channel_index].bw;
-                        info(MODULE, "OK - current_channel:%d\n", current_channel);
-                    }
-                } else {
-                    error(MODULE, "fail: set_wifi_spectrum_param, ret:%d\n", ret);
-                }
-
-                fill_scan_data_from_file(sd);
-                // TODO: scan only in BW: 20MHz; other settings does not work...
-                process_spectrum_data(sd, pinfo, 0 /*p_usi->table[pinfo->channel_index].chan_width*/, 
-                                    ieee80211_channel_to_frequency(pinfo->current_channel, band_5g));
+            if(opts->scan_flag && opts->dwell_ms) {
+                if (stream_spectrum(radio_if_name, opts->node, opts->node_f, opts->sd, band_5g,
+                                    opts->occupancy_only, opts->zoom, opts->dwell_ms, &sched) <= 0)
+                    continue;
+            }
+            else if(opts->scan_flag) {
+                /* keep capturing until the channel statistics converge */
+                sampler_start_channel(&opts->sampler);
+                while (!(ret = capture_spectrum(radio_if_name, opts->node, opts->node_f, opts->sd, band_5g,
+                                                opts->occupancy_only, opts->zoom, chains)) &&
+                       !capture_done(pinfo->current_channel) &&
+                       !sched_expired(&sched))
+                    ;
+                if (ret < 0 && !opts->sampler.captures)
+                    continue;
+                info(MODULE, "Ch: %d; captures: %d\n", pinfo->current_channel, opts->sampler.captures);
             }
             else
 #endif // SPECTRAL_SCAN_SUPPORT
@@ -349,99 +859,526 @@ int main(int argc, char *argv[])
 #ifdef ATTEMPTS_4_UTILIZATION
         for (attempt = 0; attempt < ATTEMPTS_OF_SAMPLES; attempt++) {
 #endif // ATTEMPTS_4_UTILIZATION
+            t = prof_now();
             get_athstat(radio_if_name, &iface_info);
+            prof_record(&opts->prof, PROF_UTILIZATION, t);
             info(MODULE, "Ch: %d; utilization: %d\n", pinfo->current_channel, iface_info.ath_11n_info.cu_total);
 #ifdef UTILIZATION_AVERAGE
             p_usi->table[pinfo->channel_index].utilization += iface_info.ath_11n_info.cu_total;
 #else
             tmp_cu = MAX(p_usi->table[pinfo->channel_index].utilization, iface_info.ath_11n_info.cu_total);
+            // bonded channels are derived from the spectrum index after the scan
             ubnt_set_channel_utilization(pinfo->current_channel, BW_20, tmp_cu);
-            // duplicate utilization for all bandwidth
-            if(band_5g) {
-                if (ch_gr40_cnt == 2) {
-                    debug(MODULE, "Ch (BW_40) idx: %d; utilization: %d\n", (pinfo->channel_index-i), tmp_cu);
-                    for (i = 0; i < 2; i++)
-                        tmp_cu = MAX(p_usi->table[pinfo->channel_index-i].utilization, tmp_cu);
-                    for (i = 0; i < 2; i++)
-                        ubnt_set_channel_utilization(p_usi->table[pinfo->channel_index-i].channel, BW_40, tmp_cu);
-                    ch_gr40_cnt = 0;
-                }
-                if (ch_gr80_cnt == 4) {
-                    debug(MODULE, "Ch (BW_80) idx: %d; utilization: %d\n", (pinfo->channel_index-i), tmp_cu);
-                    for (i = 0; i < 4; i++)
-                        tmp_cu = MAX(p_usi->table[pinfo->channel_index-i].utilization, tmp_cu);
-                    for (i = 0; i < 4; i++)
-                        ubnt_set_channel_utilization(p_usi->table[pinfo->channel_index-i].channel, BW_80, tmp_cu);
-                    ch_gr80_cnt = 0;
-                }
-                if (ch_gr160_cnt == 8) {
-                    debug(MODULE, "Ch (BW_160) idx: %d; utilization: %d\n", (pinfo->channel_index-i), tmp_cu);
-                    for (i = 0; i < 8; i++)
-                        tmp_cu = MAX(p_usi->table[pinfo->channel_index-i].utilization, tmp_cu);
-                    for (i = 0; i < 8; i++)
-                        ubnt_set_channel_utilization(p_usi->table[pinfo->channel_index-i].channel, BW_160, tmp_cu);
-                    ch_gr160_cnt = 0;
-                }
-            } else { // 2G
-                ubnt_set_channel_utilization(pinfo->current_channel, BW_40, tmp_cu);
-            }
 #endif // !UTILIZATION_AVERAGE
 #ifdef ATTEMPTS_4_UTILIZATION
         }
 #endif // ATTEMPTS_4_UTILIZATION
 #endif // !IF_INFO_4EACH_SAMP
-            for (sample_idx = 0; sample_idx < pinfo->window_num; sample_idx++) {
-                pinfo->pssd[sample_idx].ch_width = BW_20;
-                ubnt_process_spectral_data(pinfo, sample_idx);
-                pinfo->pssd[sample_idx].ch_width = BW_40;
-                ubnt_process_spectral_data(pinfo, sample_idx);
-                if(band_5g) {
-                    pinfo->pssd[sample_idx].ch_width = BW_80;
-                    ubnt_process_spectral_data(pinfo, sample_idx);
-                    pinfo->pssd[sample_idx].ch_width = BW_160;
-                    ubnt_process_spectral_data(pinfo, sample_idx);
-                }
-            }
 #ifndef ATTEMPTS_4_UTILIZATION
         }
 #endif // !ATTEMPTS_4_UTILIZATION
 #ifndef IF_INFO_4EACH_SAMP
  #ifdef UTILIZATION_AVERAGE
         p_usi->table[pinfo->channel_index].utilization /= attempt;
-        // duplicate utilization for all bandwidth
-        ubnt_set_channel_utilization(pinfo->current_channel, BW_40, p_usi->table[pinfo->channel_index].utilization);
-        if(band_5g) {
-            ubnt_set_channel_utilization(pinfo->current_channel, BW_80, p_usi->table[pinfo->channel_index].utilization);
-            ubnt_set_channel_utilization(pinfo->current_channel, BW_160, p_usi->table[pinfo->channel_index].utilization);
-        }
+        ubnt_set_channel_utilization(pinfo->current_channel, BW_20, p_usi->table[pinfo->channel_index].utilization);
  #endif // UTILIZATION_AVERAGE
 #endif // !IF_INFO_4EACH_SAMP
         ubnt_process_channel_data(pinfo->current_channel, BW_20);
-        ubnt_process_channel_data(pinfo->current_channel, BW_40);
-        if(band_5g) {
-            ubnt_process_channel_data(pinfo->current_channel, BW_80);
-            ubnt_process_channel_data(pinfo->current_channel, BW_160);
-        }
+        ubnt_mark_channel_scanned(pinfo->current_channel);
+        sched_complete(&sched);
+        /* let the readers see the channel, skipped while they hold the spare copy */
+        ubnt_publish_snapshot(true, false);
+        shm_table_update(opts->shm, p_usi, ubnt_get_radio()->chan_scanned, NULL, 0);
+        shm_table_set_state(opts->shm, SHM_SCAN_RUNNING, sched.visited, sched.count);
+        prof_record(&opts->prof, PROF_CHANNEL, t_channel);
+    }
+    ubnt_process_bonded_channels(band_5g);
+    ubnt_publish_snapshot(false, true);
+    if (pinfo->budget) {
+        prof_count(&opts->prof, PROF_PROCESS_CPU_US, opts->budget.cpu_ns / 1000);
+        prof_count(&opts->prof, PROF_PROCESS_WALL_US, opts->budget.wall_ns / 1000);
+        prof_count(&opts->prof, PROF_THROTTLED_US, opts->budget.throttled_ns / 1000);
+        info(MODULE, "processing used %.1f%% of a core (limit %.0f%%), throttled %llu ms\n",
+             100 * cpu_budget_achieved(&opts->budget), 100 * opts->budget.share,
+             (unsigned long long)(opts->budget.throttled_ns / 1000000));
     }
+    /* the budget may run out on the last channel, the scan is complete then */
+    if (sched.visited < sched.count) {
+        warn(MODULE, "scan budget of %u sec exhausted after %u/%u channels (%u ms)\n",
+             opts->budget_sec, sched.visited, sched.count, sched_elapsed_ms(&sched));
+        mark_spectrum_scan_partial(if_name, sched.visited, sched.count);
+    }
+
+    t = prof_now();
+    write_spectrum_json_table(if_name, best_channels);
+    if (opts->bin_enable)
+        write_spectrum_bin_table(if_name, best_channels);
+#ifdef SPECTRAL_SCAN_SUPPORT
+    if (opts->zoom)
+        write_zoom_json(if_name);
+    if (chains)
+        write_chains_json(if_name);
+#endif // SPECTRAL_SCAN_SUPPORT
+    shm_table_update(opts->shm, p_usi, ubnt_get_radio()->chan_scanned, best_channels, NUM_SUGGESTED_CHANNELS);
+    shm_table_set_state(opts->shm, sched.visited < sched.count ? SHM_SCAN_PARTIAL : SHM_SCAN_DONE, sched.visited, sched.count);
+
+    state_save(if_name, band_5g);
+    prof_record(&opts->prof, PROF_OUTPUT, t);
 
-    write_spectrum_json_table(if_name);
+    snprintf(profile_file, sizeof(profile_file), PROFILE_FILE_FMT, if_name);
+    if (prof_write(&opts->prof, profile_file))
+        warn(MODULE, "cannot write %s\n", profile_file);
 
+    return sched.visited;
+}
+
+/* daemon callbacks */
+static int daemon_scan(const uint8_t *channels, uint8_t count, uint32_t max_age, bool incremental)
+{
+    int ret;
+
+    /* the radio is in ICAP mode for the scan only, it serves clients in between */
 #ifdef SPECTRAL_SCAN_SUPPORT
-    /* restore Normal mode */
-    if(scan_flag) {
-        ret = nvram_set(radio_if_name, "IcapMode", "0");
-        // ret = interface_reload(radio_if_name);
-        // there is no need to apply (in case softrestart applies)
-        info(MODULE, "Restore Normal mode\n");
+    if (opts->scan_flag)
+        icap_mode_enter(opts->radio_if_name);
+#endif // SPECTRAL_SCAN_SUPPORT
+    ret = run_scan(incremental, max_age, channels, count);
+#ifdef SPECTRAL_SCAN_SUPPORT
+    if (opts->scan_flag)
+        icap_mode_leave(opts->radio_if_name);
+#endif // SPECTRAL_SCAN_SUPPORT
+    mark_spectrum_scan_done(opts->if_name);
+    timestamp_spectrum_table(opts->if_name);
+    return ret;
+}
+
+/* the radio served by the daemon, queried from the client threads */
+static struct ubnt_radio *daemon_radio;
+static struct scan_opts *daemon_opts;
+
+static json_t *daemon_table(void)
+{
+    struct channel_bw best_channels[NUM_SUGGESTED_CHANNELS];
+    struct spectrum_snapshot *snap = snapshot_acquire(&daemon_radio->snap);
+    json_t *reply = prepare_spectrum_json(snap, daemon_opts->if_name, best_channels);
+
+    json_object_set_new(reply, "version", json_integer(snap->version));
+    json_object_set_new(reply, "published", json_integer(snap->published));
+    json_object_set_new(reply, "scanning", snap->scanning ? json_true() : json_false());
+    snapshot_release(&daemon_radio->snap, snap);
+
+    return reply;
+}
+
+static json_t *daemon_best(int num_best_channels)
+{
+    struct channel_bw best_channels[MAX_NUM_CHANNELS];
+    struct spectrum_snapshot *snap = snapshot_acquire(&daemon_radio->snap);
+
+    num_best_channels = MIN(MAX(num_best_channels, 1), MAX_NUM_CHANNELS);
+    get_best_channels(&snap->usi, daemon_opts->if_name, best_channels, num_best_channels);
+    snapshot_release(&daemon_radio->snap, snap);
+
+    return prepare_suggested_channels(best_channels, num_best_channels);
+}
+
+static const struct daemon_ops rf_daemon_ops = {
+    .scan = daemon_scan,
+    .table = daemon_table,
+    .best = daemon_best,
+};
+
+
+/*
+ * Function     : radio_main
+ * Description  : set up a radio, scan it (or serve it in daemon mode)
+ *                and restore it, in the calling thread
+ * Input params : idx - radio index
+ * Return       : status
+ *
+ */
+static int radio_main(int idx)
+{
+    enum nl80211_band band_5g;
+    char *radio_if_name, *if_name;
+    bool ready = false;
+    int  ret = 0;
+#ifdef SPECTRAL_SCAN_SUPPORT
+    SPECTRAL_SAMP_DATA *ssd;
+#endif //SPECTRAL_SCAN_SUPPORT
+
+    opts = &radio_opts[idx];
+    pinfo = &mtk_ssdinfo[idx];
+    ubnt_select_radio(opts->stats);
+    band_5g = opts->band_5g;
+    radio_if_name = opts->radio_if_name;
+    if_name = opts->if_name;
+
+#ifdef SPECTRAL_SCAN_SUPPORT
+    opts->sd = (MTK_SPECTRUM_DATA *)malloc(MTK_SPECTRUM_DATA_LEN * sizeof(MTK_SPECTRUM_DATA));
+    ssd = (SPECTRAL_SAMP_DATA *)malloc(SPECTRAL_SAMP_DATA_LEN * sizeof(SPECTRAL_SAMP_DATA));
+    opts->zoom = opts->zoom_cfg.span_khz ? calloc(1, sizeof(*opts->zoom)) : NULL;
+    if (!opts->sd || !ssd || (opts->zoom_cfg.span_khz && !opts->zoom)) {
+        error(MODULE, "UOH, not enough memory!!!");
+        free(opts->sd);
+        free(ssd);
+        free(opts->zoom);
+        return -1;
+    }
+    if (opts->zoom)
+        opts->zoom->cfg = opts->zoom_cfg;
+    pinfo->pssd = ssd;
+    pinfo->prof = &opts->prof;
+    pinfo->psd = opts->psd;
+    if (opts->background) {
+        cpu_budget_idle();
+        pinfo->budget = &opts->budget;
     }
+
+    if(opts->scan_flag) {
+        if (band_5g) {
+            ret = nvram_set(radio_if_name, "WirelessMode", "14"); // 11A/AN/AC mixed 5G band only            
+        } else {
+            ret = nvram_set(radio_if_name, "WirelessMode", "9"); // 11bgn mixed
+        }
+        /* the daemon switches the mode around each of its scans */
+        if (!opts->daemon_sock)
+            icap_mode_enter(radio_if_name);
+    }
+#endif // SPECTRAL_SCAN_SUPPORT
+    pinfo->radio_ifname = if_name;
+
+    /* on a thread of its own, a setup failure ends this radio only */
+    if (!strlen(if_name)) {
+        error(MODULE, "the interface name is not defined!\n");
+        goto restore;
+    }
+    if (ubnt_populate_chan_list(radio_if_name, pinfo, band_5g)) {
+        error(MODULE, "ubnt_populate_chan_list() - failed!\n");
+        goto restore;
+    }
+    ubnt_init(pinfo->max_channels, pinfo->chan_list, band_5g);
+#ifdef SPECTRAL_SCAN_SUPPORT
+    if (opts->chains.count && chains_init(&opts->chains, pinfo->max_channels, opts->sd)) {
+        error(MODULE, "UOH, not enough memory!!!");
+        ubnt_cleanup(pinfo);
+        goto restore;
+    }
+#endif // SPECTRAL_SCAN_SUPPORT
+    ready = true;
+    opts->aged_at = ubnt_uptime();
+    if ((opts->incremental || opts->half_life) && state_load(if_name, band_5g, &opts->aged_at)) {
+        info(MODULE, "no usable previous scan, full scan\n");
+        opts->incremental = false;
+    }
+    ubnt_publish_snapshot(false, true);
+    if (opts->shm_enable && (opts->shm = shm_table_create(if_name, get_usi_p(), band_5g)))
+        shm_table_update(opts->shm, get_usi_p(), ubnt_get_radio()->chan_scanned, NULL, 0);
+
+    if (opts->daemon_sock) {
+        /* usi and the radio setup stay resident, scans are run on request */
+        daemon_radio = ubnt_get_radio();
+        daemon_opts = opts;
+        ret = daemon_run(opts->daemon_sock, &rf_daemon_ops);
+    } else {
+        run_scan(opts->incremental, opts->max_age, opts->rescan, opts->rescan_len);
+    }
+
+restore:
+#ifdef SPECTRAL_SCAN_SUPPORT
+    if(opts->scan_flag && !opts->daemon_sock)
+        ret = icap_mode_leave(radio_if_name);
+    chains_free(&opts->chains);
+    free(opts->sd);
+    free(ssd);
+    free(opts->zoom);
+    opts->zoom = NULL;
 #endif // SPECTRAL_SCAN_SUPPORT
 
-    mark_spectrum_scan_done(if_name);
-    timestamp_spectrum_table(if_name);
+    if (!ready)
+        return -1;
+
+    /* done once the radio is back in normal mode */
+    if (!opts->daemon_sock) {
+        mark_spectrum_scan_done(if_name);
+        timestamp_spectrum_table(if_name);
+    }
 
+    shm_table_close(opts->shm);
+    opts->shm = NULL;
     ubnt_cleanup(pinfo);
 
     info(MODULE, "END SCAN - %s\n", (band_5g) ? "5G" : "2G");
 
     return ret;
 }
+
+static void *radio_thread(void *arg)
+{
+    int idx = (int)(intptr_t)arg;
+
+    radio_opts[idx].ret = radio_main(idx);
+    return NULL;
+}
+
+/* processing workers a radio keeps busy, one per capture node */
+static int radio_workers(int idx)
+{
+#ifdef SPECTRAL_SCAN_SUPPORT
+    return MAX(radio_opts[idx].chains.count, 1);
+#else
+    return 1;
+#endif // SPECTRAL_SCAN_SUPPORT
+}
+
+/*
+ * Scan both radios, each from its own control thread, sharing one
+ * processing pool. Only the ICAP capture itself is serialized.
+ */
+static int dual_radio_main(void)
+{
+    static struct ubnt_radio second_radio;
+    pthread_t threads[MAX_RADIOS];
+    pthread_attr_t attr;
+    int i, started = 0, ret = 0;
+
+    radio_opts[1].stats = &second_radio;
+    proc_pool_start(MIN(get_nprocs(), MAX_RADIOS * radio_workers(0)), radio_opts[0].background);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PROC_THREAD_STACK_SIZE);
+    for (i = 0; i < MAX_RADIOS; i++) {
+        if (pthread_create(&threads[i], &attr, radio_thread, (void *)(intptr_t)i)) {
+            error(MODULE, "failed to start the %s thread\n", radio_opts[i].radio_if_name);
+            radio_opts[i].ret = -1;
+            break;
+        }
+        started++;
+    }
+    pthread_attr_destroy(&attr);
+
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    proc_pool_stop();
+
+    for (i = 0; i < MAX_RADIOS; i++) {
+        if (radio_opts[i].ret)
+            ret = radio_opts[i].ret;
+    }
+    return ret;
+}
+
+/*
+ * Function     : main
+ * Description  : entry point
+ * Input params : argc, argv
+ * Return       : status
+ *
+ */
+int main(int argc, char *argv[])
+{
+    int c;
+    // int  bw = -1;
+    char *radio_if_name = opts->radio_if_name;
+    char *if_name = opts->if_name;
+    char *second = NULL, *sep;
+    char *offline_src = NULL, *offline_out = ".";
+    bool offline_merged = false;
+    int offline_jobs = 0;
+    double share;
+    char *end;
+#ifdef SPECTRAL_SCAN_SUPPORT
+    uint8_t max_captures = 1;
+    long captures;
+    unsigned long dwell_ms;
+    double ci_db = 0;
+#endif //SPECTRAL_SCAN_SUPPORT
+
+    int  ret = 0;
+
+    while ((c = getopt (argc, argv, "hHi:r:b:B:n:m:w:Sa:e:EP:R:z:L:t:U:I:C:W:D:MKZX:O:o:Gj:vd")) != -1) {
+        switch (c) {
+            case 'h':
+            case 'H':
+                print_usage(argv[0]);
+                return ret;
+            case 'i':
+                snprintf(if_name, IFACE_MAX_LEN, "%s", optarg);
+                break;
+            case 'r':
+                snprintf(radio_if_name, IFACE_MAX_LEN, "%s", optarg);
+                break;
+            // case 'b':
+            //     bw = atoi(optarg);
+            //     break;
+            case 'B':
+                opts->band_5g = !!(atoi(optarg)); // default 1 --> 5G
+                break;
+#ifdef SPECTRAL_SCAN_SUPPORT
+            case 'n':
+                if (chains_parse(&opts->chains, optarg)) {
+                    error(MODULE, "bad capture nodes '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                memcpy(opts->node, opts->chains.chain[0].node, strlen(opts->node));
+                break;
+            case 'm':
+                if (chains_parse_combine(&opts->chains, optarg)) {
+                    error(MODULE, "bad combining '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                opts->node_f = atoi(optarg);
+                break;
+            case 'S':
+                opts->scan_flag = true;
+                break;
+            case 'a':
+                captures = strtol(optarg, &end, 10);
+                if (end == optarg || *end || captures < 1 || captures > UINT8_MAX) {
+                    error(MODULE, "bad max captures '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                max_captures = captures;
+                break;
+            case 'e':
+                ci_db = strtod(optarg, &end);
+                if (end == optarg || *end || !(ci_db > 0 && ci_db <= SAMPLER_MAX_CI_DB)) {
+                    error(MODULE, "bad confidence interval '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'E':
+                opts->occupancy_only = true;
+                break;
+            case 'P':
+                if (psd_parse(&opts->psd, optarg)) {
+                    error(MODULE, "bad spectral estimator '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'R':
+                if (psd_set_dft_size(&opts->psd, atoi(optarg))) {
+                    error(MODULE, "bad DFT size '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'z':
+                if (zoom_parse(&opts->zoom_cfg, optarg)) {
+                    error(MODULE, "bad zoom sub-band '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'L':
+                dwell_ms = strtoul(optarg, &end, 10);
+                if (end == optarg || *end || optarg[0] == '-' || dwell_ms > ICAP_RING_MAX_DWELL_MS) {
+                    error(MODULE, "bad dwell '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                opts->dwell_ms = dwell_ms;
+                break;
+#endif //SPECTRAL_SCAN_SUPPORT
+            case 'W':
+                opts->half_life = atoi(optarg);
+                break;
+            case 't':
+                opts->budget_sec = atoi(optarg);
+                break;
+            case 'U':
+                share = strtod(optarg, &end);
+                if (end == optarg || *end || !(share > 0 && share <= 100)) {
+                    error(MODULE, "bad processing share '%s'\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                opts->background = true;
+                cpu_budget_init(&opts->budget, share / 100);
+                break;
+            case 'I':
+                opts->incremental = true;
+                opts->max_age = atoi(optarg);
+                break;
+            case 'C':
+                /* without -I the kept channels do not age out */
+                if (!opts->incremental)
+                    opts->max_age = UINT32_MAX;
+                opts->incremental = true;
+                opts->rescan_len = parse_channel_list(optarg, opts->rescan, ARRAY_SIZE(opts->rescan));
+                break;
+            case 'D':
+                opts->daemon_sock = optarg;
+                break;
+            case 'M':
+                opts->shm_enable = true;
+                break;
+            case 'K':
+                opts->bin_enable = true;
+                break;
+            case 'Z':
+                opts->bin_enable = true;
+                opts->delta_enable = true;
+                break;
+            case 'X':
+                second = optarg;
+                break;
+            case 'O':
+                offline_src = optarg;
+                break;
+            case 'o':
+                offline_out = optarg;
+                break;
+            case 'G':
+                offline_merged = true;
+                break;
+            case 'j':
+                offline_jobs = atoi(optarg);
+                break;
+            case 'v':
+                libubnt_log_level = (libubnt_log_level << 1);
+                break;
+            case 'd':
+                libubnt_log_use_syslog = 0;
+                break;
+            default:
+                print_usage(argv[0]);
+                abort();
+        }
+
+#ifdef ONLY_5G_SUPPORT
+        if (!opts->band_5g) {
+            warn(MODULE, "5G - supported only\n");
+            return -1;
+        }
+#endif
+    }
+#ifdef SPECTRAL_SCAN_SUPPORT
+    sampler_init(&opts->sampler, max_captures, ci_db);
+#endif // SPECTRAL_SCAN_SUPPORT
+
+    if (offline_src)
+        return offline_main(offline_src, offline_out, offline_merged, offline_jobs, &opts->psd) ? EXIT_FAILURE : 0;
+
+    if (!second) {
+        if (radio_workers(0) == 1)
+            return radio_main(0);
+        /* the chains of the radio are processed in parallel */
+        proc_pool_start(MIN(get_nprocs(), radio_workers(0)), opts->background);
+        ret = radio_main(0);
+        proc_pool_stop();
+        return ret;
+    }
+
+    if (opts->daemon_sock) {
+        error(MODULE, "daemon mode serves a single radio\n");
+        exit(EXIT_FAILURE);
+    }
+    /* the second radio scans the other band with the same settings */
+    radio_opts[1] = radio_opts[0];
+    radio_opts[1].band_5g = !radio_opts[0].band_5g;
+    if ((sep = strchr(second, ':')))
+        *sep++ = '\0';
+    snprintf(radio_opts[1].radio_if_name, IFACE_MAX_LEN, "%s", second);
+    snprintf(radio_opts[1].if_name, IFACE_MAX_LEN, "%s", sep ? sep : second);
+
+    return dual_radio_main();
+}
@@ -0,0 +1,383 @@
+/*
+ * Ubiquiti RF Environment tool - compact binary table
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "ubnt.h"
+#include "rftable_bin.h"
+
+struct bin_buf {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    int err;
+};
+
+struct bin_cursor {
+    const uint8_t *p;
+    const uint8_t *end;
+    int err;
+};
+
+static void bin_put(struct bin_buf *b, const void *data, size_t len)
+{
+    uint8_t *p;
+
+    if (b->err)
+        return;
+    if (b->len + len > b->cap) {
+        size_t cap = MAX(b->cap * 2, b->len + len + 4096);
+
+        if (!(p = realloc(b->data, cap))) {
+            b->err = ENOMEM;
+            return;
+        }
+        b->data = p;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void bin_put_u8(struct bin_buf *b, uint8_t v)
+{
+    bin_put(b, &v, 1);
+}
+
+static void bin_put_u16(struct bin_buf *b, uint16_t v)
+{
+    uint8_t le[2] = { v, v >> 8 };
+
+    bin_put(b, le, sizeof(le));
+}
+
+static void bin_put_u32(struct bin_buf *b, uint32_t v)
+{
+    uint8_t le[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+    bin_put(b, le, sizeof(le));
+}
+
+static void bin_put_varint(struct bin_buf *b, uint32_t v)
+{
+    uint8_t out[5];
+    int n = 0;
+
+    while (v >= 0x80) {
+        out[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = v;
+    bin_put(b, out, n);
+}
+
+static void bin_put_histogram(struct bin_buf *b, const uint32_t *hist)
+{
+    int i, prev = -1, nonzero = 0;
+
+    for (i = 0; i < UBNT_RSSI_HISTOGRAM_SIZE; i++)
+        nonzero += !!hist[i];
+    bin_put_varint(b, nonzero);
+    for (i = 0; i < UBNT_RSSI_HISTOGRAM_SIZE; i++) {
+        if (!hist[i])
+            continue;
+        bin_put_varint(b, i - prev - 1);
+        bin_put_varint(b, hist[i]);
+        prev = i;
+    }
+}
+
+static uint8_t bin_get_u8(struct bin_cursor *c)
+{
+    if (c->err || c->p + 1 > c->end) {
+        c->err = 1;
+        return 0;
+    }
+    return *c->p++;
+}
+
+static uint16_t bin_get_u16(struct bin_cursor *c)
+{
+    uint16_t v = bin_get_u8(c);
+
+    return v | (bin_get_u8(c) << 8);
+}
+
+static uint32_t bin_get_u32(struct bin_cursor *c)
+{
+    uint32_t v = bin_get_u16(c);
+
+    return v | ((uint32_t)bin_get_u16(c) << 16);
+}
+
+static uint32_t bin_get_varint(struct bin_cursor *c)
+{
+    uint32_t v = 0;
+    uint8_t byte;
+    int shift;
+
+    for (shift = 0; shift < 35; shift += 7) {
+        byte = bin_get_u8(c);
+        v |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return v;
+    }
+    c->err = 1;
+    return 0;
+}
+
+static void bin_get_histogram(struct bin_cursor *c, uint32_t *hist)
+{
+    uint32_t nonzero = bin_get_varint(c);
+    int bin = -1;
+
+    memset(hist, 0, UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t));
+    while (nonzero-- && !c->err) {
+        bin += bin_get_varint(c) + 1;
+        if (bin < 0 || bin >= UBNT_RSSI_HISTOGRAM_SIZE) {
+            c->err = 1;
+            return;
+        }
+        hist[bin] = bin_get_varint(c);
+    }
+}
+
+/*
+ * Encode usi and the suggested channels into path (through a temporary
+ * file, like the JSON table).
+ */
+int rftable_bin_write(const char *path, const struct ubnt_spectral_info *usi, bool band_5g,
+                      const struct channel_bw *suggested, int suggested_count, uint32_t table_id)
+{
+    struct bin_buf b = { 0 };
+    char tmp[FILE_NAME_LEN + 8];
+    size_t written;
+    FILE *fp;
+    int i;
+
+    suggested_count = MIN(suggested_count, RFTABLE_BIN_SUGGESTED);
+
+    bin_put_u32(&b, RFTABLE_BIN_MAGIC);
+    bin_put_u16(&b, RFTABLE_BIN_VERSION);
+    bin_put_u16(&b, RFTABLE_BIN_HEADER_SIZE);
+    bin_put_u8(&b, band_5g);
+    bin_put_u8(&b, suggested_count);
+    bin_put_u16(&b, usi->count);
+    bin_put_u16(&b, usi->width);
+    bin_put_u16(&b, UBNT_RSSI_HISTOGRAM_SIZE);
+    bin_put_u16(&b, band_5g ? UBNT_RSSI_SPECTRUM_START_5G : UBNT_RSSI_SPECTRUM_START_2G);
+    bin_put_u32(&b, ubnt_uptime());
+    bin_put_u32(&b, usi->num_processed);
+    bin_put_u32(&b, table_id);
+
+    for (i = 0; i < suggested_count; i++) {
+        bin_put_u16(&b, suggested[i].channel);
+        bin_put_u8(&b, suggested[i].bw);
+        bin_put_u8(&b, 0);
+    }
+    for (i = 0; i < usi->count; i++) {
+        const struct ubnt_spectral_stats *uss = &usi->table[i];
+
+        bin_put_u16(&b, uss->channel);
+        bin_put_u16(&b, uss->freq_center);
+        bin_put_u8(&b, uss->chan_width);
+        bin_put_u8(&b, uss->utilization);
+        bin_put_u16(&b, (uint16_t)(int16_t)uss->interference);
+        bin_put_u32(&b, uss->total_samples);
+        bin_put_histogram(&b, uss->rssi_histogram);
+        bin_put_histogram(&b, uss->normalized_rssi_histogram);
+    }
+    for (i = 0; i < usi->width; i++) {
+        bin_put_varint(&b, usi->rssi_histograms_counts[i]);
+        bin_put_histogram(&b, usi->rssi_histograms[i]);
+    }
+    if (b.err) {
+        error(MODULE, "UOH, not enough memory!!!");
+        free(b.data);
+        return -1;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.temp", path);
+    fp = fopen(tmp, "w");
+    if (!fp) {
+        error(MODULE, "%s: %s: %s\n", __func__, tmp, strerror(errno));
+        free(b.data);
+        return -1;
+    }
+    /* fclose() flushes, a full disk may only show up there */
+    written = fwrite(b.data, 1, b.len, fp);
+    if (fclose(fp) || written != b.len) {
+        error(MODULE, "%s: short write to %s\n", __func__, tmp);
+        unlink(tmp);
+        free(b.data);
+        return -1;
+    }
+    free(b.data);
+    if (rename(tmp, path)) {
+        error(MODULE, "%s: rename to %s: %s\n", __func__, path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    debug(MODULE, "%s: %zu bytes\n", path, b.len);
+
+    return 0;
+}
+
+static int rftable_bin_alloc(struct ubnt_spectral_info *usi, uint16_t count, uint16_t width)
+{
+    uint32_t *data;
+    int i;
+
+    memset(usi, 0, sizeof(*usi));
+    usi->count = count;
+    usi->width = width;
+    usi->table = (struct ubnt_spectral_stats *)calloc(MAX(count, 1), sizeof(struct ubnt_spectral_stats));
+    usi->rssi_histograms_counts = (uint32_t *)calloc(MAX(width, 1), sizeof(uint32_t));
+    usi->rssi_histograms = (uint32_t **)calloc(MAX(width, 1), sizeof(uint32_t *));
+    data = (uint32_t *)calloc(MAX(width, 1), UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t));
+    if (!usi->table || !usi->rssi_histograms_counts || !usi->rssi_histograms || !data) {
+        free(data);
+        return -1;
+    }
+    for (i = 0; i < MAX(width, 1); i++, data += UBNT_RSSI_HISTOGRAM_SIZE)
+        usi->rssi_histograms[i] = data;
+
+    return 0;
+}
+
+void rftable_bin_free(struct rftable_bin *tb)
+{
+    struct ubnt_spectral_info *usi = &tb->usi;
+
+    if (usi->rssi_histograms)
+        free(usi->rssi_histograms[0]);
+    free(usi->rssi_histograms);
+    free(usi->rssi_histograms_counts);
+    free(usi->table);
+    memset(tb, 0, sizeof(*tb));
+}
+
+/*
+ * Decode a binary table. tb owns the decoded usi afterwards, release it
+ * with rftable_bin_free(). Returns 0 on success, -1 on a malformed or
+ * unsupported buffer.
+ */
+int rftable_bin_decode(const uint8_t *buf, size_t len, struct rftable_bin *tb)
+{
+    struct bin_cursor c = { buf, buf + len, 0 };
+    uint16_t header_size, count, width, hist_size;
+    int i;
+
+    memset(tb, 0, sizeof(*tb));
+    if (bin_get_u32(&c) != RFTABLE_BIN_MAGIC)
+        return -1;
+    tb->version = bin_get_u16(&c);
+    header_size = bin_get_u16(&c);
+    if (tb->version != RFTABLE_BIN_VERSION || header_size < RFTABLE_BIN_HEADER_SIZE || header_size > len)
+        return -1;
+    tb->band_5g = bin_get_u8(&c);
+    tb->suggested_count = bin_get_u8(&c);
+    count = bin_get_u16(&c);
+    width = bin_get_u16(&c);
+    hist_size = bin_get_u16(&c);
+    tb->spectrum_start = bin_get_u16(&c);
+    tb->generated = bin_get_u32(&c);
+    if (c.err || hist_size != UBNT_RSSI_HISTOGRAM_SIZE || tb->suggested_count > RFTABLE_BIN_SUGGESTED ||
+        rftable_bin_alloc(&tb->usi, count, width)) {
+        rftable_bin_free(tb);
+        return -1;
+    }
+    tb->usi.num_processed = bin_get_u32(&c);
+    tb->table_id = bin_get_u32(&c);
+    /* newer minor additions to the header are skipped */
+    c.p = buf + header_size;
+
+    for (i = 0; i < tb->suggested_count; i++) {
+        tb->suggested[i].channel = bin_get_u16(&c);
+        tb->suggested[i].bw = bin_get_u8(&c);
+        bin_get_u8(&c);
+    }
+    for (i = 0; i < count && !c.err; i++) {
+        struct ubnt_spectral_stats *uss = &tb->usi.table[i];
+
+        uss->channel = bin_get_u16(&c);
+        uss->freq_center = bin_get_u16(&c);
+        uss->chan_width = bin_get_u8(&c);
+        uss->utilization = bin_get_u8(&c);
+        uss->interference = (int16_t)bin_get_u16(&c);
+        uss->total_samples = bin_get_u32(&c);
+        bin_get_histogram(&c, uss->rssi_histogram);
+        bin_get_histogram(&c, uss->normalized_rssi_histogram);
+    }
+    for (i = 0; i < width && !c.err; i++) {
+        tb->usi.rssi_histograms_counts[i] = bin_get_varint(&c);
+        bin_get_histogram(&c, tb->usi.rssi_histograms[i]);
+    }
+    if (c.err) {
+        rftable_bin_free(tb);
+        return -1;
+    }
+
+    return 0;
+}
+
+int rftable_bin_load(const char *path, struct rftable_bin *tb)
+{
+    uint8_t *buf;
+    long len;
+    FILE *fp;
+    int ret = -1;
+
+    if (!(fp = fopen(path, "r")))
+        return -1;
+    if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) <= 0 || fseek(fp, 0, SEEK_SET)) {
+        fclose(fp);
+        return -1;
+    }
+    if ((buf = malloc(len)) && fread(buf, 1, len, fp) == (size_t)len)
+        ret = rftable_bin_decode(buf, len, tb);
+    free(buf);
+    fclose(fp);
+
+    return ret;
+}
+
+/*
+ * Check that the binary table at path says the same as usi: both produce
+ * the same JSON table and suggested channels. Returns 0 if they match.
+ */
+int rftable_bin_verify(const char *path, struct ubnt_spectral_info *usi,
+                       const struct channel_bw *suggested, int suggested_count)
+{
+    struct rftable_bin tb;
+    json_t *expected, *decoded;
+    int i, ret;
+
+    if (rftable_bin_load(path, &tb)) {
+        error(MODULE, "%s: cannot decode %s\n", __func__, path);
+        return -1;
+    }
+    expected = prepare_spectrum_table_usi(usi);
+    decoded = prepare_spectrum_table_usi(&tb.usi);
+    ret = json_equal(expected, decoded) ? 0 : -1;
+    json_decref(expected);
+    json_decref(decoded);
+
+    suggested_count = MIN(suggested_count, RFTABLE_BIN_SUGGESTED);
+    if (tb.suggested_count != suggested_count)
+        ret = -1;
+    for (i = 0; !ret && i < suggested_count; i++) {
+        if (tb.suggested[i].channel != suggested[i].channel || tb.suggested[i].bw != suggested[i].bw)
+            ret = -1;
+    }
+    if (ret)
+        error(MODULE, "%s: %s does not match the JSON table\n", __func__, path);
+    rftable_bin_free(&tb);
+
+    return ret;
+}
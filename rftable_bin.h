@@ -0,0 +1,60 @@
+#ifndef RFTABLE_BIN_H
+#define RFTABLE_BIN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "libubnt/libubnt.h"
+#include "libubnt/rfscan.h"
+
+/*
+ * Compact binary form of the published table, written next to the JSON
+ * as /var/run/rftable_<if>.bin. All integers are little endian.
+ *
+ *   header      magic "RFTB", u16 version, u16 header size, u8 band_5g,
+ *               u8 suggested count, u16 channel count, u16 width,
+ *               u16 histogram size, u16 spectrum start (MHz),
+ *               u32 generated (uptime), u32 num_processed,
+ *               u32 table id (increments with every table written)
+ *   suggested   u16 channel, u8 bw, u8 reserved  (per suggested channel)
+ *   channels    u16 channel, u16 freq_center, u8 chan_width,
+ *               u8 utilization, s16 interference, u32 total_samples,
+ *               rssi histogram, normalized histogram
+ *   per-MHz     varint count, histogram  (per MHz of width)
+ *
+ * A histogram is a varint number of non-zero bins followed by
+ * (varint gap to the previous non-zero bin, varint value) pairs.
+ *
+ * No channel occupancy, see occupancy_add_json().
+ */
+
+#define RFTABLE_BIN_FILE_FMT    "/var/run/rftable_%s.bin"
+#define RFTABLE_BIN_MAGIC       0x42544652 /* "RFTB" */
+#define RFTABLE_BIN_VERSION     2       /* 2 - table id */
+#define RFTABLE_BIN_HEADER_SIZE 30
+#define RFTABLE_BIN_SUGGESTED   8
+
+struct rftable_bin {
+    uint16_t version;
+    bool band_5g;
+    uint16_t spectrum_start;
+    uint32_t generated;
+    uint32_t table_id;
+    uint8_t suggested_count;
+    struct channel_bw suggested[RFTABLE_BIN_SUGGESTED];
+    struct ubnt_spectral_info usi;                  /* decoded table, owned */
+};
+
+/* writer */
+int rftable_bin_write(const char *path, const struct ubnt_spectral_info *usi, bool band_5g,
+                      const struct channel_bw *suggested, int suggested_count, uint32_t table_id);
+
+/* reader */
+int rftable_bin_decode(const uint8_t *buf, size_t len, struct rftable_bin *tb);
+int rftable_bin_load(const char *path, struct rftable_bin *tb);
+void rftable_bin_free(struct rftable_bin *tb);
+int rftable_bin_verify(const char *path, struct ubnt_spectral_info *usi,
+                       const struct channel_bw *suggested, int suggested_count);
+
+#endif //RFTABLE_BIN_H
@@ -0,0 +1,124 @@
+/*
+ * Ubiquiti RF Environment tool - table deltas
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ubnt.h"
+#include "rftable_delta.h"
+
+static bool delta_channel_changed(const struct ubnt_spectral_stats *a, const struct ubnt_spectral_stats *b)
+{
+    return a->utilization != b->utilization || a->interference != b->interference ||
+           a->total_samples != b->total_samples ||
+           memcmp(a->rssi_histogram, b->rssi_histogram, sizeof(a->rssi_histogram)) ||
+           memcmp(a->normalized_rssi_histogram, b->normalized_rssi_histogram, sizeof(a->normalized_rssi_histogram));
+}
+
+/* the delta can only be applied to a table of the same shape */
+static bool delta_same_layout(const struct ubnt_spectral_info *a, const struct ubnt_spectral_info *b)
+{
+    int i;
+
+    if (a->count != b->count || a->width != b->width)
+        return false;
+    for (i = 0; i < a->count; i++) {
+        if (a->table[i].channel != b->table[i].channel || a->table[i].chan_width != b->table[i].chan_width)
+            return false;
+    }
+    return true;
+}
+
+static json_t *delta_full(uint32_t base, uint32_t version)
+{
+    json_t *delta = json_object();
+
+    json_object_set_new(delta, "base", json_integer(base));
+    json_object_set_new(delta, "version", json_integer(version));
+    json_object_set_new(delta, "full", json_true());
+    return delta;
+}
+
+/*
+ * Build the delta from base (NULL if there is none) to usi, which
+ * becomes table version. Channel entries are formatted by libubnt from a
+ * one-channel view, exactly as in the full table.
+ */
+json_t *rftable_delta(const struct rftable_bin *base, struct ubnt_spectral_info *usi, uint32_t version,
+                      const struct channel_bw *suggested, int suggested_count)
+{
+    struct ubnt_spectral_info view = *usi;
+    json_t *delta, *channels, *rows, *row, *hist, *part, *entry;
+    size_t index;
+    int i, j, changed = 0, changed_rows = 0;
+
+    if (!base || !delta_same_layout(&base->usi, usi))
+        return delta_full(base ? base->table_id : 0, version);
+
+    for (i = 0; i < usi->count; i++)
+        changed += delta_channel_changed(&base->usi.table[i], &usi->table[i]);
+    for (i = 0; i < usi->width; i++)
+        changed_rows += base->usi.rssi_histograms_counts[i] != usi->rssi_histograms_counts[i] ||
+                        memcmp(base->usi.rssi_histograms[i], usi->rssi_histograms[i],
+                               UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t));
+    if (changed * 100 > usi->count * RFTABLE_DELTA_MAX_PCT ||
+        changed_rows * 100 > usi->width * RFTABLE_DELTA_MAX_PCT)
+        return delta_full(base->table_id, version);
+
+    delta = json_object();
+    json_object_set_new(delta, "base", json_integer(base->table_id));
+    json_object_set_new(delta, "version", json_integer(version));
+    json_object_set_new(delta, "full", json_false());
+
+    channels = json_array();
+    for (i = 0; i < usi->count; i++) {
+        if (!delta_channel_changed(&base->usi.table[i], &usi->table[i]))
+            continue;
+        view.table = &usi->table[i];
+        view.count = 1;
+        part = prepare_spectrum_table_usi(&view);
+        if (json_is_array(part)) {
+            json_array_foreach(part, index, entry)
+                json_array_append_new(channels, json_incref(entry));
+        }
+        json_decref(part);
+    }
+    json_object_set_new(delta, "channels", channels);
+
+    rows = json_array();
+    for (i = 0; i < usi->width; i++) {
+        if (base->usi.rssi_histograms_counts[i] == usi->rssi_histograms_counts[i] &&
+            !memcmp(base->usi.rssi_histograms[i], usi->rssi_histograms[i], UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t)))
+            continue;
+        row = json_object();
+        hist = json_array();
+        for (j = 0; j < UBNT_RSSI_HISTOGRAM_SIZE; j++)
+            json_array_append_new(hist, json_integer(usi->rssi_histograms[i][j]));
+        json_object_set_new(row, "freq", json_integer(base->spectrum_start + i));
+        json_object_set_new(row, "count", json_integer(usi->rssi_histograms_counts[i]));
+        json_object_set_new(row, "histogram", hist);
+        json_array_append_new(rows, row);
+    }
+    json_object_set_new(delta, "rows", rows);
+    json_object_set_new(delta, "suggested_channels",
+                        prepare_suggested_channels((struct channel_bw *)suggested, suggested_count));
+
+    debug(MODULE, "delta %u -> %u: %d channels, %d rows\n", base->table_id, version, changed, changed_rows);
+
+    return delta;
+}
+
+int rftable_delta_write(const char *path, const json_t *delta)
+{
+    char tmp[FILE_NAME_LEN + 8];
+
+    snprintf(tmp, sizeof(tmp), "%s.temp", path);
+    if (json_dump_file(delta, tmp, JSON_COMPACT)) {
+        error(MODULE, "%s: cannot write %s\n", __func__, tmp);
+        unlink(tmp);
+        return -1;
+    }
+    return rename(tmp, path);
+}
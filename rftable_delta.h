@@ -0,0 +1,33 @@
+#ifndef RFTABLE_DELTA_H
+#define RFTABLE_DELTA_H
+
+#include <stdint.h>
+#include <jansson.h>
+
+#include "rftable_bin.h"
+
+/*
+ * Change document between two published tables, written as
+ * /var/run/rftable_<if>.delta:
+ *
+ *   {"base":<id>,"version":<id>,"full":false,
+ *    "channels":[<spectrum_table entries of the changed channels>],
+ *    "rows":[{"freq":<MHz>,"count":<n>,"histogram":[...]}, ...],
+ *    "suggested_channels":[...]}
+ *
+ * A consumer holding table <base> applies it to get table <version>.
+ * Anyone else, or when "full" is true (no usable base, or too much
+ * changed for a delta to pay off), reads the full table instead. The
+ * channel entries are the ones of prepare_spectrum_table_usi(), without
+ * the occupancy (see occupancy_add_json()).
+ */
+
+#define RFTABLE_DELTA_FILE_FMT "/var/run/rftable_%s.delta"
+/* beyond this share of changed channels or rows, compact to a full table */
+#define RFTABLE_DELTA_MAX_PCT  50
+
+json_t *rftable_delta(const struct rftable_bin *base, struct ubnt_spectral_info *usi, uint32_t version,
+                      const struct channel_bw *suggested, int suggested_count);
+int rftable_delta_write(const char *path, const json_t *delta);
+
+#endif //RFTABLE_DELTA_H
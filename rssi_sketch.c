@@ -0,0 +1,130 @@
+/*
+ * Ubiquiti RF Environment tool - RSSI quantile sketch
+ */
+
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "rssi_sketch.h"
+
+#define LOWBIT(i) ((i) & -(i))
+
+void rssi_sketch_reset(struct rssi_sketch *sk)
+{
+    memset(sk, 0, sizeof(*sk));
+}
+
+/* tree[] holds Fenwick partial sums over the 1-based values 1..RSSI_SKETCH_SIZE */
+static void rssi_sketch_build(uint32_t *tree)
+{
+    int i, j;
+
+    for (i = 1; i <= RSSI_SKETCH_SIZE; i++) {
+        j = i + LOWBIT(i);
+        if (j <= RSSI_SKETCH_SIZE)
+            tree[j - 1] += tree[i - 1];
+    }
+}
+
+static void rssi_sketch_unbuild(uint32_t *tree)
+{
+    int i, j;
+
+    for (i = RSSI_SKETCH_SIZE; i >= 1; i--) {
+        j = i + LOWBIT(i);
+        if (j <= RSSI_SKETCH_SIZE)
+            tree[j - 1] -= tree[i - 1];
+    }
+}
+
+/*
+ * if the counts are about to overflow, divide all values by 2
+ * (effectively giving 50% weightage to previous samples)
+ */
+void rssi_sketch_halve(struct rssi_sketch *sk)
+{
+    int i;
+
+    rssi_sketch_unbuild(sk->tree);
+    sk->total = 0;
+    for (i = 0; i < RSSI_SKETCH_SIZE; i++) {
+        sk->tree[i] >>= 1;
+        sk->total += sk->tree[i];
+    }
+    rssi_sketch_build(sk->tree);
+}
+
+/* scale all counts by weight (0..1), to age older samples */
+void rssi_sketch_scale(struct rssi_sketch *sk, double weight)
+{
+    int i;
+
+    rssi_sketch_unbuild(sk->tree);
+    sk->total = 0;
+    for (i = 0; i < RSSI_SKETCH_SIZE; i++) {
+        sk->tree[i] = (uint32_t)(sk->tree[i] * weight);
+        sk->total += sk->tree[i];
+    }
+    rssi_sketch_build(sk->tree);
+}
+
+void rssi_sketch_add(struct rssi_sketch *sk, int rssi, uint32_t count)
+{
+    int i;
+
+    if (rssi < 0)
+        rssi = 0;
+    else if (rssi >= RSSI_SKETCH_SIZE)
+        rssi = RSSI_SKETCH_SIZE - 1;
+
+    while (sk->total > UINT_MAX - count)
+        rssi_sketch_halve(sk);
+
+    for (i = rssi + 1; i <= RSSI_SKETCH_SIZE; i += LOWBIT(i))
+        sk->tree[i - 1] += count;
+    sk->total += count;
+}
+
+void rssi_sketch_merge(struct rssi_sketch *dst, const struct rssi_sketch *src)
+{
+    int i;
+
+    while (dst->total > UINT_MAX - src->total)
+        rssi_sketch_halve(dst);
+
+    /* the Fenwick transform is linear, so partial sums add directly */
+    for (i = 0; i < RSSI_SKETCH_SIZE; i++)
+        dst->tree[i] += src->tree[i];
+    dst->total += src->total;
+}
+
+/*
+ * Return the smallest rssi value whose cumulative share of the samples
+ * reaches the requested percentile, or -1 for an empty sketch.
+ */
+int rssi_sketch_quantile(const struct rssi_sketch *sk, double percentile)
+{
+    uint64_t target;
+    int pos = 0, step;
+
+    if (!sk->total)
+        return -1;
+
+    if (percentile <= 0)
+        target = 1;
+    else if (percentile >= 100)
+        target = sk->total;
+    else
+        target = (uint64_t)ceil((double)sk->total * percentile / 100.0);
+
+    /* find the largest prefix holding fewer than target samples */
+    for (step = RSSI_SKETCH_SIZE; step; step >>= 1) {
+        if (pos + step <= RSSI_SKETCH_SIZE && sk->tree[pos + step - 1] < target) {
+            pos += step;
+            target -= sk->tree[pos - 1];
+        }
+    }
+
+    return pos;
+}
@@ -0,0 +1,29 @@
+#ifndef RSSI_SKETCH_H
+#define RSSI_SKETCH_H
+
+#include <stdint.h>
+
+/*
+ * Streaming quantile summary of RSSI samples.
+ *
+ * RSSI values are small integers, so the summary is an exact 1 dB resolution
+ * count array kept as a Fenwick tree: insertion and percentile queries are
+ * O(log n), and two sketches merge by plain addition.
+ */
+
+/* must be a power of two (binary lifting in the quantile query) */
+#define RSSI_SKETCH_SIZE 128
+
+struct rssi_sketch {
+    uint32_t total;
+    uint32_t tree[RSSI_SKETCH_SIZE];
+};
+
+void rssi_sketch_reset(struct rssi_sketch *sk);
+void rssi_sketch_add(struct rssi_sketch *sk, int rssi, uint32_t count);
+void rssi_sketch_merge(struct rssi_sketch *dst, const struct rssi_sketch *src);
+void rssi_sketch_halve(struct rssi_sketch *sk);
+void rssi_sketch_scale(struct rssi_sketch *sk, double weight);
+int rssi_sketch_quantile(const struct rssi_sketch *sk, double percentile);
+
+#endif //RSSI_SKETCH_H
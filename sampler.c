@@ -0,0 +1,89 @@
+/*
+ * Ubiquiti RF Environment tool - adaptive channel sampler
+ */
+
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+#include "sampler.h"
+#include "rssi_sketch.h"
+
+void sampler_init(struct adaptive_sampler *s, uint8_t max_captures, double ci_db)
+{
+    memset(s, 0, sizeof(*s));
+    s->max_captures = max_captures ? max_captures : 1;
+    s->min_captures = MIN(SAMPLER_DEF_MIN_CAPTURES, s->max_captures);
+    s->ci_db = (ci_db > 0) ? ci_db : SAMPLER_DEF_CI_DB;
+    s->z = SAMPLER_DEF_Z;
+    s->max_tvd = SAMPLER_DEF_MAX_TVD;
+}
+
+void sampler_start_channel(struct adaptive_sampler *s)
+{
+    s->captures = 0;
+    s->prev_total = 0;
+    memset(s->prev_histogram, 0, sizeof(s->prev_histogram));
+}
+
+/* total variation distance between two histograms, in % */
+static double sampler_histogram_tvd(const uint32_t *a, uint32_t a_total, const uint32_t *b, uint32_t b_total)
+{
+    double tvd = 0;
+    int i;
+
+    if (!a_total || !b_total)
+        return 100.0;
+
+    for (i = 0; i < UBNT_RSSI_HISTOGRAM_SIZE; i++)
+        tvd += fabs((double)a[i] / a_total - (double)b[i] / b_total);
+
+    return 50.0 * tvd;
+}
+
+/*
+ * Width of the confidence interval of the interference percentile: the
+ * rank of a sample p-quantile is binomial, so the interval spans the values
+ * at p -/+ z * sqrt(p * (1 - p) / n).
+ */
+static int sampler_percentile_ci(const struct adaptive_sampler *s, const struct rssi_sketch *sk)
+{
+    double p = UBNT_INTERFERENCE_POWER_PERCENTILE / 100.0;
+    double half;
+
+    if (!sk->total)
+        return INT_MAX;
+
+    half = s->z * sqrt(p * (1.0 - p) / sk->total);
+
+    return rssi_sketch_quantile(sk, 100.0 * (p + half)) - rssi_sketch_quantile(sk, 100.0 * (p - half));
+}
+
+/*
+ * Account one more capture on the channel (its windows already processed)
+ * and report whether sampling can stop.
+ */
+bool sampler_converged(struct adaptive_sampler *s, uint16_t channel)
+{
+    struct ubnt_spectral_stats *uss = ubnt_get_channel_stats(channel, BW_20);
+    struct rssi_sketch *sk = ubnt_get_channel_sketch(channel, BW_20);
+    double tvd;
+    int ci;
+    bool done;
+
+    s->captures++;
+    if (!uss || !sk || s->captures >= s->max_captures)
+        return true;
+
+    ci = sampler_percentile_ci(s, sk);
+    tvd = sampler_histogram_tvd(uss->rssi_histogram, uss->total_samples, s->prev_histogram, s->prev_total);
+    done = (s->captures >= s->min_captures) && (ci <= s->ci_db) && (tvd <= s->max_tvd);
+
+    debug(MODULE, "%s: ch:%d capture:%d samples:%u ci:%d dB tvd:%.1f%% -> %s\n", __func__,
+          channel, s->captures, uss->total_samples, ci, tvd, done ? "done" : "continue");
+
+    memcpy(s->prev_histogram, uss->rssi_histogram, sizeof(s->prev_histogram));
+    s->prev_total = uss->total_samples;
+
+    return done;
+}
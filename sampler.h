@@ -0,0 +1,37 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ubnt.h"
+
+/*
+ * Adaptive per-channel sampling: keep capturing on a channel until the
+ * interference percentile and the RSSI histogram have converged, or the
+ * capture limit is reached.
+ */
+
+#define SAMPLER_DEF_MIN_CAPTURES 2
+#define SAMPLER_DEF_CI_DB        2.0     /* confidence interval width of the interference percentile */
+#define SAMPLER_MAX_CI_DB        UBNT_RSSI_HISTOGRAM_SIZE    /* as wide as the histogram, always met */
+#define SAMPLER_DEF_Z            1.96    /* 95% confidence */
+#define SAMPLER_DEF_MAX_TVD      5.0     /* histogram change between captures, % */
+
+struct adaptive_sampler {
+    uint8_t  min_captures;
+    uint8_t  max_captures;
+    double   ci_db;
+    double   z;
+    double   max_tvd;
+    /* per-channel state */
+    uint8_t  captures;
+    uint32_t prev_total;
+    uint32_t prev_histogram[UBNT_RSSI_HISTOGRAM_SIZE];
+};
+
+void sampler_init(struct adaptive_sampler *s, uint8_t max_captures, double ci_db);
+void sampler_start_channel(struct adaptive_sampler *s);
+bool sampler_converged(struct adaptive_sampler *s, uint16_t channel);
+
+#endif //SAMPLER_H
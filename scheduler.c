@@ -0,0 +1,123 @@
+/*
+ * Ubiquiti RF Environment tool - time-budgeted scan scheduler
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "scheduler.h"
+
+static uint32_t elapsed_ms(const struct timespec *from)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - from->tv_sec) * 1000 + (now.tv_nsec - from->tv_nsec) / 1000000;
+}
+
+void sched_init(struct scan_scheduler *s, uint32_t budget_sec)
+{
+    memset(s, 0, sizeof(*s));
+    s->budget_ms = budget_sec * 1000;
+    s->visit_ms = SCHED_DEF_VISIT_MS;
+    s->current = -1;
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+}
+
+void sched_add(struct scan_scheduler *s, uint8_t index, uint16_t freq, uint32_t age_sec, double spread_db)
+{
+    struct sched_item *item;
+
+    if (s->count >= ARRAY_SIZE(s->items))
+        return;
+
+    item = &s->items[s->count++];
+    item->index = index;
+    item->freq = freq;
+    item->age_sec = age_sec;
+    item->spread_db = spread_db;
+    item->done = false;
+}
+
+uint32_t sched_elapsed_ms(const struct scan_scheduler *s)
+{
+    return elapsed_ms(&s->start);
+}
+
+/* true once the remaining budget cannot fit another channel visit */
+bool sched_expired(struct scan_scheduler *s)
+{
+    if (s->budget_ms && sched_elapsed_ms(s) + s->visit_ms > s->budget_ms)
+        s->expired = true;
+    return s->expired;
+}
+
+/* measure the cost of the current visit and close it */
+static void sched_close(struct scan_scheduler *s)
+{
+    /* moving average, settle time dominates and is fairly constant */
+    s->visit_ms = (s->visit_ms + elapsed_ms(&s->visit_start)) / 2;
+    s->current = -1;
+}
+
+/* the current channel has been accounted, count its visit */
+void sched_complete(struct scan_scheduler *s)
+{
+    if (s->current < 0)
+        return;
+    s->visited++;
+    sched_close(s);
+}
+
+/*
+ * Close the current visit, counted only if sched_complete() was called,
+ * and return the chan_list index of the next channel to visit, or -1 when
+ * all channels have been picked or the budget is exhausted.
+ */
+int sched_next(struct scan_scheduler *s)
+{
+    uint32_t max_age = 0;
+    double max_spread = 0, best_score = 0, score, stale;
+    int i, best = -1;
+
+    if (s->current >= 0)
+        sched_close(s);
+    if (sched_expired(s))
+        return -1;
+
+    for (i = 0; i < s->count; i++) {
+        if (s->items[i].done)
+            continue;
+        if (s->items[i].age_sec != SCHED_AGE_UNKNOWN)
+            max_age = MAX(max_age, s->items[i].age_sec);
+        max_spread = MAX(max_spread, s->items[i].spread_db);
+    }
+
+    for (i = 0; i < s->count; i++) {
+        struct sched_item *item = &s->items[i];
+
+        if (item->done)
+            continue;
+        if (item->age_sec == SCHED_AGE_UNKNOWN || !max_age)
+            stale = 1.0;
+        else
+            stale = (double)item->age_sec / max_age;
+        score = SCHED_W_STALENESS * stale;
+        if (max_spread > 0)
+            score += SCHED_W_VARIANCE * item->spread_db / max_spread;
+        score -= SCHED_W_ADJACENCY * abs((int)item->freq - (int)s->last_freq) / 100.0;
+        if (best < 0 || score > best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+
+    if (best < 0)
+        return -1;
+    s->items[best].done = true;
+    s->last_freq = s->items[best].freq;
+    s->current = best;
+    clock_gettime(CLOCK_MONOTONIC, &s->visit_start);
+
+    return s->items[best].index;
+}
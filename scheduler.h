@@ -0,0 +1,52 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "ubnt.h"
+
+/*
+ * Time-budgeted channel visit scheduler. Channels are visited in order of
+ * staleness and variance, discounted by the retune distance from the
+ * current channel, until the wall-clock budget would be exceeded.
+ */
+
+#define SCHED_DEF_VISIT_MS  2500    /* settle + capture, until measured */
+#define SCHED_AGE_UNKNOWN   UINT32_MAX
+
+/* priority weights */
+#define SCHED_W_STALENESS   1.0
+#define SCHED_W_VARIANCE    0.5
+#define SCHED_W_ADJACENCY   0.25    /* per 100 MHz of retune */
+
+struct sched_item {
+    uint8_t  index;                 /* chan_list index */
+    uint16_t freq;
+    uint32_t age_sec;
+    double   spread_db;
+    bool     done;
+};
+
+struct scan_scheduler {
+    struct sched_item items[MAX_NUM_CHANNELS];
+    uint16_t count;
+    uint16_t visited;               /* visits completed */
+    uint32_t budget_ms;             /* 0 - unlimited */
+    uint32_t visit_ms;              /* running estimate of a channel visit */
+    uint16_t last_freq;
+    int      current;               /* item being visited, -1 if none */
+    bool     expired;
+    struct timespec start;
+    struct timespec visit_start;
+};
+
+void sched_init(struct scan_scheduler *s, uint32_t budget_sec);
+void sched_add(struct scan_scheduler *s, uint8_t index, uint16_t freq, uint32_t age_sec, double spread_db);
+int sched_next(struct scan_scheduler *s);
+void sched_complete(struct scan_scheduler *s);
+bool sched_expired(struct scan_scheduler *s);
+uint32_t sched_elapsed_ms(const struct scan_scheduler *s);
+
+#endif //SCHEDULER_H
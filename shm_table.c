@@ -0,0 +1,219 @@
+/*
+ * Ubiquiti RF Environment tool - shared-memory result segment
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ubnt.h"
+#include "shm_table.h"
+
+/* reader retries before giving up on a writer that keeps the segment busy */
+#define SHM_TABLE_READ_RETRIES 1000
+
+static void shm_table_write_begin(struct shm_table_header *hdr)
+{
+    __atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELAXED);
+    /* the data stores must not pass the odd seq */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void shm_table_write_end(struct shm_table_header *hdr)
+{
+    hdr->updated = ubnt_uptime();
+    __atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Create (or recreate) the segment of ifname sized for usi. The layout
+ * is fixed for the life of the process.
+ */
+struct shm_table *shm_table_create(const char *ifname, const struct ubnt_spectral_info *usi, bool band_5g)
+{
+    struct shm_table *t = calloc(1, sizeof(*t));
+    struct shm_table_header *hdr;
+    size_t channels_off, hist_counts_off, hist_off;
+
+    if (!t) {
+        error(MODULE, "UOH, not enough memory!!!");
+        return NULL;
+    }
+    channels_off = sizeof(struct shm_table_header);
+    hist_counts_off = channels_off + usi->count * sizeof(struct shm_table_channel);
+    hist_off = hist_counts_off + usi->width * sizeof(uint32_t);
+    t->size = hist_off + usi->width * UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t);
+
+    snprintf(t->name, sizeof(t->name), SHM_TABLE_NAME_FMT, ifname);
+    t->fd = shm_open(t->name, O_CREAT | O_RDWR, 0644);
+    if (t->fd < 0) {
+        error(MODULE, "%s: shm_open %s: %s\n", __func__, t->name, strerror(errno));
+        free(t);
+        return NULL;
+    }
+    if (ftruncate(t->fd, t->size) < 0 ||
+        (hdr = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0)) == MAP_FAILED) {
+        error(MODULE, "%s: %s: %s\n", __func__, t->name, strerror(errno));
+        close(t->fd);
+        free(t);
+        return NULL;
+    }
+    t->hdr = hdr;
+
+    /*
+     * Readers of a previous instance may still have it mapped, and seq is
+     * left odd if that one died mid-write: odd either way while it is
+     * reinitialised.
+     */
+    __atomic_store_n(&hdr->seq, hdr->seq | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memset((char *)hdr + offsetof(struct shm_table_header, size), 0,
+           t->size - offsetof(struct shm_table_header, size));
+    hdr->magic = SHM_TABLE_MAGIC;
+    hdr->version = SHM_TABLE_VERSION;
+    hdr->header_size = sizeof(struct shm_table_header);
+    hdr->size = t->size;
+    hdr->band_5g = band_5g;
+    hdr->state = SHM_SCAN_NONE;
+    hdr->channel_count = usi->count;
+    hdr->width = usi->width;
+    hdr->hist_size = UBNT_RSSI_HISTOGRAM_SIZE;
+    hdr->spectrum_start = band_5g ? UBNT_RSSI_SPECTRUM_START_5G : UBNT_RSSI_SPECTRUM_START_2G;
+    hdr->channels_off = channels_off;
+    hdr->hist_counts_off = hist_counts_off;
+    hdr->hist_off = hist_off;
+    shm_table_write_end(hdr);
+
+    info(MODULE, "shared table %s, %zu bytes\n", t->name, t->size);
+
+    return t;
+}
+
+/* the segment is left in place for the consumers */
+void shm_table_close(struct shm_table *t)
+{
+    if (!t)
+        return;
+    munmap(t->hdr, t->size);
+    close(t->fd);
+    free(t);
+}
+
+void shm_table_set_state(struct shm_table *t, enum shm_scan_state state, uint16_t visited, uint16_t scheduled)
+{
+    struct shm_table_header *hdr;
+
+    if (!t)
+        return;
+    hdr = t->hdr;
+    shm_table_write_begin(hdr);
+    if (state == SHM_SCAN_RUNNING && hdr->state != SHM_SCAN_RUNNING)
+        hdr->scan_start = ubnt_uptime();
+    hdr->state = state;
+    hdr->visited = visited;
+    hdr->scheduled = scheduled;
+    shm_table_write_end(hdr);
+}
+
+/*
+ * Copy the table in. scanned holds the per-channel scan uptimes (may be
+ * NULL); suggested may be NULL to keep the previous suggestions.
+ */
+void shm_table_update(struct shm_table *t, const struct ubnt_spectral_info *usi, const uint32_t *scanned,
+                      const struct channel_bw *suggested, int suggested_count)
+{
+    struct shm_table_header *hdr;
+    struct shm_table_channel *ch;
+    uint16_t count, width;
+    int i;
+
+    if (!t)
+        return;
+    hdr = t->hdr;
+    ch = (struct shm_table_channel *)((char *)hdr + hdr->channels_off);
+    count = MIN(usi->count, hdr->channel_count);
+    width = MIN(usi->width, hdr->width);
+
+    shm_table_write_begin(hdr);
+    for (i = 0; i < count; i++, ch++) {
+        const struct ubnt_spectral_stats *uss = &usi->table[i];
+
+        ch->channel = uss->channel;
+        ch->freq_center = uss->freq_center;
+        ch->chan_width = uss->chan_width;
+        ch->utilization = uss->utilization;
+        ch->interference = uss->interference;
+        ch->total_samples = uss->total_samples;
+        ch->scanned = scanned ? scanned[i] : 0;
+        memcpy(ch->rssi_histogram, uss->rssi_histogram, sizeof(ch->rssi_histogram));
+    }
+    memcpy((char *)hdr + hdr->hist_counts_off, usi->rssi_histograms_counts, width * sizeof(uint32_t));
+    memcpy((char *)hdr + hdr->hist_off, usi->rssi_histograms[0], width * UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t));
+    if (suggested) {
+        hdr->suggested_count = MIN(suggested_count, SHM_TABLE_SUGGESTED);
+        for (i = 0; i < hdr->suggested_count; i++) {
+            hdr->suggested[i].channel = suggested[i].channel;
+            hdr->suggested[i].bw = suggested[i].bw;
+        }
+    }
+    shm_table_write_end(hdr);
+}
+
+/*
+ * Map the segment of ifname read-only. size gets the mapped size.
+ */
+const struct shm_table_header *shm_table_attach(const char *ifname, size_t *size)
+{
+    char name[32];
+    struct stat st;
+    void *seg;
+    int fd;
+
+    snprintf(name, sizeof(name), SHM_TABLE_NAME_FMT, ifname);
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct shm_table_header)) {
+        close(fd);
+        return NULL;
+    }
+    seg = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED)
+        return NULL;
+    *size = st.st_size;
+
+    return seg;
+}
+
+/*
+ * Take a consistent copy of the segment (mapped seg_size bytes) into buf
+ * (size bytes, at least the segment size). Returns 0 on success, -1 if
+ * the segment is not a table of this version or kept changing.
+ */
+int shm_table_read(const struct shm_table_header *seg, size_t seg_size, void *buf, size_t size)
+{
+    uint32_t seq;
+    int retries;
+
+    for (retries = 0; retries < SHM_TABLE_READ_RETRIES; retries++) {
+        seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            usleep(100);
+            continue;
+        }
+        if (seg->magic != SHM_TABLE_MAGIC || seg->version != SHM_TABLE_VERSION || seg->size > size || seg->size > seg_size)
+            return -1;
+        memcpy(buf, seg, seg->size);
+        /* the copy must be done before seq is checked again */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == seq)
+            return 0;
+    }
+
+    return -1;
+}
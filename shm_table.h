@@ -0,0 +1,96 @@
+#ifndef SHM_TABLE_H
+#define SHM_TABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "libubnt/libubnt.h"
+#include "libubnt/rfscan.h"
+
+/*
+ * Optional POSIX shared-memory copy of the published table, for local
+ * consumers that want it without parsing JSON or touching files:
+ *
+ *   struct shm_table_header
+ *   struct shm_table_channel  channels[channel_count]   at channels_off
+ *   uint32_t                  hist_counts[width]        at hist_counts_off
+ *   uint32_t                  hist[width][hist_size]    at hist_off
+ *
+ * All fields are host endian. The writer bumps seq to odd before it
+ * touches the segment and back to even when done (seqlock); readers copy
+ * the segment and retry while seq was odd or changed, see shm_table_read().
+ * No channel occupancy, see occupancy_add_json().
+ */
+
+#define SHM_TABLE_NAME_FMT  "/rftable_%s"
+#define SHM_TABLE_MAGIC     0x48534652 /* "RFSH" */
+#define SHM_TABLE_VERSION   1
+#define SHM_TABLE_SUGGESTED 8
+
+enum shm_scan_state {
+    SHM_SCAN_NONE = 0,                              /* no scan yet, table loaded or empty */
+    SHM_SCAN_RUNNING,
+    SHM_SCAN_DONE,
+    SHM_SCAN_PARTIAL,                               /* stopped by the time budget */
+};
+
+struct shm_table_channel {
+    uint16_t channel;
+    uint16_t freq_center;
+    uint8_t  chan_width;
+    uint8_t  utilization;
+    int16_t  interference;                          /* dBm */
+    uint32_t total_samples;
+    uint32_t scanned;                               /* uptime of the last scan, 0 = not scanned */
+    uint32_t rssi_histogram[UBNT_RSSI_HISTOGRAM_SIZE];
+};
+
+struct shm_table_suggested {
+    uint16_t channel;
+    uint8_t  bw;
+    uint8_t  reserved;
+};
+
+struct shm_table_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t seq;                                   /* odd while being written */
+    uint32_t size;                                  /* whole segment */
+    uint32_t updated;                               /* uptime of the last update */
+    uint32_t scan_start;                            /* uptime the current/last scan started */
+    uint8_t  band_5g;
+    uint8_t  state;                                 /* enum shm_scan_state */
+    uint16_t visited;                               /* channels scanned by the current/last scan */
+    uint16_t scheduled;                             /* channels the scan set out to visit */
+    uint16_t channel_count;
+    uint16_t width;                                 /* MHz covered by the histograms */
+    uint16_t hist_size;                             /* bins per histogram */
+    uint16_t spectrum_start;                        /* MHz of histogram 0 */
+    uint16_t suggested_count;
+    uint32_t channels_off;
+    uint32_t hist_counts_off;
+    uint32_t hist_off;
+    struct shm_table_suggested suggested[SHM_TABLE_SUGGESTED];
+};
+
+struct shm_table {
+    char name[32];
+    int fd;
+    size_t size;
+    struct shm_table_header *hdr;
+};
+
+/* writer side */
+struct shm_table *shm_table_create(const char *ifname, const struct ubnt_spectral_info *usi, bool band_5g);
+void shm_table_close(struct shm_table *t);
+void shm_table_set_state(struct shm_table *t, enum shm_scan_state state, uint16_t visited, uint16_t scheduled);
+void shm_table_update(struct shm_table *t, const struct ubnt_spectral_info *usi, const uint32_t *scanned,
+                      const struct channel_bw *suggested, int suggested_count);
+
+/* reader side */
+const struct shm_table_header *shm_table_attach(const char *ifname, size_t *size);
+int shm_table_read(const struct shm_table_header *seg, size_t seg_size, void *buf, size_t size);
+
+#endif //SHM_TABLE_H
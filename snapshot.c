@@ -0,0 +1,125 @@
+/*
+ * Ubiquiti RF Environment tool - lock-free table snapshots
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "ubnt.h"
+#include "snapshot.h"
+#include "occupancy.h"
+
+static int snapshot_alloc(struct spectrum_snapshot *snap, const struct ubnt_spectral_info *usi)
+{
+    uint32_t *data;
+    int i;
+
+    memset(snap, 0, sizeof(*snap));
+    snap->usi.count = usi->count;
+    snap->usi.width = usi->width;
+    snap->usi.table = (struct ubnt_spectral_stats *)calloc(usi->count, sizeof(struct ubnt_spectral_stats));
+    snap->usi.rssi_histograms_counts = (uint32_t *)calloc(usi->width, sizeof(uint32_t));
+    /* zeroed, snapshot_release_buf() frees [0] of a partly allocated buffer */
+    snap->usi.rssi_histograms = (uint32_t **)calloc(usi->width, sizeof(uint32_t *));
+    data = (uint32_t *)calloc(usi->width, UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t));
+    snap->occupancy = (struct occupancy *)calloc(usi->count, sizeof(struct occupancy));
+    if (!snap->usi.table || !snap->usi.rssi_histograms_counts || !snap->usi.rssi_histograms || !data ||
+        !snap->occupancy) {
+        error(MODULE, "UOH, not enough memory!!!");
+        free(data);
+        return -1;
+    }
+    for (i = 0; i < usi->width; i++, data += UBNT_RSSI_HISTOGRAM_SIZE)
+        snap->usi.rssi_histograms[i] = data;
+
+    return 0;
+}
+
+static void snapshot_release_buf(struct spectrum_snapshot *snap)
+{
+    if (snap->usi.rssi_histograms)
+        free(snap->usi.rssi_histograms[0]);
+    free(snap->usi.rssi_histograms);
+    free(snap->usi.rssi_histograms_counts);
+    free(snap->usi.table);
+    free(snap->occupancy);
+    memset(snap, 0, sizeof(*snap));
+}
+
+/*
+ * Size both buffers after the radio's usi, ubnt_init() must have run.
+ * Until the first publication readers get an empty table.
+ */
+int snapshot_init(struct snapshot_pub *pub, const struct ubnt_spectral_info *usi)
+{
+    memset(pub, 0, sizeof(*pub));
+    if (snapshot_alloc(&pub->buf[0], usi) || snapshot_alloc(&pub->buf[1], usi)) {
+        snapshot_free(pub);
+        return -1;
+    }
+    return 0;
+}
+
+void snapshot_free(struct snapshot_pub *pub)
+{
+    snapshot_release_buf(&pub->buf[0]);
+    snapshot_release_buf(&pub->buf[1]);
+}
+
+/*
+ * Copy usi into the spare buffer and make it current. Only the scanning
+ * thread publishes. If a reader still holds the spare buffer, either wait
+ * for it or, without wait, skip: the next channel publishes a newer copy.
+ * Returns 0 if published, 1 if skipped.
+ */
+int snapshot_publish(struct snapshot_pub *pub, const struct ubnt_spectral_info *usi,
+                     const struct occupancy *occupancy, bool scanning, bool wait)
+{
+    uint32_t back = !__atomic_load_n(&pub->current, __ATOMIC_RELAXED);
+    struct spectrum_snapshot *snap = &pub->buf[back];
+
+    if (!snap->usi.table)
+        return -1;
+
+    /* pairs with the reader's increment and recheck of current */
+    while (__atomic_load_n(&pub->readers[back], __ATOMIC_SEQ_CST)) {
+        if (!wait)
+            return 1;
+        sched_yield();
+    }
+
+    memcpy(snap->usi.table, usi->table, MIN(usi->count, snap->usi.count) * sizeof(struct ubnt_spectral_stats));
+    memcpy(snap->usi.rssi_histograms_counts, usi->rssi_histograms_counts,
+           MIN(usi->width, snap->usi.width) * sizeof(uint32_t));
+    memcpy(snap->usi.rssi_histograms[0], usi->rssi_histograms[0],
+           MIN(usi->width, snap->usi.width) * UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t));
+    memcpy(snap->occupancy, occupancy, MIN(usi->count, snap->usi.count) * sizeof(struct occupancy));
+    snap->usi.num_processed = usi->num_processed;
+    snap->version = ++pub->version;
+    snap->published = ubnt_uptime();
+    snap->scanning = scanning;
+
+    __atomic_store_n(&pub->current, back, __ATOMIC_SEQ_CST);
+
+    return 0;
+}
+
+struct spectrum_snapshot *snapshot_acquire(struct snapshot_pub *pub)
+{
+    uint32_t cur;
+
+    for (;;) {
+        cur = __atomic_load_n(&pub->current, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&pub->readers[cur], 1, __ATOMIC_SEQ_CST);
+        /* still current: the publisher will not touch it until we let go */
+        if (__atomic_load_n(&pub->current, __ATOMIC_SEQ_CST) == cur)
+            return &pub->buf[cur];
+        __atomic_sub_fetch(&pub->readers[cur], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void snapshot_release(struct snapshot_pub *pub, const struct spectrum_snapshot *snap)
+{
+    __atomic_sub_fetch(&pub->readers[snap - pub->buf], 1, __ATOMIC_SEQ_CST);
+}
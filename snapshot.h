@@ -0,0 +1,46 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libubnt/libubnt.h"
+#include "libubnt/rfscan.h"
+
+/*
+ * Published copies of a radio's spectral table. The scan keeps mutating
+ * its own usi and publishes a copy after every channel; readers in other
+ * threads (daemon queries, writers) pick up the latest copy without
+ * taking a lock and without stalling the scan.
+ *
+ * Two buffers with per-buffer reader counts (left-right scheme): the
+ * scan only ever writes the buffer that is not current, and only once
+ * its readers have drained. A reader holds a snapshot between
+ * snapshot_acquire() and snapshot_release() and must not modify it.
+ */
+
+struct occupancy;
+
+struct spectrum_snapshot {
+    uint32_t version;                               /* publication counter, 0 = never published */
+    uint32_t published;                             /* uptime of the publication */
+    bool scanning;                                  /* taken mid-scan, bonded channels not yet derived */
+    struct ubnt_spectral_info usi;                  /* self-contained copy */
+    struct occupancy *occupancy;                    /* usi.count entries */
+};
+
+struct snapshot_pub {
+    struct spectrum_snapshot buf[2];
+    uint32_t readers[2];
+    uint32_t current;                               /* index of the buffer readers get */
+    uint32_t version;
+};
+
+int snapshot_init(struct snapshot_pub *pub, const struct ubnt_spectral_info *usi);
+void snapshot_free(struct snapshot_pub *pub);
+int snapshot_publish(struct snapshot_pub *pub, const struct ubnt_spectral_info *usi,
+                     const struct occupancy *occupancy, bool scanning, bool wait);
+struct spectrum_snapshot *snapshot_acquire(struct snapshot_pub *pub);
+void snapshot_release(struct snapshot_pub *pub, const struct spectrum_snapshot *snap);
+
+#endif //SNAPSHOT_H
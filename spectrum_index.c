@@ -0,0 +1,167 @@
+/*
+ * Ubiquiti RF Environment tool - per-MHz spectrum index
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ubnt.h"
+#include "spectrum_index.h"
+
+static int log2_floor(uint32_t v)
+{
+    int l = 0;
+
+    while (v >>= 1)
+        l++;
+    return l;
+}
+
+int spectrum_index_init(struct spectrum_index *idx, uint16_t width)
+{
+    int l;
+
+    memset(idx, 0, sizeof(*idx));
+    idx->width = width;
+
+    idx->pwr_sum = (int64_t *)calloc(width, sizeof(int64_t));
+    idx->samples = (uint32_t *)calloc(width, sizeof(uint32_t));
+    idx->utilization = (uint8_t *)calloc(width, sizeof(uint8_t));
+    /* prefix arrays carry one leading zero entry */
+    idx->pwr_prefix = (int64_t *)calloc(width + 1, sizeof(int64_t));
+    idx->samples_prefix = (uint64_t *)calloc(width + 1, sizeof(uint64_t));
+    if (!idx->pwr_sum || !idx->samples || !idx->utilization || !idx->pwr_prefix || !idx->samples_prefix)
+        goto fail;
+
+    for (l = 0; l < SPECTRUM_INDEX_LEVELS && (1U << l) <= width; l++) {
+        idx->util_max[l] = (uint8_t *)calloc(width, sizeof(uint8_t));
+        if (!idx->util_max[l])
+            goto fail;
+    }
+
+    return 0;
+
+fail:
+    error(MODULE, "UOH, not enough memory!!!");
+    spectrum_index_free(idx);
+    return -1;
+}
+
+void spectrum_index_free(struct spectrum_index *idx)
+{
+    int l;
+
+    free(idx->pwr_sum);
+    free(idx->samples);
+    free(idx->utilization);
+    free(idx->pwr_prefix);
+    free(idx->samples_prefix);
+    for (l = 0; l < SPECTRUM_INDEX_LEVELS; l++)
+        free(idx->util_max[l]);
+    memset(idx, 0, sizeof(*idx));
+}
+
+/* drop the accumulated data of bins [start, end) */
+void spectrum_index_reset(struct spectrum_index *idx, uint16_t start, uint16_t end)
+{
+    if (end > idx->width)
+        end = idx->width;
+    if (start >= end)
+        return;
+
+    memset(&idx->pwr_sum[start], 0, (end - start) * sizeof(int64_t));
+    memset(&idx->samples[start], 0, (end - start) * sizeof(uint32_t));
+    memset(&idx->utilization[start], 0, (end - start) * sizeof(uint8_t));
+    idx->built = false;
+}
+
+/* scale the accumulated data by weight (0..1), to age it */
+void spectrum_index_scale(struct spectrum_index *idx, double weight)
+{
+    uint32_t i;
+
+    for (i = 0; i < idx->width; i++) {
+        idx->pwr_sum[i] = (int64_t)(idx->pwr_sum[i] * weight);
+        idx->samples[i] = (uint32_t)(idx->samples[i] * weight);
+        idx->utilization[i] = (uint8_t)(idx->utilization[i] * weight);
+    }
+    idx->built = false;
+}
+
+/* add the data of src, an index of the same width */
+void spectrum_index_merge(struct spectrum_index *idx, const struct spectrum_index *src)
+{
+    uint32_t i;
+
+    for (i = 0; i < idx->width && i < src->width; i++) {
+        idx->pwr_sum[i] += src->pwr_sum[i];
+        idx->samples[i] += src->samples[i];
+        if (src->utilization[i] > idx->utilization[i])
+            idx->utilization[i] = src->utilization[i];
+    }
+    idx->built = false;
+}
+
+void spectrum_index_add(struct spectrum_index *idx, uint16_t bin, int16_t pwr)
+{
+    if (bin >= idx->width)
+        return;
+
+    idx->pwr_sum[bin] += pwr;
+    idx->samples[bin]++;
+    idx->built = false;
+}
+
+void spectrum_index_set_utilization(struct spectrum_index *idx, uint16_t start, uint16_t end, uint8_t utilization)
+{
+    if (end > idx->width)
+        end = idx->width;
+    if (start >= end)
+        return;
+
+    memset(&idx->utilization[start], utilization, end - start);
+    idx->built = false;
+}
+
+void spectrum_index_build(struct spectrum_index *idx)
+{
+    uint32_t i;
+    int l;
+
+    for (i = 0; i < idx->width; i++) {
+        idx->pwr_prefix[i + 1] = idx->pwr_prefix[i] + idx->pwr_sum[i];
+        idx->samples_prefix[i + 1] = idx->samples_prefix[i] + idx->samples[i];
+    }
+
+    if (idx->width)
+        memcpy(idx->util_max[0], idx->utilization, idx->width);
+    for (l = 1; l < SPECTRUM_INDEX_LEVELS && idx->util_max[l]; l++) {
+        for (i = 0; i + (1U << l) <= idx->width; i++)
+            idx->util_max[l][i] = MAX(idx->util_max[l - 1][i], idx->util_max[l - 1][i + (1U << (l - 1))]);
+    }
+
+    idx->built = true;
+}
+
+static uint8_t spectrum_index_util_max(const struct spectrum_index *idx, uint16_t start, uint16_t end)
+{
+    int l = log2_floor(end - start);
+
+    return MAX(idx->util_max[l][start], idx->util_max[l][end - (1U << l)]);
+}
+
+/* statistics of bins [start, end) */
+int spectrum_index_query(const struct spectrum_index *idx, uint16_t start, uint16_t end,
+                         struct spectrum_range_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (!idx->built || end > idx->width || start >= end)
+        return -1;
+
+    stats->samples = idx->samples_prefix[end] - idx->samples_prefix[start];
+    if (stats->samples)
+        stats->avg_pwr = (idx->pwr_prefix[end] - idx->pwr_prefix[start]) / (int64_t)stats->samples;
+    stats->utilization = spectrum_index_util_max(idx, start, end);
+
+    return 0;
+}
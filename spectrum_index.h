@@ -0,0 +1,46 @@
+#ifndef SPECTRUM_INDEX_H
+#define SPECTRUM_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Full-band per-MHz power/utilization arrays stitched from the 20 MHz
+ * captures. spectrum_index_build() turns them into cumulative indexes so
+ * that the statistics of any frequency range (a bonded channel) are O(1)
+ * queries.
+ */
+
+/* enough sparse table levels for 2^11 MHz of spectrum */
+#define SPECTRUM_INDEX_LEVELS 11
+
+struct spectrum_index {
+    uint16_t width;                                 /* MHz covered, bin 0 is the band start */
+    int64_t  *pwr_sum;                              /* per-MHz sum of bin power */
+    uint32_t *samples;                              /* per-MHz number of bins */
+    uint8_t  *utilization;                          /* per-MHz channel utilization */
+    /* cumulative indexes, valid after spectrum_index_build() */
+    int64_t  *pwr_prefix;
+    uint64_t *samples_prefix;
+    uint8_t  *util_max[SPECTRUM_INDEX_LEVELS];      /* sparse table for range max */
+    bool     built;
+};
+
+struct spectrum_range_stats {
+    uint64_t samples;
+    int16_t  avg_pwr;                               /* mean bin power, histogram units */
+    uint8_t  utilization;                           /* max channel utilization */
+};
+
+int spectrum_index_init(struct spectrum_index *idx, uint16_t width);
+void spectrum_index_free(struct spectrum_index *idx);
+void spectrum_index_reset(struct spectrum_index *idx, uint16_t start, uint16_t end);
+void spectrum_index_scale(struct spectrum_index *idx, double weight);
+void spectrum_index_merge(struct spectrum_index *idx, const struct spectrum_index *src);
+void spectrum_index_add(struct spectrum_index *idx, uint16_t bin, int16_t pwr);
+void spectrum_index_set_utilization(struct spectrum_index *idx, uint16_t start, uint16_t end, uint8_t utilization);
+void spectrum_index_build(struct spectrum_index *idx);
+int spectrum_index_query(const struct spectrum_index *idx, uint16_t start, uint16_t end,
+                         struct spectrum_range_stats *stats);
+
+#endif //SPECTRUM_INDEX_H
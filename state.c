@@ -0,0 +1,172 @@
+/*
+ * Ubiquiti RF Environment tool - persistent scan statistics
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state.h"
+#include "rssi_sketch.h"
+#include "spectrum_index.h"
+#include "occupancy.h"
+
+static int state_write_index(FILE *fp, const struct spectrum_index *idx)
+{
+    if (fwrite(idx->pwr_sum, sizeof(int64_t), idx->width, fp) != idx->width ||
+        fwrite(idx->samples, sizeof(uint32_t), idx->width, fp) != idx->width ||
+        fwrite(idx->utilization, sizeof(uint8_t), idx->width, fp) != idx->width)
+        return -1;
+    return 0;
+}
+
+static int state_read_index(FILE *fp, struct spectrum_index *idx)
+{
+    if (fread(idx->pwr_sum, sizeof(int64_t), idx->width, fp) != idx->width ||
+        fread(idx->samples, sizeof(uint32_t), idx->width, fp) != idx->width ||
+        fread(idx->utilization, sizeof(uint8_t), idx->width, fp) != idx->width)
+        return -1;
+    idx->built = false;
+    return 0;
+}
+
+int state_save(const char *ifname, enum nl80211_band band_5g)
+{
+    char fname[FILE_NAME_LEN], ftemp[FILE_NAME_LEN];
+    struct ubnt_radio *r = ubnt_get_radio();
+    struct state_header hdr;
+    struct state_channel rec;
+    FILE *fp;
+    int i, ret = 0;
+
+    if (!r->usi.table || !r->usi.rssi_histograms)
+        return -1;
+
+    snprintf(fname, sizeof(fname), STATE_FILE_FMT, ifname);
+    snprintf(ftemp, sizeof(ftemp), STATE_FILE_FMT ".temp", ifname);
+    fp = fopen(ftemp, "w");
+    if (!fp) {
+        error(MODULE, "%s: failed to open %s\n", __func__, ftemp);
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = STATE_MAGIC;
+    hdr.version = STATE_VERSION;
+    hdr.band_5g = band_5g;
+    hdr.count = r->usi.count;
+    hdr.width = r->usi.width;
+    hdr.histogram_size = UBNT_RSSI_HISTOGRAM_SIZE;
+    hdr.sketch_size = RSSI_SKETCH_SIZE;
+    hdr.saved = ubnt_uptime();
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        ret = -1;
+
+    for (i = 0; !ret && i < r->usi.count; i++) {
+        struct ubnt_spectral_stats *uss = &r->usi.table[i];
+
+        memset(&rec, 0, sizeof(rec));
+        rec.channel = uss->channel;
+        rec.chan_width = uss->chan_width;
+        rec.utilization = uss->utilization;
+        rec.freq_center = uss->freq_center;
+        rec.interference = uss->interference;
+        rec.total_samples = uss->total_samples;
+        rec.scanned = r->chan_scanned[i];
+        memcpy(rec.rssi_histogram, uss->rssi_histogram, sizeof(rec.rssi_histogram));
+        memcpy(rec.normalized_rssi_histogram, uss->normalized_rssi_histogram, sizeof(rec.normalized_rssi_histogram));
+        if (fwrite(&rec, sizeof(rec), 1, fp) != 1 ||
+            fwrite(&r->chan_sketches[i], sizeof(struct rssi_sketch), 1, fp) != 1 ||
+            fwrite(&r->occupancy[i], sizeof(struct occupancy), 1, fp) != 1)
+            ret = -1;
+    }
+
+    /* the per-MHz histograms are a single allocation */
+    if (!ret &&
+        (fwrite(r->usi.rssi_histograms_counts, sizeof(uint32_t), hdr.width, fp) != hdr.width ||
+         fwrite(r->usi.rssi_histograms[0], sizeof(uint32_t) * UBNT_RSSI_HISTOGRAM_SIZE, hdr.width, fp) != hdr.width ||
+         fwrite(r->mhz_sketches, sizeof(struct rssi_sketch), hdr.width, fp) != hdr.width ||
+         state_write_index(fp, &r->index)))
+        ret = -1;
+
+    if (fclose(fp) || ret) {
+        error(MODULE, "%s: failed to write %s\n", __func__, ftemp);
+        unlink(ftemp);
+        return -1;
+    }
+    rename(ftemp, fname);
+    debug(MODULE, "%s: saved %d channels to %s\n", __func__, hdr.count, fname);
+
+    return 0;
+}
+
+/*
+ * Load the statistics saved by a previous run into the freshly initialized
+ * usi, if it was taken with the same band and channel list. saved gets the
+ * uptime they were saved at.
+ */
+int state_load(const char *ifname, enum nl80211_band band_5g, uint32_t *saved)
+{
+    char fname[FILE_NAME_LEN];
+    struct ubnt_radio *r = ubnt_get_radio();
+    struct state_header hdr;
+    struct state_channel rec;
+    FILE *fp;
+    int i;
+
+    if (!r->usi.table || !r->usi.rssi_histograms)
+        return -1;
+
+    snprintf(fname, sizeof(fname), STATE_FILE_FMT, ifname);
+    fp = fopen(fname, "r");
+    if (!fp) {
+        info(MODULE, "%s: no previous state %s\n", __func__, fname);
+        return -1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        hdr.magic != STATE_MAGIC || hdr.version != STATE_VERSION ||
+        hdr.band_5g != band_5g || hdr.count != r->usi.count || hdr.width != r->usi.width ||
+        hdr.histogram_size != UBNT_RSSI_HISTOGRAM_SIZE || hdr.sketch_size != RSSI_SKETCH_SIZE) {
+        warn(MODULE, "%s: %s does not match the current scan, ignored\n", __func__, fname);
+        goto fail;
+    }
+
+    for (i = 0; i < r->usi.count; i++) {
+        struct ubnt_spectral_stats *uss = &r->usi.table[i];
+
+        if (fread(&rec, sizeof(rec), 1, fp) != 1 ||
+            fread(&r->chan_sketches[i], sizeof(struct rssi_sketch), 1, fp) != 1 ||
+            fread(&r->occupancy[i], sizeof(struct occupancy), 1, fp) != 1)
+            goto fail;
+        if (rec.channel != uss->channel || rec.chan_width != uss->chan_width ||
+            rec.freq_center != uss->freq_center) {
+            warn(MODULE, "%s: channel list changed (%d/%d != %d/%d), ignored\n", __func__,
+                 rec.channel, rec.chan_width, uss->channel, uss->chan_width);
+            goto fail;
+        }
+        uss->utilization = rec.utilization;
+        uss->interference = rec.interference;
+        uss->total_samples = rec.total_samples;
+        r->chan_scanned[i] = rec.scanned;
+        memcpy(uss->rssi_histogram, rec.rssi_histogram, sizeof(rec.rssi_histogram));
+        memcpy(uss->normalized_rssi_histogram, rec.normalized_rssi_histogram, sizeof(rec.normalized_rssi_histogram));
+    }
+
+    if (fread(r->usi.rssi_histograms_counts, sizeof(uint32_t), hdr.width, fp) != hdr.width ||
+        fread(r->usi.rssi_histograms[0], sizeof(uint32_t) * UBNT_RSSI_HISTOGRAM_SIZE, hdr.width, fp) != hdr.width ||
+        fread(r->mhz_sketches, sizeof(struct rssi_sketch), hdr.width, fp) != hdr.width ||
+        state_read_index(fp, &r->index))
+        goto fail;
+
+    fclose(fp);
+    *saved = hdr.saved;
+    info(MODULE, "%s: loaded %d channels from %s\n", __func__, hdr.count, fname);
+    return 0;
+
+fail:
+    fclose(fp);
+    /* never keep a half loaded state */
+    ubnt_clear_scan_data();
+    return -1;
+}
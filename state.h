@@ -0,0 +1,44 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "ubnt.h"
+
+/*
+ * Binary snapshot of the accumulated scan statistics (usi table, channel
+ * occupancy, per-MHz histograms, sketches and spectrum index) kept between
+ * runs.
+ */
+
+#define STATE_FILE_FMT  "/var/run/rftable_%s.state"
+#define STATE_MAGIC     0x54534652  /* "RFST" */
+#define STATE_VERSION   3           /* 2 - channel occupancy, 3 - no per-MHz occupied counts */
+
+struct state_header {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t  band_5g;
+    uint8_t  reserved;
+    uint16_t count;                 /* usi.count */
+    uint16_t width;                 /* usi.width */
+    uint16_t histogram_size;        /* UBNT_RSSI_HISTOGRAM_SIZE */
+    uint16_t sketch_size;           /* RSSI_SKETCH_SIZE */
+    uint32_t saved;                 /* uptime */
+};
+
+/* per usi.table entry, followed by its sketch and its occupancy */
+struct state_channel {
+    uint16_t channel;
+    uint8_t  chan_width;
+    uint8_t  utilization;
+    uint16_t freq_center;
+    int16_t  interference;
+    uint32_t total_samples;
+    uint32_t scanned;
+    uint32_t rssi_histogram[UBNT_RSSI_HISTOGRAM_SIZE];
+    uint32_t normalized_rssi_histogram[UBNT_RSSI_HISTOGRAM_SIZE];
+};
+
+int state_save(const char *ifname, enum nl80211_band band_5g);
+int state_load(const char *ifname, enum nl80211_band band_5g, uint32_t *saved);
+
+#endif //STATE_H
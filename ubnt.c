@@ -10,22 +10,51 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <sys/sysinfo.h>
 
 #include "ubnt.h"
 #include "fft_proc.h"
 #include "mt_spectr.h"
+#include "rssi_sketch.h"
+#include "spectrum_index.h"
+#include "occupancy.h"
 
 /* static var */
-static struct ubnt_spectral_info usi;
+static struct ubnt_radio default_radio;
+/* the radio the calling thread works on, see ubnt_select_radio() */
+static __thread struct ubnt_radio *radio = &default_radio;
 
 struct ubnt_spectral_info *get_usi_p(void) {
-    return &usi;
+    return &radio->usi;
+}
+
+struct ubnt_radio *ubnt_get_radio(void)
+{
+    return radio;
+}
+
+/*
+ * Bind the calling thread to a radio, NULL selects the default one.
+ * All ubnt_* calls of the thread then work on its statistics.
+ */
+void ubnt_select_radio(struct ubnt_radio *r)
+{
+    radio = r ? r : &default_radio;
+}
+
+uint32_t ubnt_uptime(void)
+{
+    struct sysinfo si;
+
+    if (sysinfo(&si))
+        return 0;
+    return si.uptime;
 }
 
 /* Perform json output */
 json_t* prepare_spectrum_table(void)
 {
-    return prepare_spectrum_table_usi(&usi);
+    return prepare_spectrum_table_usi(&radio->usi);
 }
 
 int ieee80211_channel_to_frequency(int chan, enum nl80211_band band)
@@ -59,42 +88,47 @@ int ieee80211_channel_to_frequency(int chan, enum nl80211_band band)
     return 0; /* not supported */
 }
 
+/* map a frequency to its per-MHz spectrum bin, -1 when outside of our range */
+static int ubnt_freq_to_bin(uint32_t freq)
+{
+    int bin;
+
+    if (freq >= UBNT_RSSI_SPECTRUM_START_5G) {
+        bin = freq - UBNT_RSSI_SPECTRUM_START_5G;
+    } else {
+        bin = freq - UBNT_RSSI_SPECTRUM_START_2G;
+    }
+    if ((bin < 0) || (bin >= radio->usi.width))
+        return -1;
+    return bin;
+}
+
 int ubnt_get_best_channels(const char* radio_ifname, struct channel_bw *best_channels, int num_best_channels)
 {
-    return get_best_channels(&usi, radio_ifname, best_channels, num_best_channels);
+    return get_best_channels(&radio->usi, radio_ifname, best_channels, num_best_channels);
 }
 
-void ubnt_calculate_interference(struct ubnt_spectral_stats *uss)
+void ubnt_calculate_interference(struct ubnt_spectral_stats *uss, const struct rssi_sketch *sk)
 {
-    int i;
+    int rssi;
 
-    if (!uss->total_samples) {
+    if (!uss->total_samples || !sk->total) {
         uss->interference += UBNT_HISTOGRAM_START_DBM + 3 * uss->chan_width;
         return;
     }
 
-    uint32_t wifi_samples = 0;
-    for (i = 0; i < UBNT_RSSI_HISTOGRAM_SIZE; i++) {
-        wifi_samples += uss->normalized_rssi_histogram[i];
-        if (wifi_samples >=
-                UBNT_INTERFERENCE_POWER_PERCENTILE) {
-            break;
-        }
-    }
-    /* we want to count upto the bin just short of the
-       required area under the power spectral density
-       function. when we break out of the for loop above,
-       i points to the bin that caused the area to exceed
-       the specified percentile. so, i - 1 would point to
-       the bin we are interested in except when i is 0.
+    /* we want the rssi just short of the required area under the power
+       spectral density function, so step back from the value that reaches
+       the specified percentile (keeping the lowest reportable value at 1).
      */
-    uss->interference = (i) ? (((i - 1) * 2) + 1) : 1;
+    rssi = rssi_sketch_quantile(sk, UBNT_INTERFERENCE_POWER_PERCENTILE);
+    uss->interference = (rssi > 1) ? (rssi - 1) : 1;
     /* convert interference based on RSSI to dBm based on noise-floor */
     uss->interference = ubnt_convert_to_dbm(uss->interference, uss->chan_width);
 #if UBNT_WIFI_DBG
-    printf("interference %d, chan %d, bw %d, wifi_samples %u, "
+    printf("interference %d, chan %d, bw %d, percentile rssi %d, "
             "total_samples %u\n", uss->interference, uss->channel,
-            uss->chan_width, wifi_samples, uss->total_samples);
+            uss->chan_width, rssi, uss->total_samples);
 #endif
 }
 
@@ -114,14 +148,12 @@ void ubnt_normalize_rssi_histogram(struct ubnt_spectral_stats *uss)
 void ubnt_process_channel_data(uint16_t channel, uint8_t bw)
 {
     uint16_t i;
-    for (i = 0; i < usi.count; i++) {
-        struct ubnt_spectral_stats *uss = &usi.table[i];
+    for (i = 0; i < radio->usi.count; i++) {
+        struct ubnt_spectral_stats *uss = &radio->usi.table[i];
         if ((channel == uss->channel) && (bw == uss->chan_width)) {
 
             ubnt_normalize_rssi_histogram(uss);
-
-            // note that this calculation depends on the normalized histogram.
-            ubnt_calculate_interference(uss);
+            ubnt_calculate_interference(uss, &radio->chan_sketches[i]);
         }
     }
 }
@@ -129,15 +161,378 @@ void ubnt_process_channel_data(uint16_t channel, uint8_t bw)
 void ubnt_set_channel_utilization(uint16_t channel, uint8_t bw, uint8_t utilization)
 {
     uint16_t i;
-    for (i = 0; i < usi.count; i++) {
-        struct ubnt_spectral_stats *uss = &usi.table[i];
+    for (i = 0; i < radio->usi.count; i++) {
+        struct ubnt_spectral_stats *uss = &radio->usi.table[i];
         if ((channel == uss->channel) && (bw == uss->chan_width)) {
             debug(MODULE, "%s: ch:%d bw:%d cu:%d\n", __func__, channel, bw, utilization);
             uss->utilization = utilization;
+            if (bw == BW_20) {
+                int bin = ubnt_freq_to_bin(uss->freq_center - 10);
+                if (bin >= 0)
+                    spectrum_index_set_utilization(&radio->index, bin, bin + 20, utilization);
+            }
         }
     }
 }
 
+struct ubnt_spectral_stats *ubnt_get_channel_stats(uint16_t channel, uint8_t bw)
+{
+    uint16_t i;
+
+    for (i = 0; i < radio->usi.count; i++) {
+        if ((channel == radio->usi.table[i].channel) && (bw == radio->usi.table[i].chan_width))
+            return &radio->usi.table[i];
+    }
+    return NULL;
+}
+
+/*
+ * Percentile of the channel RSSI distribution converted to dBm,
+ * or the histogram floor when nothing was sampled.
+ */
+int ubnt_get_channel_percentile(uint16_t channel, uint8_t bw, double percentile)
+{
+    uint16_t i;
+    int rssi;
+
+    for (i = 0; i < radio->usi.count; i++) {
+        if ((channel == radio->usi.table[i].channel) && (bw == radio->usi.table[i].chan_width)) {
+            rssi = rssi_sketch_quantile(&radio->chan_sketches[i], percentile);
+            if (rssi < 0)
+                break;
+            return ubnt_convert_to_dbm(rssi, bw);
+        }
+    }
+    return UBNT_HISTOGRAM_START_DBM + 3 * bw;
+}
+
+/*
+ * Percentile of the per-MHz bin power at freq_mhz, -1 if the frequency
+ * is outside of the spectrum or has no samples.
+ */
+int ubnt_get_mhz_percentile(uint16_t freq_mhz, double percentile)
+{
+    int bin = ubnt_freq_to_bin(freq_mhz);
+
+    if ((bin < 0) || !radio->mhz_sketches)
+        return -1;
+
+    return rssi_sketch_quantile(&radio->mhz_sketches[bin], percentile);
+}
+
+struct rssi_sketch *ubnt_get_channel_sketch(uint16_t channel, uint8_t bw)
+{
+    uint16_t i;
+
+    for (i = 0; i < radio->usi.count; i++) {
+        if ((channel == radio->usi.table[i].channel) && (bw == radio->usi.table[i].chan_width))
+            return &radio->chan_sketches[i];
+    }
+    return NULL;
+}
+
+/* of a 20 MHz channel, see process_occupancy_data() */
+struct occupancy *ubnt_get_channel_occupancy(uint16_t channel)
+{
+    struct ubnt_spectral_stats *uss = ubnt_get_channel_stats(channel, BW_20);
+
+    return uss ? &radio->occupancy[uss - radio->usi.table] : NULL;
+}
+
+struct rssi_sketch *ubnt_get_mhz_sketches(void)
+{
+    return radio->mhz_sketches;
+}
+
+void ubnt_mark_channel_scanned(uint16_t channel)
+{
+    struct ubnt_spectral_stats *uss = ubnt_get_channel_stats(channel, BW_20);
+
+    if (uss)
+        radio->chan_scanned[uss - radio->usi.table] = MAX(ubnt_uptime(), 1);
+}
+
+/* seconds since the channel was last scanned, UINT32_MAX if never */
+uint32_t ubnt_get_channel_age(uint16_t channel)
+{
+    struct ubnt_spectral_stats *uss = ubnt_get_channel_stats(channel, BW_20);
+    uint32_t now = ubnt_uptime(), scanned;
+
+    if (!uss || !(scanned = radio->chan_scanned[uss - radio->usi.table]))
+        return UINT32_MAX;
+    /* uptime restarts with the AP */
+    return (now >= scanned) ? (now - scanned) : UINT32_MAX;
+}
+
+/* drop all accumulated statistics, keeping the channel list */
+void ubnt_clear_scan_data(void)
+{
+    int i;
+
+    for (i = 0; i < radio->usi.count; i++) {
+        struct ubnt_spectral_stats *uss = &radio->usi.table[i];
+        uint16_t channel = uss->channel, freq_center = uss->freq_center;
+        uint8_t chan_width = uss->chan_width;
+
+        memset(uss, 0, sizeof(*uss));
+        uss->channel = channel;
+        uss->chan_width = chan_width;
+        uss->freq_center = freq_center;
+        rssi_sketch_reset(&radio->chan_sketches[i]);
+        occupancy_reset(&radio->occupancy[i]);
+        radio->chan_scanned[i] = 0;
+    }
+    memset(radio->usi.rssi_histograms_counts, 0, radio->usi.width * sizeof(uint32_t));
+    memset(radio->usi.rssi_histograms[0], 0, UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t) * radio->usi.width);
+    memset(radio->mhz_sketches, 0, radio->usi.width * sizeof(struct rssi_sketch));
+    spectrum_index_reset(&radio->index, 0, radio->usi.width);
+}
+
+/*
+ * Age everything accumulated so far: counts are scaled by weight (0..1)
+ * so that new captures outweigh old ones. Utilization is scaled too, as
+ * new readings are merged into it with MAX. Derived values are redone
+ * when a channel is processed again.
+ */
+void ubnt_age_scan_data(double weight)
+{
+    int i, j;
+
+    for (i = 0; i < radio->usi.count; i++) {
+        struct ubnt_spectral_stats *uss = &radio->usi.table[i];
+
+        uss->total_samples = 0;
+        for (j = 0; j < UBNT_RSSI_HISTOGRAM_SIZE; j++) {
+            uss->rssi_histogram[j] = (uint32_t)(uss->rssi_histogram[j] * weight);
+            uss->total_samples += uss->rssi_histogram[j];
+        }
+        uss->utilization = (uint8_t)(uss->utilization * weight);
+        rssi_sketch_scale(&radio->chan_sketches[i], weight);
+        occupancy_scale(&radio->occupancy[i], weight);
+    }
+    for (i = 0; i < radio->usi.width; i++) {
+        radio->usi.rssi_histograms_counts[i] = 0;
+        for (j = 0; j < UBNT_RSSI_HISTOGRAM_SIZE; j++) {
+            radio->usi.rssi_histograms[i][j] = (uint32_t)(radio->usi.rssi_histograms[i][j] * weight);
+            radio->usi.rssi_histograms_counts[i] += radio->usi.rssi_histograms[i][j];
+        }
+        rssi_sketch_scale(&radio->mhz_sketches[i], weight);
+    }
+    spectrum_index_scale(&radio->index, weight);
+}
+
+/*
+ * Add the statistics of src, a radio of the same channel list and band,
+ * to the selected one. Derived values are redone when the channels are
+ * processed.
+ */
+void ubnt_merge_radio(const struct ubnt_radio *src)
+{
+    uint64_t total;
+    int i, j;
+
+    for (i = 0; i < radio->usi.count && i < src->usi.count; i++) {
+        struct ubnt_spectral_stats *uss = &radio->usi.table[i];
+
+        total = (uint64_t)uss->total_samples + src->usi.table[i].total_samples;
+        for (j = 0; j < UBNT_RSSI_HISTOGRAM_SIZE; j++)
+            uss->rssi_histogram[j] += src->usi.table[i].rssi_histogram[j];
+        /* as in ubnt_process_spectral_data(), halve before overflowing */
+        while (total >= UINT_MAX) {
+            for (j = 0; j < UBNT_RSSI_HISTOGRAM_SIZE; j++)
+                uss->rssi_histogram[j] >>= 1;
+            total >>= 1;
+        }
+        uss->total_samples = total;
+        rssi_sketch_merge(&radio->chan_sketches[i], &src->chan_sketches[i]);
+        occupancy_merge(&radio->occupancy[i], &src->occupancy[i]);
+        radio->chan_scanned[i] = MAX(radio->chan_scanned[i], src->chan_scanned[i]);
+    }
+    for (i = 0; i < radio->usi.width && i < src->usi.width; i++) {
+        radio->usi.rssi_histograms_counts[i] += src->usi.rssi_histograms_counts[i];
+        for (j = 0; j < UBNT_RSSI_HISTOGRAM_SIZE; j++)
+            radio->usi.rssi_histograms[i][j] += src->usi.rssi_histograms[i][j];
+        rssi_sketch_merge(&radio->mhz_sketches[i], &src->mhz_sketches[i]);
+    }
+    spectrum_index_merge(&radio->index, &src->index);
+}
+
+/*
+ * Publish the current usi to the readers of the radio's snapshots,
+ * see snapshot_publish().
+ */
+int ubnt_publish_snapshot(bool scanning, bool wait)
+{
+    return snapshot_publish(&radio->snap, &radio->usi, radio->occupancy, scanning, wait);
+}
+
+/*
+ * Drop everything accumulated for a 20 MHz channel (the channel entry and
+ * the per-MHz data under it) before it is rescanned. On 2.4G the MHz bins
+ * are shared with the overlapping channels: their part of those bins goes
+ * as well, their own channel entries and sketches are left as they are.
+ */
+void ubnt_reset_channel(uint16_t channel)
+{
+    struct ubnt_spectral_stats *uss = ubnt_get_channel_stats(channel, BW_20);
+    int i, bin;
+
+    if (!uss)
+        return;
+
+    memset(uss->rssi_histogram, 0, sizeof(uss->rssi_histogram));
+    memset(uss->normalized_rssi_histogram, 0, sizeof(uss->normalized_rssi_histogram));
+    uss->total_samples = 0;
+    uss->interference = 0;
+    uss->utilization = 0;
+    rssi_sketch_reset(&radio->chan_sketches[uss - radio->usi.table]);
+    occupancy_reset(&radio->occupancy[uss - radio->usi.table]);
+    radio->chan_scanned[uss - radio->usi.table] = 0;
+
+    for (i = 0; i < 20; i++) {
+        if ((bin = ubnt_freq_to_bin(uss->freq_center - 10 + i)) < 0)
+            continue;
+        radio->usi.rssi_histograms_counts[bin] = 0;
+        memset(radio->usi.rssi_histograms[bin], 0, UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t));
+        rssi_sketch_reset(&radio->mhz_sketches[bin]);
+        spectrum_index_reset(&radio->index, bin, bin + 1);
+    }
+}
+
+/*
+ * Frequency range [start, end) of a bonded channel. 5G bonding blocks are
+ * aligned to 5170 MHz (ch 36), or to 5735 MHz (ch 149) in UNII-3 up to
+ * 5815 MHz (ch 161); 160 MHz only spans 36-64 and 100-128. 2.4G has no
+ * fixed blocks, so a channel keeps its own 20 MHz. Returns -1 for the
+ * blocks that do not exist, e.g. 160 MHz on 132-144 or 40 MHz on 165.
+ */
+int ubnt_bonded_range(uint16_t freq_center, uint8_t bw, enum nl80211_band band_5g,
+                      uint16_t *start, uint16_t *end)
+{
+    uint16_t width = 20 << bw;
+    uint16_t base = (freq_center >= 5745) ? 5735 : 5170;
+
+    if (!band_5g || bw == BW_20) {
+        *start = freq_center - 10;
+        *end = freq_center + 10;
+        return 0;
+    }
+    if (freq_center < base + 10)
+        return -1;
+
+    *start = base + ((freq_center - 10 - base) / width) * width;
+    *end = *start + width;
+    if (base == 5735 ? *end > 5815 : *end > 5735)
+        return -1;
+    if (bw == BW_160 && *start != 5170 && *start != 5490)
+        return -1;
+    return 0;
+}
+
+int ubnt_get_range_stats(uint16_t channel, uint8_t bw, enum nl80211_band band_5g,
+                         struct spectrum_range_stats *stats)
+{
+    uint16_t start, end;
+    int bin;
+
+    if (ubnt_bonded_range(ieee80211_channel_to_frequency(channel, band_5g), bw, band_5g, &start, &end))
+        return -1;
+    if ((bin = ubnt_freq_to_bin(start)) < 0)
+        return -1;
+
+    return spectrum_index_query(&radio->index, bin, bin + (end - start), stats);
+}
+
+/*
+ * Derive the 40/80/160 MHz entries from the 20 MHz ones: utilization is a
+ * range query over the spectrum index, RSSI histograms and sketches are the
+ * sum of the 20 MHz channels inside the bonded range.
+ */
+void ubnt_process_bonded_channels(enum nl80211_band band_5g)
+{
+    struct spectrum_range_stats stats;
+    uint16_t i, j, start, end;
+    int k, bin;
+
+    spectrum_index_build(&radio->index);
+
+    for (i = 0; i < radio->usi.count; i++) {
+        struct ubnt_spectral_stats *uss = &radio->usi.table[i];
+
+        if (uss->chan_width == BW_20)
+            continue;
+        if (ubnt_bonded_range(uss->freq_center, uss->chan_width, band_5g, &start, &end))
+            continue;
+
+        memset(uss->rssi_histogram, 0, sizeof(uss->rssi_histogram));
+        uss->total_samples = 0;
+        uss->interference = 0;
+        uss->utilization = 0;
+        rssi_sketch_reset(&radio->chan_sketches[i]);
+
+        for (j = 0; j < radio->usi.count; j++) {
+            struct ubnt_spectral_stats *member = &radio->usi.table[j];
+
+            if (member->chan_width != BW_20 || !member->channel ||
+                member->freq_center - 10 < start || member->freq_center + 10 > end)
+                continue;
+            for (k = 0; k < UBNT_RSSI_HISTOGRAM_SIZE; k++)
+                uss->rssi_histogram[k] += member->rssi_histogram[k];
+            uss->total_samples += member->total_samples;
+            rssi_sketch_merge(&radio->chan_sketches[i], &radio->chan_sketches[j]);
+            /* 2.4G channels overlap, their utilization is taken as is */
+            if (!band_5g)
+                uss->utilization = MAX(uss->utilization, member->utilization);
+        }
+
+        bin = ubnt_freq_to_bin(start);
+        if (band_5g && bin >= 0 &&
+            !spectrum_index_query(&radio->index, bin, bin + (end - start), &stats)) {
+            uss->utilization = stats.utilization;
+            debug(MODULE, "%s: ch:%d bw:%d [%u-%u] cu:%d pwr:%d\n", __func__,
+                  uss->channel, uss->chan_width, start, end, stats.utilization, stats.avg_pwr);
+        }
+
+        ubnt_normalize_rssi_histogram(uss);
+        ubnt_calculate_interference(uss, &radio->chan_sketches[i]);
+    }
+}
+
+/* list channels[] (20 MHz, pinfo->channels_in_bw of them) at all the bandwidths of the band */
+static void ubnt_expand_chan_list(mtk_ssd_info_t *pinfo, const uint8_t *channels, enum nl80211_band band_5g)
+{
+    uint8_t bw_num = BW_QTY(band_5g) + 1;
+    uint8_t i, j, bw;
+
+    for (j = 0, bw = 0; bw < bw_num; bw++) {
+        for (i = 0; i < pinfo->channels_in_bw; i++) {
+            // ignore the last channel (165) in 5G for 40 & 80 MHz
+            if (channels[i] == 165 /*channels[channels_in_bw-1]*/ && bw > 0 && band_5g)
+                continue;
+            pinfo->chan_list[j].channel = channels[i];
+            pinfo->chan_list[j].freq_center = ieee80211_channel_to_frequency(channels[i], band_5g);
+            pinfo->chan_list[j++].bw = bw;
+        }
+    }
+    pinfo->max_channels = j;
+}
+
+/* all the default channels of the band, without asking the radio */
+int ubnt_default_chan_list(mtk_ssd_info_t *pinfo, enum nl80211_band band_5g)
+{
+    uint8_t channels5G[] = DEF_5G_CHANNELS_20;
+    uint8_t channels2G[] = DEF_2G_CHANNEL_20;
+
+    pinfo->channels_in_bw = band_5g ? ARRAY_SIZE(channels5G) : ARRAY_SIZE(channels2G);
+    pinfo->chan_list = (struct chan_info *)malloc((BW_QTY(band_5g) + 1) * pinfo->channels_in_bw * sizeof(struct chan_info));
+    if (!pinfo->chan_list) {
+        error(MODULE, "UOH, not enough memory!!!");
+        return -1;
+    }
+    ubnt_expand_chan_list(pinfo, band_5g ? channels5G : channels2G, band_5g);
+    return 0;
+}
+
 int ubnt_populate_chan_list(char *interface, mtk_ssd_info_t *pinfo, enum nl80211_band band_5g)
 {
     // struct chan_info *chan_info_list = &pinfo->chan_list[0];
@@ -145,7 +540,7 @@ int ubnt_populate_chan_list(char *interface, mtk_ssd_info_t *pinfo, enum nl80211
     uint8_t channels5G[] = DEF_5G_CHANNELS_20;
     uint8_t channels2G[] = DEF_2G_CHANNEL_20;
     uint8_t *channels;
-    uint8_t i, j, bw;
+    uint8_t i, j;
 
 
     if (band_5g) {
@@ -188,17 +583,7 @@ int ubnt_populate_chan_list(char *interface, mtk_ssd_info_t *pinfo, enum nl80211
         printf("ch: %d\n", channels[i]);
     }
 
-    for (j = 0, bw = 0; bw < bw_num; bw++) {
-        for (i = 0; i < pinfo->channels_in_bw; i++) {
-            // ignore the last channel (165) in 5G for 40 & 80 MHz
-            if (channels[i] == 165 /*channels[channels_in_bw-1]*/ && bw > 0 && band_5g)
-                continue;
-            pinfo->chan_list[j].channel = channels[i];
-            pinfo->chan_list[j].freq_center = ieee80211_channel_to_frequency(channels[i], band_5g);
-            pinfo->chan_list[j++].bw = bw;
-        }
-    }
-    pinfo->max_channels = j;
+    ubnt_expand_chan_list(pinfo, channels, band_5g);
 
     return 0;
 }
@@ -208,11 +593,11 @@ int ubnt_populate_chan_list(char *interface, mtk_ssd_info_t *pinfo, enum nl80211
 //     int i;
 
 //     printf("%s - START!\n", __func__);
-//     for (i=0; i<usi.count; i++) {
+//     for (i=0; i<radio->usi.count; i++) {
 //         printf("!!!! Ch:%d,\tBW:%d,\tF:%d\n",
-//         usi.table[i].channel,
-//         usi.table[i].chan_width,
-//         usi.table[i].freq_center);
+//         radio->usi.table[i].channel,
+//         radio->usi.table[i].chan_width,
+//         radio->usi.table[i].freq_center);
 //     }
 // }
 
@@ -220,15 +605,22 @@ void ubnt_init(uint8_t max_channels, struct chan_info *chan_list, enum nl80211_b
 {
     int i;
 
-    usi.table = (struct ubnt_spectral_stats *)malloc(sizeof(struct ubnt_spectral_stats) * max_channels);
-    usi.count = max_channels;
-    memset(usi.table, 0, sizeof(struct ubnt_spectral_stats) * usi.count);
-    debug(MODULE, "max_channels: %d\n", usi.count);
+    radio->usi.table = (struct ubnt_spectral_stats *)malloc(sizeof(struct ubnt_spectral_stats) * max_channels);
+    radio->usi.count = max_channels;
+    memset(radio->usi.table, 0, sizeof(struct ubnt_spectral_stats) * radio->usi.count);
+    radio->chan_sketches = (struct rssi_sketch *)calloc(max_channels, sizeof(struct rssi_sketch));
+    radio->chan_scanned = (uint32_t *)calloc(max_channels, sizeof(uint32_t));
+    radio->occupancy = (struct occupancy *)calloc(max_channels, sizeof(struct occupancy));
+    if (radio->chan_sketches == NULL || radio->chan_scanned == NULL || radio->occupancy == NULL) {
+        error(MODULE, "UOH, not enough memory!!!");
+        return;
+    }
+    debug(MODULE, "max_channels: %d\n", radio->usi.count);
 
-    for (i = 0; i < usi.count; i++) {
-        usi.table[i].channel = chan_list[i].channel;
-        usi.table[i].chan_width = chan_list[i].bw;
-        usi.table[i].freq_center = chan_list[i].freq_center;
+    for (i = 0; i < radio->usi.count; i++) {
+        radio->usi.table[i].channel = chan_list[i].channel;
+        radio->usi.table[i].chan_width = chan_list[i].bw;
+        radio->usi.table[i].freq_center = chan_list[i].freq_center;
 #if UBNT_WIFI_DBG
         debug(MODULE, "channel %d, bw %d, center freq %d", chan_list[i].channel,
                 chan_list[i].bw, chan_list[i].freq_center);
@@ -236,50 +628,78 @@ void ubnt_init(uint8_t max_channels, struct chan_info *chan_list, enum nl80211_b
     }
     /* Initialize the spectral table */
     if (band_5g) {
-        usi.width = UBNT_RSSI_SPECTRUM_WIDTH_5G;
+        radio->usi.width = UBNT_RSSI_SPECTRUM_WIDTH_5G;
     } else {
-        usi.width = UBNT_RSSI_SPECTRUM_WIDTH_2G;
+        radio->usi.width = UBNT_RSSI_SPECTRUM_WIDTH_2G;
     }
     // print_usi_table();
-    usi.rssi_histograms_counts = (uint32_t*)malloc(usi.width * sizeof(uint32_t));
-    if (usi.rssi_histograms_counts == NULL) {
+    radio->usi.rssi_histograms_counts = (uint32_t*)malloc(radio->usi.width * sizeof(uint32_t));
+    if (radio->usi.rssi_histograms_counts == NULL) {
         error(MODULE, "UOH, not enough memory!!!");
         return;
     }
-    memset(usi.rssi_histograms_counts, 0, usi.width * sizeof(uint32_t));
-    usi.rssi_histograms = (uint32_t**)malloc(usi.width * sizeof(uint32_t*));
-    if (usi.rssi_histograms == NULL) {
+    memset(radio->usi.rssi_histograms_counts, 0, radio->usi.width * sizeof(uint32_t));
+    radio->usi.rssi_histograms = (uint32_t**)malloc(radio->usi.width * sizeof(uint32_t*));
+    if (radio->usi.rssi_histograms == NULL) {
         error(MODULE, "UOH, not enough memory!!!");
         return;
     }
-    uint32_t* rssi_histogram_data = (uint32_t*) malloc(UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t) * usi.width);
+    uint32_t* rssi_histogram_data = (uint32_t*) malloc(UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t) * radio->usi.width);
     if (rssi_histogram_data == NULL) {
         error(MODULE, "UOH, not enough memory!");
         return;
     }
-    for (i = 0; i < usi.width; i++, rssi_histogram_data += UBNT_RSSI_HISTOGRAM_SIZE) {
-        usi.rssi_histograms[i] = rssi_histogram_data;
-        memset(usi.rssi_histograms[i], 0, UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t));
+    for (i = 0; i < radio->usi.width; i++, rssi_histogram_data += UBNT_RSSI_HISTOGRAM_SIZE) {
+        radio->usi.rssi_histograms[i] = rssi_histogram_data;
+        memset(radio->usi.rssi_histograms[i], 0, UBNT_RSSI_HISTOGRAM_SIZE * sizeof(uint32_t));
+    }
+    radio->mhz_sketches = (struct rssi_sketch *)calloc(radio->usi.width, sizeof(struct rssi_sketch));
+    if (radio->mhz_sketches == NULL) {
+        error(MODULE, "UOH, not enough memory!!!");
+        return;
     }
+    if (spectrum_index_init(&radio->index, radio->usi.width))
+        return;
+    if (snapshot_init(&radio->snap, &radio->usi))
+        return;
     // print_usi_table();
 }
 
 void ubnt_cleanup(mtk_ssd_info_t *pinfo)
 {
-    usi.num_processed = 0;
+    radio->usi.num_processed = 0;
 
-    if (usi.table) {
-        free(usi.table);
-        usi.table = NULL;
-        usi.count = 0;
+    if (radio->usi.table) {
+        free(radio->usi.table);
+        radio->usi.table = NULL;
+        radio->usi.count = 0;
     }
-    if (*usi.rssi_histograms)
-        free(*usi.rssi_histograms);
-    if (usi.rssi_histograms)
-        free(usi.rssi_histograms);
+    if (*radio->usi.rssi_histograms)
+        free(*radio->usi.rssi_histograms);
+    if (radio->usi.rssi_histograms)
+        free(radio->usi.rssi_histograms);
 
-    if (usi.rssi_histograms_counts)
-        free(usi.rssi_histograms_counts);
+    if (radio->usi.rssi_histograms_counts)
+        free(radio->usi.rssi_histograms_counts);
+
+    if (radio->chan_sketches) {
+        free(radio->chan_sketches);
+        radio->chan_sketches = NULL;
+    }
+    if (radio->chan_scanned) {
+        free(radio->chan_scanned);
+        radio->chan_scanned = NULL;
+    }
+    if (radio->occupancy) {
+        free(radio->occupancy);
+        radio->occupancy = NULL;
+    }
+    if (radio->mhz_sketches) {
+        free(radio->mhz_sketches);
+        radio->mhz_sketches = NULL;
+    }
+    spectrum_index_free(&radio->index);
+    snapshot_free(&radio->snap);
 
     if (pinfo->chan_list)
         free(pinfo->chan_list);
@@ -299,21 +719,24 @@ void ubnt_process_spectral_data(mtk_ssd_info_t *pinfo, uint16_t sample_idx)
     struct ath_info iface_info;
 #endif //IF_INFO_4EACH_SAMP
 
-    for (i = 0; i < usi.count; i++) {
-        if (usi.table[i].channel == channel && usi.table[i].chan_width == chan_width) {
+    for (i = 0; i < radio->usi.count; i++) {
+        if (radio->usi.table[i].channel == channel && radio->usi.table[i].chan_width == chan_width) {
             break;
         }
     }
-    if (i == usi.count && !print_once) {
-        warn(MODULE, "%s: unexpected spectral msg chan %d, ch_width %d\n",
-               __func__, channel, chan_width);
-        for (i = 0; i < usi.count; i++)
-            debug(MODULE, "%d %d\n", usi.table[i].channel, usi.table[i].chan_width);
-        print_once = true;
+    if (i == radio->usi.count) {
+        /* the message is logged once, the sample is dropped every time */
+        if (!print_once) {
+            warn(MODULE, "%s: unexpected spectral msg chan %d, ch_width %d\n",
+                   __func__, channel, chan_width);
+            for (i = 0; i < radio->usi.count; i++)
+                debug(MODULE, "%d %d\n", radio->usi.table[i].channel, radio->usi.table[i].chan_width);
+            print_once = true;
+        }
         return;
     }
-    uss = &usi.table[i];
-    freq_center = usi.table[i].freq_center;
+    uss = &radio->usi.table[i];
+    freq_center = radio->usi.table[i].freq_center;
 
     if (ssd->spectral_rssi < 0) {
         /* ignore samples with -ve rssi? */
@@ -337,6 +760,7 @@ void ubnt_process_spectral_data(mtk_ssd_info_t *pinfo, uint16_t sample_idx)
     } else {
         uss->rssi_histogram[ssd->spectral_rssi >> 1]++;
     }
+    rssi_sketch_add(&radio->chan_sketches[uss - radio->usi.table], ssd->spectral_rssi, 1);
 
     /* if histogram counts are about to overflow, divide all
        bins by 2 (effectively giving 50% weightage to previous
@@ -353,7 +777,7 @@ void ubnt_process_spectral_data(mtk_ssd_info_t *pinfo, uint16_t sample_idx)
 #ifdef IF_INFO_4EACH_SAMP
     /* utilization */
     get_athstat(pinfo->radio_ifname, &iface_info);
-    uss->utilization = iface_info.ath_11n_info.cu_total;
+    ubnt_set_channel_utilization(channel, chan_width, iface_info.ath_11n_info.cu_total);
 #endif //IF_INFO_4EACH_SAMP
 
     // if (ssd->bin_pwr_count && !print_once) {
@@ -370,7 +794,8 @@ void ubnt_process_spectral_data(mtk_ssd_info_t *pinfo, uint16_t sample_idx)
         uint32_t freq;
         int32_t  log_bin_pwr;
 
-        if (ssd->bin_pwr[i] == 0)
+        /* weak bins come out negative, keep them in the first histogram bin */
+        if (ssd->bin_pwr[i] <= 0)
             ssd->bin_pwr[i] = 1;
         log_bin_pwr = ssd->bin_pwr[i];
 
@@ -381,15 +806,17 @@ void ubnt_process_spectral_data(mtk_ssd_info_t *pinfo, uint16_t sample_idx)
         } else {
             bin = freq - UBNT_RSSI_SPECTRUM_START_2G;
         }
-        if ((bin < 0) || (bin >= usi.width)) {
+        if ((bin < 0) || (bin >= radio->usi.width)) {
             // outside our range
             continue;
         }
-        usi.rssi_histograms_counts[bin]++;
+        radio->usi.rssi_histograms_counts[bin]++;
         if (log_bin_pwr >= (UBNT_RSSI_HISTOGRAM_SIZE * 2)) {
-            usi.rssi_histograms[bin][UBNT_RSSI_HISTOGRAM_SIZE-1]++;
+            radio->usi.rssi_histograms[bin][UBNT_RSSI_HISTOGRAM_SIZE-1]++;
         } else {
-            usi.rssi_histograms[bin][log_bin_pwr >> 1]++;
+            radio->usi.rssi_histograms[bin][log_bin_pwr >> 1]++;
         }
+        rssi_sketch_add(&radio->mhz_sketches[bin], log_bin_pwr, 1);
+        spectrum_index_add(&radio->index, bin, log_bin_pwr);
     }
 }
@@ -9,6 +9,9 @@
 #include "libubnt/rfscan.h"
 #include "libubnt/log.h"
 
+#include "spectrum_index.h"
+#include "snapshot.h"
+
 
 #define line()          printf("----------------------------------------------------\n")
 
@@ -20,8 +23,10 @@
 #define MAX_NUM_CHANNELS 256
 #define ARRAY_SIZE(ar) (sizeof(ar)/sizeof(ar[0]))
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
 #define FILE_NAME_LEN 64
+#define NUM_SUGGESTED_CHANNELS 4
 
 struct chan_info {
     uint16_t channel;
@@ -52,6 +57,20 @@ struct ubnt_channel_info {
     struct channel_bw_item *ch_list;                             /* channel list */
 };
 
+struct scan_profile;
+struct cpu_budget;
+
+/*
+ * Spectral estimator of process_spectrum_data(), all zero is the plain
+ * one: rectangular windows, no overlap, no averaging.
+ */
+struct psd_cfg {
+    uint8_t window;                                             /* enum psd_window */
+    uint8_t overlap;                                            /* of the segments, in % */
+    uint8_t segments;                                           /* averaged per window, 0 - 1 */
+    uint16_t dft_size;                                          /* per 20 MHz, 0 - PSD_REF_DFT_SIZE */
+};
+
 typedef struct mtk_ssd_info {
     uint8_t max_channels;
     uint8_t channels_in_bw;
@@ -62,6 +81,9 @@ typedef struct mtk_ssd_info {
     struct chan_info *chan_list;
     char   *radio_ifname;
     SPECTRAL_SAMP_DATA *pssd;
+    struct scan_profile *prof;                                  /* NULL - not profiled */
+    struct cpu_budget *budget;                                  /* NULL - not budgeted */
+    struct psd_cfg psd;
 } mtk_ssd_info_t;
 
 
@@ -90,14 +112,54 @@ enum bandwith {
 #define MAX_BW_5G BW_160
 #define BW_QTY(band_5g) ((band_5g) ? MAX_BW_5G : MAX_BW_2G)
 
+struct rssi_sketch;
+struct occupancy;
+
+/* everything accumulated by the scans of one radio */
+struct ubnt_radio {
+    struct ubnt_spectral_info usi;
+    struct rssi_sketch *chan_sketches;                          /* usi.count entries */
+    struct rssi_sketch *mhz_sketches;                           /* usi.width entries */
+    struct spectrum_index index;                                /* per-MHz, for the bonded channels */
+    uint32_t *chan_scanned;                                     /* usi.count entries, uptime of the last scan */
+    struct occupancy *occupancy;                                /* usi.count entries, 20 MHz ones only */
+    struct snapshot_pub snap;                                   /* usi as seen by other threads */
+};
+
 struct ubnt_spectral_info *get_usi_p(void);
+struct ubnt_radio *ubnt_get_radio(void);
+void ubnt_select_radio(struct ubnt_radio *r);
+uint32_t ubnt_uptime(void);
 int ieee80211_channel_to_frequency(int chan, enum nl80211_band band);
 json_t* prepare_spectrum_table(void);
 int ubnt_get_best_channels(const char* radio_ifname, struct channel_bw *best_channels, int num_best_channels);
 void ubnt_process_channel_data(uint16_t channel, uint8_t bw);
 void ubnt_set_channel_utilization(uint16_t channel, uint8_t bw, uint8_t utilization);
 
+struct ubnt_spectral_stats *ubnt_get_channel_stats(uint16_t channel, uint8_t bw);
+void ubnt_mark_channel_scanned(uint16_t channel);
+uint32_t ubnt_get_channel_age(uint16_t channel);
+void ubnt_reset_channel(uint16_t channel);
+void ubnt_clear_scan_data(void);
+void ubnt_age_scan_data(double weight);
+int ubnt_publish_snapshot(bool scanning, bool wait);
+void ubnt_merge_radio(const struct ubnt_radio *src);
+
+int ubnt_get_channel_percentile(uint16_t channel, uint8_t bw, double percentile);
+int ubnt_get_mhz_percentile(uint16_t freq_mhz, double percentile);
+struct rssi_sketch *ubnt_get_channel_sketch(uint16_t channel, uint8_t bw);
+struct rssi_sketch *ubnt_get_mhz_sketches(void);
+struct occupancy *ubnt_get_channel_occupancy(uint16_t channel);
+
+struct spectrum_range_stats;
+int ubnt_bonded_range(uint16_t freq_center, uint8_t bw, enum nl80211_band band_5g,
+                      uint16_t *start, uint16_t *end);
+int ubnt_get_range_stats(uint16_t channel, uint8_t bw, enum nl80211_band band_5g,
+                         struct spectrum_range_stats *stats);
+void ubnt_process_bonded_channels(enum nl80211_band band_5g);
+
 int ubnt_populate_chan_list(char *interface, mtk_ssd_info_t *pinfo, enum nl80211_band band_5g);
+int ubnt_default_chan_list(mtk_ssd_info_t *pinfo, enum nl80211_band band_5g);
 void ubnt_init(uint8_t max_channels, struct chan_info *chan_list, enum nl80211_band band_5g);
 void ubnt_cleanup(mtk_ssd_info_t *pinfo);
 
@@ -0,0 +1,160 @@
+/*
+ * Ubiquiti RF Environment tool - zoom FFT of a sub-band
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "ubnt.h"
+#include "zoom.h"
+
+/* <center MHz>[:<span MHz>], e.g. 2441.5:2 */
+int zoom_parse(struct zoom_cfg *cfg, const char *spec)
+{
+    double center, span = ZOOM_DEFAULT_SPAN_KHZ / 1000.0;
+    struct zoom_cfg parsed;
+
+    if (sscanf(spec, "%lf:%lf", &center, &span) < 1 || center <= 0 || span <= 0)
+        return -1;
+    parsed.center_khz = lround(center * 1000);
+    parsed.span_khz = lround(span * 1000);
+    /* the scan captures 20 MHz */
+    if (!parsed.span_khz || !zoom_decimation(&parsed, 20))
+        return -1;
+    *cfg = parsed;
+    return 0;
+}
+
+/*
+ * The largest decimation that keeps the span within ZOOM_SPAN_PCT of the
+ * decimated band, at most ZOOM_MAX_DECIM. 0 if the span is too wide to
+ * be worth zooming.
+ */
+unsigned int zoom_decimation(const struct zoom_cfg *cfg, unsigned int fs_mhz)
+{
+    unsigned int decim = fs_mhz * 1000 * ZOOM_SPAN_PCT / 100 / cfg->span_khz;
+
+    return decim < 2 ? 0 : MIN(decim, ZOOM_MAX_DECIM);
+}
+
+/* whether a capture at fc_mhz holds the whole span, kept clear of the band edges as well */
+bool zoom_covered(const struct zoom_cfg *cfg, unsigned int fc_mhz, unsigned int fs_mhz)
+{
+    int64_t offset = (int64_t)cfg->center_khz - 1000 * (int64_t)fc_mhz;
+
+    return llabs(offset) + cfg->span_khz / 2 <= fs_mhz * 1000 * ZOOM_SPAN_PCT / 200;
+}
+
+/* drop the accounted spectrum, the settings are kept */
+void zoom_reset(struct zoom_spectrum *zoom)
+{
+    zoom->fs_mhz = 0;
+    zoom->decim = 0;
+    zoom->captures = 0;
+    zoom->segments = 0;
+    memset(zoom->pwr, 0, sizeof(zoom->pwr));
+}
+
+/*
+ * Blackman windowed sinc with its cutoff at the decimated Nyquist
+ * frequency and unity gain at DC, split into its decim phases:
+ * phase r holds taps r, r + decim, r + 2 * decim, ...
+ */
+void zoom_fir_design(struct zoom_fir *fir, unsigned int decim)
+{
+    const unsigned int taps = ZOOM_TAPS_PER_PHASE * decim;
+    double h[ZOOM_MAX_DECIM * ZOOM_TAPS_PER_PHASE], t, sum = 0;
+    unsigned int k, r, j;
+
+    for (k = 0; k < taps; k++) {
+        t = k - (taps - 1) / 2.0;
+        h[k] = t ? sin(M_PI * t / decim) / (M_PI * t) : 1.0 / decim;
+        h[k] *= 0.42 - 0.5 * cos(2 * M_PI * k / (taps - 1)) + 0.08 * cos(4 * M_PI * k / (taps - 1));
+        sum += h[k];
+    }
+    for (r = 0; r < decim; r++) {
+        for (j = 0; j < ZOOM_TAPS_PER_PHASE; j++)
+            fir->coef[r][ZOOM_TAPS_PER_PHASE - 1 - j] = h[j * decim + r] / sum;
+    }
+    fir->decim = decim;
+    zoom_fir_restart(fir);
+}
+
+/* a new gain-stable stretch, the delay lines refill before any output */
+void zoom_fir_restart(struct zoom_fir *fir)
+{
+    fir->head = 0;
+    fir->phase = 0;
+    fir->outputs = 0;
+}
+
+/*
+ * Feed an input sample. Every decim inputs the branches are summed into
+ * one output (out[0] + j out[1]); only the outputs of full delay lines
+ * are returned, 1 then, else 0.
+ *
+ * Input n of a stretch goes to branch (decim - n % decim) % decim, the
+ * output m sums x[m * decim - r - j * decim] * h[j * decim + r] over the
+ * branches r and their taps j.
+ */
+int zoom_fir_push(struct zoom_fir *fir, double re, double im, double *out)
+{
+    const unsigned int branch = fir->phase ? fir->decim - fir->phase : 0;
+    double (*line)[2] = fir->line[branch];
+    const double *coef, (*tap)[2];
+    unsigned int r, j;
+
+    /* kept twice, the taps of a branch read in one run */
+    line[fir->head][0] = line[fir->head + ZOOM_TAPS_PER_PHASE][0] = re;
+    line[fir->head][1] = line[fir->head + ZOOM_TAPS_PER_PHASE][1] = im;
+    if (++fir->phase == fir->decim)
+        fir->phase = 0;
+    if (branch)
+        return 0;
+
+    out[0] = out[1] = 0;
+    for (r = 0; r < fir->decim; r++) {
+        coef = fir->coef[r];
+        tap = &fir->line[r][fir->head + 1];
+        for (j = 0; j < ZOOM_TAPS_PER_PHASE; j++) {
+            out[0] += coef[j] * tap[j][0];
+            out[1] += coef[j] * tap[j][1];
+        }
+    }
+    if (++fir->head == ZOOM_TAPS_PER_PHASE)
+        fir->head = 0;
+    return ++fir->outputs > ZOOM_TAPS_PER_PHASE;
+}
+
+/* resolution of the bins, in Hz */
+static double zoom_res_hz(const struct zoom_spectrum *zoom)
+{
+    return 1e6 * zoom->fs_mhz / zoom->decim / ZOOM_DFT_SIZE;
+}
+
+json_t *zoom_json(const struct zoom_spectrum *zoom)
+{
+    json_t *json = json_object(), *bins;
+    unsigned int half, p;
+    double res_hz;
+
+    json_object_set_new(json, "center_mhz", json_real(zoom->cfg.center_khz / 1000.0));
+    json_object_set_new(json, "span_mhz", json_real(zoom->cfg.span_khz / 1000.0));
+    json_object_set_new(json, "captures", json_integer(zoom->captures));
+    json_object_set_new(json, "segments", json_integer(zoom->segments));
+    if (!zoom->segments)
+        return json;
+
+    /* the bins of the span around the center one, ZOOM_DFT_SIZE / 2 */
+    res_hz = zoom_res_hz(zoom);
+    half = MIN((unsigned int)(zoom->cfg.span_khz * 500.0 / res_hz), ZOOM_DFT_SIZE / 2 - 1);
+    bins = json_array();
+    for (p = ZOOM_DFT_SIZE / 2 - half; p <= ZOOM_DFT_SIZE / 2 + half; p++)
+        json_array_append_new(bins, json_real(round(100 * log10(zoom->pwr[p] / zoom->segments)) / 10));
+    json_object_set_new(json, "decimation", json_integer(zoom->decim));
+    json_object_set_new(json, "res_khz", json_real(round(res_hz / 10) / 100));
+    json_object_set_new(json, "start_mhz", json_real((zoom->cfg.center_khz * 1e3 - half * res_hz) / 1e6));
+    json_object_set_new(json, "bins", bins);
+    return json;
+}
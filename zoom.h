@@ -0,0 +1,65 @@
+#ifndef ZOOM_H
+#define ZOOM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <jansson.h>
+
+/*
+ * Zoom FFT of a narrow sub-band (see process_zoom_data()): the capture is
+ * mixed down to the zoom center, low-pass filtered and decimated by a
+ * polyphase FIR, and the decimated samples go through ZOOM_DFT_SIZE point
+ * FFTs. The decimation is the largest one whose kept band still holds the
+ * span: 2 MHz of a 20 MHz capture are decimated by 7, 11 kHz bins instead
+ * of the 156 kHz of the reference DFT size.
+ *
+ * Bin powers are calibrated as the ones of process_spectrum_data() (to the
+ * reference resolution bandwidth) and averaged over the segments of every
+ * capture whose channel holds the whole span.
+ */
+
+#define ZOOM_DFT_SIZE           256
+#define ZOOM_MAX_DECIM          32
+#define ZOOM_TAPS_PER_PHASE     16                  /* FIR length ZOOM_TAPS_PER_PHASE * decimation */
+/* share of the decimated band kept, the rest is the filter transition */
+#define ZOOM_SPAN_PCT           75
+#define ZOOM_DEFAULT_SPAN_KHZ   2000
+#define ZOOM_FILE_FMT           "/var/run/rftable_%s.zoom"
+
+struct zoom_cfg {
+    uint32_t center_khz;
+    uint32_t span_khz;                              /* 0 - no zoom */
+};
+
+/* decimating low-pass FIR, one branch per phase of the decimation */
+struct zoom_fir {
+    unsigned int decim;                             /* 0 - not designed */
+    unsigned int head;                              /* of the delay lines */
+    unsigned int phase;                             /* of the next input */
+    unsigned int outputs;                           /* since the restart */
+    double coef[ZOOM_MAX_DECIM][ZOOM_TAPS_PER_PHASE];   /* the oldest tap first */
+    double line[ZOOM_MAX_DECIM][2 * ZOOM_TAPS_PER_PHASE][2];
+};
+
+struct zoom_spectrum {
+    struct zoom_cfg cfg;
+    uint16_t fs_mhz;                                /* of the accounted captures */
+    uint16_t decim;
+    uint32_t captures;
+    uint32_t segments;
+    double pwr[ZOOM_DFT_SIZE];                      /* linear sum of the segments, DC in the middle */
+    struct zoom_fir fir;                            /* scratch of process_zoom_data() */
+};
+
+int zoom_parse(struct zoom_cfg *cfg, const char *spec);
+unsigned int zoom_decimation(const struct zoom_cfg *cfg, unsigned int fs_mhz);
+bool zoom_covered(const struct zoom_cfg *cfg, unsigned int fc_mhz, unsigned int fs_mhz);
+void zoom_reset(struct zoom_spectrum *zoom);
+
+void zoom_fir_design(struct zoom_fir *fir, unsigned int decim);
+void zoom_fir_restart(struct zoom_fir *fir);
+int zoom_fir_push(struct zoom_fir *fir, double re, double im, double *out);
+
+json_t *zoom_json(const struct zoom_spectrum *zoom);
+
+#endif //ZOOM_H